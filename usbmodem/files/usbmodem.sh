@@ -19,6 +19,16 @@ proto_usbmodem_init_config() {
 	proto_config_add_string prefer_dhcp
 	proto_config_add_string force_network_restart
 	proto_config_add_string force_network_restart
+	proto_config_add_string at_io_mode
+	proto_config_add_string adaptive_timeouts
+	proto_config_add_string latency_file
+	proto_config_add_string serial_low_latency
+	proto_config_add_string serial_vmin
+	proto_config_add_string serial_vtime
+	proto_config_add_string serial_read_chunk
+	proto_config_add_string cmux
+	proto_config_add_string at_ports
+	proto_config_add_string serial_trace
 	proto_config_add_defaults
 }
 
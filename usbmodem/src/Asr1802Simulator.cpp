@@ -0,0 +1,559 @@
+#include "Asr1802Simulator.h"
+
+#include <sstream>
+
+#include <unistd.h>
+
+#include "Log.h"
+#include "Utils.h"
+#include "AtParser.h"
+
+Asr1802Simulator::Asr1802Simulator() {
+	m_pty.onCommand([=](int, const std::string &cmd) {
+		return handleCommandLine(cmd);
+	});
+}
+
+Asr1802Simulator::~Asr1802Simulator() {
+	stop();
+}
+
+bool Asr1802Simulator::start() {
+	m_stop = false;
+	
+	if (!m_pty.start())
+		return false;
+	
+	m_thread = std::thread([=]() {
+		run();
+	});
+	
+	return true;
+}
+
+void Asr1802Simulator::stop() {
+	m_mutex.lock();
+	m_stop = true;
+	m_timers.clear();
+	m_mutex.unlock();
+	m_cond.notify_all();
+	
+	if (m_thread.joinable())
+		m_thread.join();
+	
+	m_pty.stop();
+}
+
+void Asr1802Simulator::run() {
+	std::unique_lock<std::mutex> lock(m_mutex);
+	
+	while (!m_stop) {
+		if (m_timers.empty()) {
+			m_cond.wait(lock);
+			continue;
+		}
+		
+		auto it = m_timers.begin();
+		int64_t delay = it->first - getCurrentTimestamp();
+		if (delay > 0) {
+			m_cond.wait_for(lock, std::chrono::milliseconds(delay));
+			continue;
+		}
+		
+		auto callback = it->second;
+		m_timers.erase(it);
+		
+		lock.unlock();
+		callback();
+		lock.lock();
+	}
+}
+
+/*
+ * Behaviour
+ * */
+void Asr1802Simulator::setLatency(int latency, int jitter) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_latency = latency;
+	m_jitter = jitter;
+}
+
+void Asr1802Simulator::setAttachDelay(int delay) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_attach_delay = delay;
+}
+
+void Asr1802Simulator::setResponse(const std::string &cmd, const std::string &response) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_responses[cmd] = response;
+}
+
+void Asr1802Simulator::hang(int duration) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_hang_until = getCurrentTimestamp() + duration;
+}
+
+bool Asr1802Simulator::isHanging() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (getCurrentTimestamp() < m_hang_until) {
+		m_stats.dropped++;
+		return true;
+	}
+	return false;
+}
+
+void Asr1802Simulator::emulateLatency() {
+	m_mutex.lock();
+	int delay = m_latency;
+	if (m_jitter > 0) {
+		m_seed = m_seed * 1103515245 + 12345;
+		delay += static_cast<int>((m_seed >> 16) % (m_jitter * 2 + 1)) - m_jitter;
+	}
+	m_mutex.unlock();
+	
+	if (delay > 0)
+		usleep(delay * 1000);
+}
+
+void Asr1802Simulator::sendUrc(const std::string &urc, int delay) {
+	if (delay > 0) {
+		m_mutex.lock();
+		m_timers.emplace(getCurrentTimestamp() + delay, [=]() {
+			sendUrc(urc, 0);
+		});
+		m_mutex.unlock();
+		m_cond.notify_all();
+		return;
+	}
+	
+	if (isHanging())
+		return;
+	
+	m_mutex.lock();
+	m_stats.urcs++;
+	m_mutex.unlock();
+	
+	// Modem sends URC's to first DLC
+	m_pty.send(1, "\r\n" + urc + "\r\n");
+}
+
+void Asr1802Simulator::startUrcStorm(const std::string &urc, int count, int interval) {
+	if (count <= 0)
+		return;
+	
+	sendUrc(urc, 0);
+	
+	m_mutex.lock();
+	m_timers.emplace(getCurrentTimestamp() + interval, [=]() {
+		startUrcStorm(urc, count - 1, interval);
+	});
+	m_mutex.unlock();
+	m_cond.notify_all();
+}
+
+Asr1802Simulator::Stats Asr1802Simulator::getStats() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return m_stats;
+}
+
+/*
+ * Network
+ * */
+std::string Asr1802Simulator::getCregResponse(const std::string &prefix, bool query) {
+	std::string value = query ? "2," : "";
+	
+	if (!m_registered)
+		return prefix + ": " + value + "0";
+	
+	value += "1,\"1A2B\",\"0123ABCD\",7";
+	if (prefix == "+CGREG")
+		value += ",\"01\"";
+	
+	return prefix + ": " + value;
+}
+
+void Asr1802Simulator::setRegistered(bool registered) {
+	m_mutex.lock();
+	bool changed = m_registered != registered;
+	bool was_active = m_pdp_active;
+	m_registered = registered;
+	m_pdp_active = registered;
+	
+	std::vector<std::string> urcs;
+	if (changed) {
+		if (!registered && was_active)
+			urcs.push_back("+CGEV: ME PDN DEACT 1");
+		
+		for (auto prefix: {"+CREG", "+CGREG", "+CEREG"})
+			urcs.push_back(getCregResponse(prefix, false));
+		
+		// Default bearer activated automatically on LTE
+		if (registered)
+			urcs.push_back("+CGEV: ME PDN ACT 1");
+	}
+	m_mutex.unlock();
+	
+	for (auto &urc: urcs)
+		sendUrc(urc);
+}
+
+void Asr1802Simulator::attach() {
+	m_mutex.lock();
+	m_timers.emplace(getCurrentTimestamp() + m_attach_delay, [=]() {
+		m_mutex.lock();
+		bool radio_on = m_radio_on;
+		m_mutex.unlock();
+		
+		if (radio_on)
+			setRegistered(true);
+	});
+	m_mutex.unlock();
+	m_cond.notify_all();
+}
+
+void Asr1802Simulator::detach() {
+	setRegistered(false);
+}
+
+/*
+ * SMS
+ * */
+void Asr1802Simulator::addSmsPart(const std::string &text, int ref, int parts, int seq, bool unread) {
+	std::string ud;
+	if (parts > 1)
+		ud = strprintf("050003%02X%02X%02X", ref & 0xFF, parts, seq);
+	
+	for (uint8_t c: text)
+		ud += strprintf("%04X", c);
+	
+	// SMS-DELIVER, UCS2
+	std::string tpdu = std::string(parts > 1 ? "44" : "04") + "0B919761989901F0" "00" "08" "12504121000021";
+	tpdu += strprintf("%02X", static_cast<int>(ud.size() / 2)) + ud;
+	
+	int index = m_sms.size() > 0 ? m_sms.back().index + 1 : 0;
+	m_sms.push_back({index, unread ? 0 : 1, "07919730071111F1" + tpdu});
+}
+
+void Asr1802Simulator::addSms(const std::string &text, bool unread) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	if (text.size() <= 70) {
+		addSmsPart(text, 0, 1, 1, unread);
+		return;
+	}
+	
+	// 6 bytes of UDH, 67 UCS2 chars per part
+	int parts = (text.size() + 66) / 67;
+	m_sms_ref++;
+	for (int i = 0; i < parts; i++)
+		addSmsPart(text.substr(i * 67, 67), m_sms_ref, parts, i + 1, unread);
+}
+
+void Asr1802Simulator::generateSms(int count) {
+	for (int i = 0; i < count; i++) {
+		std::string text = "Test message #" + std::to_string(i);
+		
+		// Every 5th message is long
+		if (i % 5 == 4) {
+			while (text.size() < 150)
+				text += " Lorem ipsum dolor sit amet.";
+		}
+		
+		addSms(text, i % 3 == 0);
+	}
+}
+
+std::string Asr1802Simulator::getSmsListResponse(int dir) {
+	std::string out;
+	for (auto &sms: m_sms) {
+		if (dir != 4 && sms.stat != dir)
+			continue;
+		out += "\r\n+CMGL: " + std::to_string(sms.index) + "," + std::to_string(sms.stat) + ",," + std::to_string(sms.pdu.size() / 2 - 8) + "\r\n" + sms.pdu;
+	}
+	if (out.size() > 0)
+		out += "\r\n";
+	return out;
+}
+
+/*
+ * Commands
+ * */
+std::string Asr1802Simulator::handleCommandLine(const std::string &cmd) {
+	if (isHanging())
+		return "";
+	
+	m_mutex.lock();
+	m_stats.commands++;
+	std::string echo = m_echo ? cmd + "\r" : "";
+	m_mutex.unlock();
+	
+	emulateLatency();
+	
+	// Chained commands: AT+CMD1;+CMD2;+CMD3
+	std::vector<std::string> commands;
+	bool quoted = false;
+	size_t start = 2;
+	for (size_t i = 2; i <= cmd.size(); i++) {
+		if (i == cmd.size() || (cmd[i] == ';' && !quoted)) {
+			commands.push_back(cmd.substr(start, i - start));
+			start = i + 1;
+		} else if (cmd[i] == '"') {
+			quoted = !quoted;
+		}
+	}
+	
+	std::string response = echo;
+	for (auto &command: commands) {
+		std::string out;
+		if (!handleCommand(command, &out))
+			return response + (out.size() > 0 ? out : "\r\nERROR\r\n");
+		response += out;
+	}
+	
+	return response + "\r\nOK\r\n";
+}
+
+bool Asr1802Simulator::handleCommand(const std::string &cmd, std::string *out) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	auto line = [&](const std::string &value) {
+		*out += "\r\n" + value + "\r\n";
+	};
+	
+	auto it = m_responses.find(cmd);
+	if (it != m_responses.end()) {
+		*out = it->second;
+		return true;
+	}
+	
+	// Arguments of set command, parsed as "+CMD: <args>"
+	size_t eq = cmd.find('=');
+	std::string args_line = eq != std::string::npos ? ": " + cmd.substr(eq + 1) : "";
+	AtParser args(args_line);
+	
+	if (cmd == "" || cmd == "Q0" || cmd == "V1" || cmd == "Z" || cmd == "&F") {
+		return true;
+	} else if (cmd == "E0" || cmd == "E1") {
+		m_echo = cmd == "E1";
+		return true;
+	}
+	
+	/* Identification */
+	else if (cmd == "+CGMI") {
+		line("+CGMI: \"ASR\"");
+		return true;
+	} else if (cmd == "+CGMM") {
+		line("+CGMM: \"ASR1802\"");
+		return true;
+	} else if (cmd == "+CGMR") {
+		line("+CGMR: \"ASR1802_SIMULATOR_1.0\"");
+		return true;
+	} else if (cmd == "+CGSN" || cmd == "+GSN") {
+		line("867400012345678");
+		return true;
+	} else if (cmd == "+CIMI") {
+		line("250011234567890");
+		return true;
+	} else if (cmd == "+CNUM") {
+		line("+CNUM: \"\",\"+79001234567\",145");
+		return true;
+	} else if (cmd == "+CPIN?") {
+		line("+CPIN: READY");
+		return true;
+	}
+	
+	/* Radio and network */
+	else if (cmd == "+CFUN?") {
+		line(m_radio_on ? "+CFUN: 1" : "+CFUN: 4");
+		return true;
+	} else if (strStartsWith(cmd, "+CFUN=")) {
+		int mode = 0;
+		if (!args.parseInt(&mode).success())
+			return false;
+		
+		bool radio_on = mode == 1;
+		if (radio_on != m_radio_on) {
+			m_radio_on = radio_on;
+			m_timers.emplace(getCurrentTimestamp() + (radio_on ? m_attach_delay : 0), [=]() {
+				m_mutex.lock();
+				bool changed = m_radio_on != radio_on;
+				m_mutex.unlock();
+				
+				// Radio switched again while attaching
+				if (!changed)
+					setRegistered(radio_on);
+			});
+			m_cond.notify_all();
+		}
+		return true;
+	} else if (cmd == "+CREG?" || cmd == "+CGREG?" || cmd == "+CEREG?") {
+		line(getCregResponse(cmd.substr(0, cmd.size() - 1), true));
+		return true;
+	} else if (cmd == "+CESQ") {
+		line("+CESQ: 99,99,255,255,20,50");
+		return true;
+	}
+	
+	/* PDP context */
+	else if (cmd == "*CGDFLT=1") {
+		std::string value = "*CGDFLT: \"" + m_pdp_type + "\",\"" + m_pdp_apn + "\"";
+		for (int i = 0; i < 17; i++)
+			value += ",0";
+		line(value + "," + std::to_string(m_pdp_etif));
+		return true;
+	} else if (strStartsWith(cmd, "*CGDFLT=1,")) {
+		// 1, <PDP_type>, <APN>, ..., <etif>
+		std::string type, apn;
+		args.parseSkip().parseString(&type).parseString(&apn);
+		for (int i = 0; i < 17; i++)
+			args.parseSkip();
+		if (!args.parseInt(&m_pdp_etif).success())
+			return false;
+		m_pdp_type = type;
+		m_pdp_apn = apn;
+		return true;
+	} else if (cmd == "*CGDFAUTH?") {
+		line("*CGDFAUTH: " + std::to_string(m_auth_type) + ",\"" + m_auth_user + "\",\"" + m_auth_password + "\"");
+		return true;
+	} else if (strStartsWith(cmd, "*CGDFAUTH=")) {
+		return args.parseSkip().parseInt(&m_auth_type).parseString(&m_auth_user).parseString(&m_auth_password).success();
+	} else if (cmd == "+CGDCONT?") {
+		line("+CGDCONT: 1,\"" + m_pdp_type + "\",\"" + m_pdp_apn + "\",\"" + (m_pdp_active ? "10.20.30.40" : "") + "\",0,0");
+		return true;
+	} else if (strStartsWith(cmd, "+CGDCONT=") || strStartsWith(cmd, "*AUTHReq=")) {
+		return true;
+	} else if (cmd == "+CGCONTRDP=?") {
+		if (m_pdp_active)
+			line("+CGCONTRDP: 1");
+		return true;
+	} else if (strStartsWith(cmd, "+CGCONTRDP=")) {
+		if (!m_pdp_active) {
+			line("+CME ERROR: 3");
+			return false;
+		}
+		line("+CGCONTRDP: 1,5,\"" + m_pdp_apn + "\",\"10.20.30.40\",\"255.255.255.0\",\"10.20.30.1\",\"8.8.8.8\",\"8.8.4.4\"");
+		return true;
+	} else if (strStartsWith(cmd, "+CGDATA=")) {
+		if (!m_registered) {
+			line("NO CARRIER");
+			return false;
+		}
+		m_pdp_active = true;
+		return true;
+	}
+	
+	/* SMS */
+	else if (cmd == "+CPMS=?") {
+		line("+CPMS: (\"SM\",\"ME\"),(\"SM\",\"ME\"),(\"SM\",\"ME\")");
+		return true;
+	} else if (cmd == "+CPMS?") {
+		std::string used = std::to_string(m_sms.size()) + "," + std::to_string(m_sms_total);
+		line("+CPMS: \"ME\"," + used + ",\"ME\"," + used + ",\"ME\"," + used);
+		return true;
+	} else if (strStartsWith(cmd, "+CPMS=")) {
+		std::string used = std::to_string(m_sms.size()) + "," + std::to_string(m_sms_total);
+		line("+CPMS: " + used + "," + used + "," + used);
+		return true;
+	} else if (strStartsWith(cmd, "+CMGL=")) {
+		int dir = 4;
+		if (!args.parseInt(&dir).success())
+			return false;
+		*out += getSmsListResponse(dir);
+		return true;
+	} else if (strStartsWith(cmd, "+CMGD=")) {
+		int index = -1;
+		args.parseInt(&index);
+		for (auto it = m_sms.begin(); it != m_sms.end(); it++) {
+			if (it->index == index) {
+				m_sms.erase(it);
+				return true;
+			}
+		}
+		line("+CMS ERROR: 321");
+		return false;
+	}
+	
+	/* USSD */
+	else if (strStartsWith(cmd, "+CUSD=1,")) {
+		std::string code;
+		if (!args.parseSkip().parseString(&code).success())
+			return false;
+		
+		std::string reply;
+		for (uint8_t c: "Balance for " + code + ": 100.00")
+			reply += strprintf("%04X", c);
+		
+		m_timers.emplace(getCurrentTimestamp() + m_latency + 300, [=]() {
+			sendUrc("+CUSD: 0,\"" + reply + "\",72");
+		});
+		m_cond.notify_all();
+		return true;
+	}
+	
+	// Other settings (+CMEE, +CREG, +CNMI, ...) are accepted as is
+	return eq != std::string::npos && cmd.back() != '?';
+}
+
+/*
+ * Script
+ * */
+bool Asr1802Simulator::runScript(const std::string &script) {
+	std::istringstream stream(script);
+	std::string line;
+	int line_number = 0;
+	
+	while (std::getline(stream, line)) {
+		line_number++;
+		line = trim(line);
+		
+		if (!line.size() || line[0] == '#')
+			continue;
+		
+		std::istringstream args(line);
+		std::string action;
+		args >> action;
+		
+		auto rest = [&]() {
+			std::string value;
+			std::getline(args, value);
+			return trim(value);
+		};
+		
+		if (action == "wait") {
+			int ms = 0;
+			args >> ms;
+			usleep(ms * 1000);
+		} else if (action == "latency") {
+			int latency = 0, jitter = 0;
+			args >> latency >> jitter;
+			setLatency(latency, jitter);
+		} else if (action == "attach_delay") {
+			int delay = 0;
+			args >> delay;
+			setAttachDelay(delay);
+		} else if (action == "hang") {
+			int ms = 0;
+			args >> ms;
+			hang(ms);
+		} else if (action == "urc") {
+			sendUrc(rest());
+		} else if (action == "storm") {
+			int count = 0, interval = 0;
+			args >> count >> interval;
+			startUrcStorm(rest(), count, interval);
+		} else if (action == "sms") {
+			int count = 0;
+			args >> count;
+			generateSms(count);
+		} else if (action == "detach") {
+			detach();
+		} else if (action == "attach") {
+			attach();
+		} else {
+			LOGE("Script error at line %d: %s\n", line_number, line.c_str());
+			return false;
+		}
+	}
+	
+	return true;
+}
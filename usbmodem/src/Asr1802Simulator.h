@@ -0,0 +1,127 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "CmuxLoopback.h"
+
+/*
+ * ASR1802 modem emulator over PTY (plain AT or CMUX), for load and latency testing without hardware
+ * Implements AT dialect used by ModemAsr1802: registration, PDP context, *CGDFLT, SMS storage, USSD.
+ * Behaviour is scriptable: response latency, URC storms, network detach and modem hangs.
+ * */
+class Asr1802Simulator {
+	public:
+		struct Stats {
+			uint64_t commands;
+			uint64_t urcs;
+			uint64_t dropped;
+		};
+	protected:
+		struct Sms {
+			int index;
+			int stat;
+			std::string pdu;
+		};
+		
+		CmuxLoopback m_pty;
+		
+		std::mutex m_mutex;
+		std::condition_variable m_cond;
+		std::thread m_thread;
+		bool m_stop = false;
+		
+		// Delayed actions (URCs, network state changes), key is timestamp
+		std::multimap<int64_t, std::function<void()>> m_timers;
+		
+		// Modem state
+		bool m_echo = true;
+		bool m_radio_on = false;
+		bool m_registered = false;
+		bool m_pdp_active = false;
+		std::string m_pdp_type = "IP";
+		std::string m_pdp_apn = "internet";
+		int m_pdp_etif = 0;
+		int m_auth_type = 0;
+		std::string m_auth_user;
+		std::string m_auth_password;
+		
+		std::vector<Sms> m_sms;
+		int m_sms_ref = 0;
+		int m_sms_total = 100;
+		
+		std::map<std::string, std::string> m_responses;
+		
+		// Behaviour
+		int m_latency = 0;
+		int m_jitter = 0;
+		int m_attach_delay = 500;
+		int64_t m_hang_until = 0;
+		uint32_t m_seed = 1;
+		
+		Stats m_stats = {};
+		
+		void run();
+		std::string handleCommandLine(const std::string &cmd);
+		bool handleCommand(const std::string &cmd, std::string *out);
+		bool isHanging();
+		void emulateLatency();
+		
+		void setRegistered(bool registered);
+		std::string getCregResponse(const std::string &prefix, bool query);
+		std::string getSmsListResponse(int dir);
+		void addSmsPart(const std::string &text, int ref, int parts, int seq, bool unread);
+	public:
+		Asr1802Simulator();
+		~Asr1802Simulator();
+		
+		Asr1802Simulator(const Asr1802Simulator &) = delete;
+		Asr1802Simulator &operator=(const Asr1802Simulator &) = delete;
+		
+		bool start();
+		void stop();
+		
+		inline const std::string &getTty() {
+			return m_pty.getTty();
+		}
+		
+		// Delay before each response: latency +- random jitter (ms)
+		void setLatency(int latency, int jitter = 0);
+		
+		// Delay between AT+CFUN=1 and network registration (ms)
+		void setAttachDelay(int delay);
+		
+		// Custom response for command (without "AT" and final "OK")
+		void setResponse(const std::string &cmd, const std::string &response);
+		
+		// Store SMS, long text split to concatenated parts (ASCII only)
+		void addSms(const std::string &text, bool unread = false);
+		void generateSms(int count);
+		
+		// Unsolicited result code, optionally delayed
+		void sendUrc(const std::string &urc, int delay = 0);
+		
+		// Send count URCs with interval between them
+		void startUrcStorm(const std::string &urc, int count, int interval);
+		
+		// Stop answering commands and sending URCs for some time
+		void hang(int duration);
+		
+		// Network lost / returned
+		void detach();
+		void attach();
+		
+		/*
+		 * Run script, one action per line:
+		 *   wait <ms>, latency <ms> [jitter], attach_delay <ms>, hang <ms>, urc <line>,
+		 *   storm <count> <interval> <line>, sms <count>, detach, attach
+		 * */
+		bool runScript(const std::string &script);
+		
+		Stats getStats();
+};
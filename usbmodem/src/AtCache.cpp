@@ -0,0 +1,133 @@
+#include "AtCache.h"
+
+#include "Log.h"
+#include "Utils.h"
+
+void AtCache::setTtl(const std::string &cmd, int ttl) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	if (ttl > 0) {
+		m_ttl[cmd] = ttl;
+	} else {
+		m_ttl.erase(cmd);
+		m_entries.erase(cmd);
+	}
+}
+
+bool AtCache::isCacheable(AtChannel::ResultType type, const std::string &prefix) {
+	// Without prefix any line is accepted as response
+	return type != AtChannel::NO_PREFIX && type != AtChannel::CHAINED && prefix.size() > 0;
+}
+
+bool AtCache::lookup(AtChannel::ResultType type, const std::string &cmd, const std::string &prefix, AtChannel::Response *response) {
+	if (!isCacheable(type, prefix))
+		return false;
+	
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	if (m_ttl.find(cmd) == m_ttl.end())
+		return false;
+	
+	// Same command with other response type is other result
+	auto it = m_entries.find(cmd);
+	if (it == m_entries.end() || it->second.type != type || it->second.prefix != prefix || it->second.expires <= getCurrentTimestamp()) {
+		m_misses++;
+		return false;
+	}
+	
+	m_hits++;
+	*response = it->second.response;
+	
+	return true;
+}
+
+void AtCache::store(AtChannel::ResultType type, const std::string &cmd, const std::string &prefix, const AtChannel::Response &response) {
+	if (response.error != AtChannel::AT_SUCCESS || !isCacheable(type, prefix))
+		return;
+	
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	auto ttl = m_ttl.find(cmd);
+	if (ttl == m_ttl.end())
+		return;
+	
+	auto &entry = m_entries[cmd];
+	entry.type = type;
+	entry.prefix = prefix;
+	entry.response = response;
+	entry.expires = getCurrentTimestamp() + ttl->second;
+}
+
+std::string AtCache::getBaseCommand(const std::string &cmd) {
+	std::string family = AtChannel::getCommandFamily(cmd);
+	
+	// +CGDCONT=, +CGDCONT? -> +CGDCONT
+	while (family.size() > 0 && (family.back() == '=' || family.back() == '?'))
+		family.pop_back();
+	
+	return family;
+}
+
+void AtCache::handleCommand(const std::string &cmd) {
+	m_mutex.lock();
+	bool empty = m_entries.empty();
+	m_mutex.unlock();
+	
+	if (empty)
+		return;
+	
+	// Every command of chain: AT+CMD1=1;+CMD2=2
+	size_t start = 0;
+	while (start < cmd.size()) {
+		size_t end = std::min(cmd.find(';', start), cmd.size());
+		std::string part = cmd.substr(start, end - start);
+		start = end + 1;
+		
+		if (!strStartsWith(part, "AT"))
+			part = "AT" + part;
+		
+		// Only set commands changes something, test commands are not writes
+		std::string family = AtChannel::getCommandFamily(part);
+		if (family.size() < 2 || family.back() != '=')
+			continue;
+		
+		// Radio state changes everything
+		if (family == "+CFUN=") {
+			invalidate();
+		} else {
+			invalidate(getBaseCommand(part));
+		}
+	}
+}
+
+void AtCache::invalidate() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_invalidations += m_entries.size();
+	m_entries.clear();
+}
+
+void AtCache::invalidate(const std::string &base) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	for (auto it = m_entries.begin(); it != m_entries.end(); ) {
+		// Supported values (AT+CMD=?) don't depend on current value
+		if (AtChannel::getCommandFamily(it->first) != base + "=?" && getBaseCommand(it->first) == base) {
+			m_invalidations++;
+			it = m_entries.erase(it);
+		} else {
+			it++;
+		}
+	}
+}
+
+AtCache::Stats AtCache::getStats() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	return {m_hits, m_misses, m_invalidations, static_cast<uint32_t>(m_entries.size())};
+}
+
+void AtCache::resetStats() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_hits = 0;
+	m_misses = 0;
+	m_invalidations = 0;
+}
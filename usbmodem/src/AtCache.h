@@ -0,0 +1,57 @@
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <cstdint>
+
+#include "AtChannel.h"
+
+/*
+ * TTL cache of AT responses, keyed by exact command string
+ * Can be shared by several channels of same modem, so write on any port invalidates reads on all.
+ * Only commands with configured TTL are cached.
+ * Responses without prefix are never cached, they can contain interleaved URC's.
+ * */
+class AtCache {
+	public:
+		struct Stats {
+			uint64_t hits;
+			uint64_t misses;
+			uint64_t invalidations;
+			uint32_t entries;
+		};
+	protected:
+		struct Entry {
+			AtChannel::ResultType type;
+			std::string prefix;
+			AtChannel::Response response;
+			int64_t expires;
+		};
+		
+		std::map<std::string, int> m_ttl;
+		std::map<std::string, Entry> m_entries;
+		std::mutex m_mutex;
+		
+		uint64_t m_hits = 0;
+		uint64_t m_misses = 0;
+		uint64_t m_invalidations = 0;
+		
+		static std::string getBaseCommand(const std::string &cmd);
+		static bool isCacheable(AtChannel::ResultType type, const std::string &prefix);
+	public:
+		// TTL in ms, 0 - don't cache
+		void setTtl(const std::string &cmd, int ttl);
+		
+		bool lookup(AtChannel::ResultType type, const std::string &cmd, const std::string &prefix, AtChannel::Response *response);
+		void store(AtChannel::ResultType type, const std::string &cmd, const std::string &prefix, const AtChannel::Response &response);
+		
+		// Called for every command sent to modem (including chains): writes invalidates cached reads of same command
+		void handleCommand(const std::string &cmd);
+		
+		void invalidate();
+		void invalidate(const std::string &base);
+		
+		Stats getStats();
+		void resetStats();
+};
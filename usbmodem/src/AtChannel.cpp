@@ -1,39 +1,138 @@
 #include "AtChannel.h"
-#include "AtParser.h"
+#include "AtCache.h"
+#include "AtSchema.h"
+#include "Loop.h"
 
 #include <signal.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <algorithm>
 #include <stdexcept>
 
 const std::string AtChannel::empty_line;
-			
+
+/*
+ * Pool of response buffers
+ * */
+struct ResponseStorage {
+	std::string buffer;
+	std::vector<uint32_t> offsets;
+};
+
+static constexpr size_t RESPONSE_POOL_SIZE = 8;
+static constexpr size_t RESPONSE_POOL_MAX_BUFFER = 64 * 1024;
+static constexpr size_t RESPONSE_DEFAULT_BUFFER = 256;
+
+static std::mutex response_pool_mutex;
+static std::vector<ResponseStorage> response_pool;
+
+void AtChannel::Response::acquireStorage() {
+	m_pooled = true;
+	
+	response_pool_mutex.lock();
+	if (response_pool.size() > 0) {
+		m_buffer = std::move(response_pool.back().buffer);
+		m_offsets = std::move(response_pool.back().offsets);
+		response_pool.pop_back();
+	}
+	response_pool_mutex.unlock();
+	
+	if (m_buffer.capacity() < RESPONSE_DEFAULT_BUFFER)
+		m_buffer.reserve(RESPONSE_DEFAULT_BUFFER);
+}
+
+void AtChannel::Response::releaseStorage() {
+	// Never had storage or moved-out
+	if (!m_pooled)
+		return;
+	
+	m_pooled = false;
+	
+	if (m_buffer.capacity() > RESPONSE_POOL_MAX_BUFFER)
+		return;
+	
+	m_buffer.clear();
+	m_offsets.clear();
+	
+	response_pool_mutex.lock();
+	if (response_pool.size() < RESPONSE_POOL_SIZE)
+		response_pool.push_back({std::move(m_buffer), std::move(m_offsets)});
+	response_pool_mutex.unlock();
+}
+
+void AtChannel::Response::copyLines(const Response &other) {
+	if (!other.m_offsets.size()) {
+		clear();
+		return;
+	}
+	
+	// Copy to own pooled storage
+	if (!m_pooled)
+		acquireStorage();
+	
+	m_buffer.assign(other.m_buffer);
+	m_offsets.assign(other.m_offsets.begin(), other.m_offsets.end());
+}
+
+void AtChannel::Response::addLine(std::string_view line) {
+	if (!m_pooled)
+		acquireStorage();
+	
+	m_offsets.push_back(m_buffer.size());
+	m_buffer.append(line).push_back('\0');
+}
+
+void AtChannel::Response::appendToLastLine(std::string_view line) {
+	if (!m_offsets.size()) {
+		addLine(line);
+		return;
+	}
+	
+	// Replace terminator of last line
+	m_buffer.pop_back();
+	m_buffer.append("\r\n").append(line).push_back('\0');
+}
+
+void AtChannel::Response::clear() {
+	m_buffer.clear();
+	m_offsets.clear();
+}
+
+std::vector<std::string> AtChannel::Response::lines() const {
+	std::vector<std::string> out;
+	out.reserve(linesCount());
+	for (size_t i = 0; i < linesCount(); i++)
+		out.emplace_back(lineView(i));
+	return out;
+}
+
 const int AtChannel::Response::getCmeError() const {
 	if (strStartsWith(status, "+CME ERROR")) {
-		int error;
-		if (AtParser(status).parseInt(&error).success())
-			return error;
+		auto error = AtSchema<AtField::Int>::parse(status);
+		if (error)
+			return std::get<0>(*error);
 	}
 	return -1;
 }
 
 const int AtChannel::Response::getCmsError() const {
 	if (strStartsWith(status, "+CMS ERROR")) {
-		int error;
-		if (AtParser(status).parseInt(&error).success())
-			return error;
+		auto error = AtSchema<AtField::Int>::parse(status);
+		if (error)
+			return std::get<0>(*error);
 	}
 	return -1;
 }
 
 AtChannel::AtChannel() {
-	if (sem_init(&at_cmd_sem, 0, 0) != 0) {
-		LOGE("sem_init() failed, errno = %d\n", errno);
-		throw std::runtime_error("sem_init fatal error");
-	}
+	
 }
 
 AtChannel::~AtChannel() {
-	
+	if (m_loop_started)
+		stopLoopIo();
+	uloop_timeout_cancel(&m_complete_timeout.timeout);
+	stopUnsolicitedQueue();
 }
 
 void *AtChannel::readerThread(void *arg) {
@@ -43,19 +142,33 @@ void *AtChannel::readerThread(void *arg) {
 }
 
 bool AtChannel::start() {
+	// In loop mode handlers are never called while serial is read, sync commands in handlers would nest reading
+	if ((m_unsol_on_loop || m_io_mode == IO_LOOP) && !startUnsolicitedQueue())
+		return false;
+	
+	if (m_io_mode == IO_LOOP)
+		return startLoopIo();
+	
 	if (!m_at_thread_created) {
+		m_stop = false;
+		
 		// Run AT channel
 		if (pthread_create(&m_at_thread, nullptr, readerThread, this) != 0) {
 			LOGD("Can't create readerloop thread, errno=%d\n", errno);
 			return false;
 		}
-		m_stop = false;
 		m_at_thread_created = true;
 	}
 	return true;
 }
 
 void AtChannel::stop() {
+	if (m_io_mode == IO_LOOP) {
+		stopLoopIo();
+		stopUnsolicitedQueue();
+		return;
+	}
+	
 	if (m_at_thread_created) {
 		m_stop = true;
 		
@@ -67,23 +180,153 @@ void AtChannel::stop() {
 		
 		m_at_thread_created = false;
 	}
+	
+	stopUnsolicitedQueue();
+	
+	// Reader loop is not running, nobody can finish pending commands
+	abortAllRequests(AT_IO_BROKEN);
 }
 
 void AtChannel::onUnsolicited(const std::string &prefix, const std::function<void(const std::string &)> &handler) {
-	m_unsol_handlers.push_back({.prefix = prefix, .handler = handler});
+	m_unsol_mutex.lock();
+	
+	int node = 0;
+	for (auto c: prefix) {
+		int next = -1;
+		for (auto &child: m_unsol_trie[node].children) {
+			if (child.first == c) {
+				next = child.second;
+				break;
+			}
+		}
+		
+		if (next < 0) {
+			next = m_unsol_trie.size();
+			m_unsol_trie[node].children.push_back({c, next});
+			m_unsol_trie.emplace_back();
+		}
+		
+		node = next;
+	}
+	
+	m_unsol_trie[node].prefix = prefix;
+	m_unsol_trie[node].handlers.push_back(handler);
+	
+	m_unsol_mutex.unlock();
 }
 
 void AtChannel::resetUnsolicitedHandlers() {
-	m_unsol_handlers.clear();
+	m_unsol_mutex.lock();
+	m_unsol_trie.clear();
+	m_unsol_trie.resize(1);
+	m_unsol_mutex.unlock();
 }
 
-void AtChannel::readerLoop() {
-	char tmp[256];
+std::map<std::string, uint64_t> AtChannel::getUnsolicitedStats() {
+	std::map<std::string, uint64_t> stats;
+	
+	m_unsol_mutex.lock();
+	for (auto &node: m_unsol_trie) {
+		if (node.handlers.size() > 0)
+			stats[node.prefix] = node.dispatched;
+	}
+	m_unsol_mutex.unlock();
+	
+	return stats;
+}
+
+/*
+ * Metrics
+ * */
+void AtChannel::addBytesRead(int size) {
+	std::lock_guard<std::mutex> lock(m_stats_mutex);
+	m_bytes_read += size;
+}
+
+void AtChannel::addCommandStats(const std::shared_ptr<Request> &request) {
+	Errors error = request->response.error;
+	int64_t now = getCurrentTimestamp();
 	
+	std::lock_guard<std::mutex> lock(m_stats_mutex);
+	
+	auto &stats = m_cmd_stats[request->family];
+	stats.count++;
+	
+	if (error == AT_TIMEOUT) {
+		stats.timeouts++;
+	} else if (error != AT_SUCCESS) {
+		stats.errors++;
+	}
+	
+	stats.queue_wait.add(request->start - request->queued);
+	
+	if (request->written) {
+		stats.bytes_written += request->cmd.size() + 1;
+		stats.bytes_read += request->bytes_read;
+		stats.write_time.add(request->written - request->start);
+		stats.response_time.add(now - request->written);
+	}
+}
+
+AtChannel::Stats AtChannel::getStats() {
+	Stats stats;
+	
+	m_stats_mutex.lock();
+	stats.elapsed = getCurrentTimestamp() - m_stats_start;
+	stats.bytes_read = m_bytes_read;
+	stats.bytes_written = m_bytes_written;
+	stats.commands = m_cmd_stats;
+	m_stats_mutex.unlock();
+	
+	m_unsol_mutex.lock();
+	stats.unsolicited = m_unsol_count;
+	m_unsol_mutex.unlock();
+	
+	stats.unsolicited_handlers = getUnsolicitedStats();
+	
+	for (int i = 0; i < PRIORITY_MAX; i++)
+		stats.queues[i] = getQueueStats(static_cast<Priority>(i));
+	
+	m_queue_mutex.lock();
+	stats.coalesced = m_coalesced;
+	m_queue_mutex.unlock();
+	
+	return stats;
+}
+
+void AtChannel::resetStats() {
+	m_stats_mutex.lock();
+	m_cmd_stats.clear();
+	m_bytes_read = 0;
+	m_bytes_written = 0;
+	m_stats_start = getCurrentTimestamp();
+	m_stats_mutex.unlock();
+	
+	m_unsol_mutex.lock();
+	m_unsol_count = 0;
+	for (auto &node: m_unsol_trie)
+		node.dispatched = 0;
+	m_unsol_mutex.unlock();
+	
+	m_queue_mutex.lock();
+	for (auto &stats: m_queue_stats)
+		stats = {};
+	m_coalesced = 0;
+	m_queue_mutex.unlock();
+}
+
+void AtChannel::readerLoop() {
 	m_stop = false;
+	m_framer.reset();
 	
 	while (!m_stop) {
-		int readed = m_serial->readChunk(tmp, sizeof(tmp), 30000);
+		checkCancel();
+		
+		// Send next command from queue
+		if (!m_curr_request)
+			sendNextRequest();
+		
+		int readed = m_serial->readChunk(m_framer.writePtr(), m_framer.writeAvail(), getReadTimeout());
 		if (m_stop)
 			break;
 		
@@ -91,38 +334,163 @@ void AtChannel::readerLoop() {
 		if (readed == Serial::ERR_BROKEN) {
 			m_stop = true;
 			
-			if (m_curr_response) {
-				m_curr_response->error = AT_IO_BROKEN;
-				postAtCmdSem();
-			}
+			if (m_curr_request)
+				finishRequest(AT_IO_BROKEN);
 			
 			if (m_broken_io_handler)
 				m_broken_io_handler();
 		}
 		
+		// Woken up by new command in queue
+		if (readed == Serial::ERR_INTR)
+			continue;
+		
 		if (readed < 0) {
 			LOGE("Serial::readChunk error: %d\n", readed);
 			continue;
 		}
 		
-		for (int i = 0; i < readed; i++) {
-			m_buffer += tmp[i];
-			if (strHasEol(m_buffer)) {
-				// Trim \r\n at end
-				m_buffer.erase(m_buffer.size() - 2);
-				
-				// Hande line if not empty after trim
-				if (m_buffer.size() > 0)
-					handleLine();
-				
-				// Reset buffer
-				m_buffer = "";
-			}
-		}
+		addBytesRead(readed);
+		
+		m_framer.commit(readed, [this](std::string_view line) {
+			handleLine(line);
+		});
+		
+		checkRequestTimeout();
+	}
+	
+	if (m_curr_request)
+		finishRequest(AT_IO_BROKEN);
+	
+	abortAllRequests(AT_IO_BROKEN);
+}
+
+/*
+ * Loop mode
+ * Serial fd handled by uloop, all commands and events processed in Loop thread.
+ * */
+bool AtChannel::startLoopIo() {
+	if (m_loop_started)
+		return true;
+	
+	m_stop = false;
+	m_framer.reset();
+	
+	m_uloop_fd.self = this;
+	m_uloop_fd.fd.fd = m_serial->getFd();
+	m_uloop_fd.fd.cb = uloopReadHandler;
+	
+	m_request_timeout.self = this;
+	m_request_timeout.timeout.cb = uloopRequestTimeoutHandler;
+	
+	m_complete_timeout.self = this;
+	m_complete_timeout.timeout.cb = uloopCompleteHandler;
+	
+	if (uloop_fd_add(&m_uloop_fd.fd, ULOOP_READ) < 0) {
+		LOGE("uloop_fd_add() failed\n");
+		return false;
+	}
+	
+	m_loop_started = true;
+	
+	return true;
+}
+
+void AtChannel::stopLoopIo() {
+	m_stop = true;
+	
+	if (m_loop_started) {
+		uloop_fd_delete(&m_uloop_fd.fd);
+		uloop_timeout_cancel(&m_request_timeout.timeout);
+		m_loop_started = false;
+	}
+	
+	if (m_curr_request)
+		finishRequest(AT_IO_BROKEN);
+	
+	abortAllRequests(AT_IO_BROKEN);
+}
+
+bool AtChannel::isInsideReader() {
+	if (m_io_mode == IO_LOOP)
+		return m_in_reader;
+	return m_at_thread_created && pthread_equal(pthread_self(), m_at_thread);
+}
+
+void AtChannel::scheduleLoopIo() {
+	if (!m_curr_request)
+		sendNextRequest();
+	
+	if (m_curr_request || isResyncActive()) {
+		uloop_timeout_set(&m_request_timeout.timeout, getReadTimeout());
+	} else {
+		uloop_timeout_cancel(&m_request_timeout.timeout);
+	}
+}
+
+int AtChannel::pumpLoopIo(int timeout) {
+	int readed = m_serial->readChunk(m_framer.writePtr(), m_framer.writeAvail(), timeout);
+	
+	// Serial device lost
+	if (readed == Serial::ERR_BROKEN) {
+		stopLoopIo();
+		
+		if (m_broken_io_handler)
+			m_broken_io_handler();
+		
+		return readed;
+	}
+	
+	m_in_reader = true;
+	
+	if (readed > 0) {
+		addBytesRead(readed);
+		
+		m_framer.commit(readed, [this](std::string_view line) {
+			handleLine(line);
+		});
+	} else if (readed < 0 && readed != Serial::ERR_INTR) {
+		LOGE("Serial::readChunk error: %d\n", readed);
 	}
+	
+	checkRequestTimeout();
+	
+	m_in_reader = false;
+	
+	return readed;
+}
+
+void AtChannel::uloopReadHandler(uloop_fd *fd, unsigned int) {
+	AtChannel *self = reinterpret_cast<UloopFd *>(fd)->self;
+	self->pumpLoopIo(0);
+	self->scheduleLoopIo();
+}
+
+void AtChannel::uloopRequestTimeoutHandler(uloop_timeout *timeout) {
+	AtChannel *self = reinterpret_cast<UloopTimeout *>(timeout)->self;
+	self->checkRequestTimeout();
+	self->scheduleLoopIo();
 }
 
-bool AtChannel::isErrorResponse(const std::string &line, bool dial) {
+void AtChannel::uloopCompleteHandler(uloop_timeout *timeout) {
+	AtChannel *self = reinterpret_cast<UloopTimeout *>(timeout)->self;
+	
+	auto completed = std::move(self->m_completed);
+	self->m_completed.clear();
+	
+	for (auto &request: completed)
+		self->runRequestCallback(request);
+}
+
+int AtChannel::getReadTimeout() {
+	if (m_curr_request)
+		return getNewTimeout(m_curr_request->start, m_curr_request->timeout);
+	if (isResyncActive())
+		return std::max<int64_t>(m_resync_until - getCurrentTimestamp(), 0);
+	return 30000;
+}
+
+bool AtChannel::isErrorResponse(std::string_view line, bool dial) {
 	if (strStartsWith(line, "ERROR") || strStartsWith(line, "+CMS ERROR") || strStartsWith(line, "+CME ERROR"))
 		return true;
 	
@@ -134,7 +502,7 @@ bool AtChannel::isErrorResponse(const std::string &line, bool dial) {
 	return false;
 }
 
-bool AtChannel::isSuccessResponse(const std::string &line, bool dial) {
+bool AtChannel::isSuccessResponse(std::string_view line, bool dial) {
 	if (strStartsWith(line, "OK"))
 		return true;
 	
@@ -146,20 +514,190 @@ bool AtChannel::isSuccessResponse(const std::string &line, bool dial) {
 	return false;
 }
 
-void AtChannel::handleUnsolicitedLine() {
+bool AtChannel::startUnsolicitedQueue() {
+	if (m_unsol_waker_w != -1)
+		return true;
+	
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+		LOGE("pipe() failed, errno = %d\n", errno);
+		return false;
+	}
+	
+	m_unsol_waker_r.self = this;
+	m_unsol_waker_r.fd.fd = fds[0];
+	m_unsol_waker_r.fd.cb = uloopUnsolicitedHandler;
+	
+	if (uloop_fd_add(&m_unsol_waker_r.fd, ULOOP_READ) < 0) {
+		LOGE("uloop_fd_add() failed\n");
+		close(fds[0]);
+		close(fds[1]);
+		return false;
+	}
+	
+	m_unsol_waker_w = fds[1];
+	m_unsol_wakeup = false;
+	
+	return true;
+}
+
+void AtChannel::stopUnsolicitedQueue() {
+	if (m_unsol_waker_w == -1)
+		return;
+	
+	uloop_fd_delete(&m_unsol_waker_r.fd);
+	close(m_unsol_waker_r.fd.fd);
+	close(m_unsol_waker_w);
+	m_unsol_waker_w = -1;
+	
+	// Reader is stopped, drop not handled lines
+	while (m_unsol_queue.front())
+		m_unsol_queue.pop();
+	
+	m_unsol_overflow_mutex.lock();
+	m_unsol_overflow.clear();
+	m_unsol_overflowed = false;
+	m_unsol_overflow_mutex.unlock();
+	m_unsol_pending.clear();
+}
+
+void AtChannel::uloopUnsolicitedHandler(uloop_fd *fd, unsigned int) {
+	AtChannel *self = reinterpret_cast<UloopFd *>(fd)->self;
+	
+	char buf[64];
+	while (true) {
+		int ret = read(fd->fd, buf, sizeof(buf));
+		if (ret > 0 || (ret < 0 && errno == EINTR))
+			continue;
+		break;
+	}
+	
+	self->drainUnsolicitedQueue();
+}
+
+void AtChannel::queueUnsolicitedLine(std::string_view line) {
+	std::string *slot = m_unsol_overflowed ? nullptr : m_unsol_queue.back();
+	
+	if (slot) {
+		slot->assign(line.data(), line.size());
+		m_unsol_queue.push();
+	} else {
+		// Queue is full, Loop is busy (or blocked by sync command)
+		m_unsol_overflow_mutex.lock();
+		m_unsol_overflow.emplace_back(line);
+		m_unsol_overflowed = true;
+		m_unsol_overflow_mutex.unlock();
+	}
+	
+	// One wakeup for all lines queued until Loop starts draining
+	if (!m_unsol_wakeup.exchange(true))
+		while (write(m_unsol_waker_w, "w", 1) < 0 && errno == EINTR);
+}
+
+void AtChannel::drainUnsolicitedQueue() {
+	m_unsol_wakeup = false;
+	
+	// Limited batch, so URC storm doesn't delay other Loop events
+	size_t budget = UNSOL_QUEUE_SIZE;
+	
+	while (budget > 0) {
+		// Overflowed lines are newer than lines queued before overflow, but older than queued after
+		if (m_unsol_pending.size() > 0) {
+			dispatchUnsolicitedLine(m_unsol_pending.front());
+			m_unsol_pending.pop_front();
+			budget--;
+			continue;
+		}
+		
+		std::string *line = m_unsol_queue.front();
+		if (line) {
+			dispatchUnsolicitedLine(*line);
+			m_unsol_queue.pop();
+			budget--;
+			continue;
+		}
+		
+		// Queue is empty and producer writes only to overflow, until flag is cleared
+		if (!m_unsol_overflowed)
+			return;
+		
+		m_unsol_overflow_mutex.lock();
+		m_unsol_pending.swap(m_unsol_overflow);
+		m_unsol_overflowed = false;
+		m_unsol_overflow_mutex.unlock();
+	}
+	
+	// Continue on next Loop iteration
+	if (!m_unsol_wakeup.exchange(true))
+		while (write(m_unsol_waker_w, "w", 1) < 0 && errno == EINTR);
+}
+
+void AtChannel::handleUnsolicitedLine(std::string_view line) {
+	if (m_unsol_waker_w != -1) {
+		queueUnsolicitedLine(line);
+		return;
+	}
+	dispatchUnsolicitedLine(line);
+}
+
+void AtChannel::dispatchUnsolicitedLine(std::string_view line) {
+	if (m_unsol_target) {
+		m_unsol_target->dispatchUnsolicitedLine(line);
+		return;
+	}
+	
 	if (m_verbose)
-		LOGD("AT -- %s\n", m_buffer.c_str());
+		LOGD("AT -- %.*s\n", static_cast<int>(line.size()), line.data());
+	
+	// Handlers are called without lock, they can add new handlers or send commands
+	std::vector<std::function<void(const std::string &)>> handlers;
 	
-	for (auto &h: m_unsol_handlers) {
-		if (strStartsWith(m_buffer, h.prefix))
-			h.handler(m_buffer);
+	m_unsol_mutex.lock();
+	m_unsol_count++;
+	
+	// Walk by trie and collect handlers of every matched prefix
+	int node = 0;
+	size_t depth = 0;
+	while (true) {
+		auto &current = m_unsol_trie[node];
+		
+		if (current.handlers.size() > 0) {
+			current.dispatched++;
+			handlers.insert(handlers.end(), current.handlers.begin(), current.handlers.end());
+		}
+		
+		if (depth >= line.size())
+			break;
+		
+		int next = -1;
+		for (auto &child: current.children) {
+			if (child.first == line[depth]) {
+				next = child.second;
+				break;
+			}
+		}
+		
+		if (next < 0)
+			break;
+		
+		node = next;
+		depth++;
 	}
+	
+	m_unsol_mutex.unlock();
+	
+	if (handlers.empty())
+		return;
+	
+	std::string line_copy(line);
+	for (auto &handler: handlers)
+		handler(line_copy);
 }
 
-void AtChannel::postAtCmdSem() {
+void AtChannel::postSem(sem_t *sem) {
 	int ret;
 	do {
-		ret = sem_post(&at_cmd_sem);
+		ret = sem_post(sem);
 	} while (ret < 0 && errno == EINTR);
 	
 	if (ret != 0) {
@@ -170,53 +708,93 @@ void AtChannel::postAtCmdSem() {
 	}
 }
 
-void AtChannel::handleLine() {
-	if (m_curr_response) {
-		if (isSuccessResponse(m_buffer, m_curr_type == DIAL)) {
-			m_curr_response->error = AT_SUCCESS;
-			m_curr_response->status = m_buffer;
-			
-			postAtCmdSem();
-		} else if (isErrorResponse(m_buffer, m_curr_type == DIAL)) {
-			m_curr_response->error = AT_ERROR;
-			m_curr_response->status = m_buffer;
-			
-			postAtCmdSem();
-		} else if (m_curr_type == DEFAULT) {
-			if (strStartsWith(m_buffer, m_curr_prefix)) {
-				m_curr_response->lines.push_back(m_buffer);
+void AtChannel::handleLine(std::string_view line) {
+	// Late result code of aborted command
+	if (isResyncActive() && (isSuccessResponse(line, true) || isErrorResponse(line, true) || strStartsWith(line, "ABORTED"))) {
+		if (m_verbose)
+			LOGD("AT << %.*s [aborted]\n", static_cast<int>(line.size()), line.data());
+		m_resync_until = 0;
+		return;
+	}
+	
+	if (m_curr_request) {
+		Response *response = &m_curr_request->response;
+		m_curr_request->bytes_read += line.size() + 2;
+		ResultType type = m_curr_request->type;
+		const std::string &prefix = m_curr_request->prefix;
+		
+		if (isSuccessResponse(line, type == DIAL)) {
+			if (m_curr_request->record_callback)
+				flushRecord();
+			response->status = line;
+			finishRequest(AT_SUCCESS);
+		} else if (isErrorResponse(line, type == DIAL)) {
+			response->status = line;
+			finishRequest(AT_ERROR);
+		} else if (type == DEFAULT) {
+			if (strStartsWith(line, prefix)) {
+				response->addLine(line);
 			} else {
-				handleUnsolicitedLine();
+				handleUnsolicitedLine(line);
 			}
-		} else if (m_curr_type == NO_PREFIX) {
-			m_curr_response->lines.push_back(m_buffer);
-			handleUnsolicitedLine();
-		} else if (m_curr_type == NUMERIC) {
-			if (m_curr_prefix.size() > 0 && strStartsWith(m_buffer, m_curr_prefix)) {
-				m_curr_response->lines.push_back(m_buffer);
-			} else if (isdigit(m_buffer[0])) {
-				m_curr_response->lines.push_back(m_buffer);
+		} else if (type == NO_PREFIX) {
+			response->addLine(line);
+			handleUnsolicitedLine(line);
+		} else if (type == NUMERIC) {
+			if (prefix.size() > 0 && strStartsWith(line, prefix)) {
+				response->addLine(line);
+			} else if (isdigit(line[0])) {
+				response->addLine(line);
 			} else {
-				handleUnsolicitedLine();
+				handleUnsolicitedLine(line);
 			}
-		} else if (m_curr_type == MULTILINE) {
-			if (strStartsWith(m_buffer, m_curr_prefix)) {
-				m_curr_response->lines.push_back(m_buffer);
-			} else if (m_curr_response->lines.size() > 0) {
-				if (m_buffer[0] == '+' || m_buffer[0] == '*' || m_buffer[0] == '^') {
-					handleUnsolicitedLine();
+		} else if (type == CHAINED) {
+			bool found = false;
+			for (auto &chain_prefix: m_curr_request->chain_prefixes) {
+				if (chain_prefix.size() > 0 && strStartsWith(line, chain_prefix)) {
+					found = true;
+					break;
+				}
+			}
+			
+			if (found) {
+				response->addLine(line);
+			} else {
+				handleUnsolicitedLine(line);
+			}
+		} else if (type == MULTILINE) {
+			if (strStartsWith(line, prefix)) {
+				// Previous record is complete
+				if (m_curr_request->record_callback)
+					flushRecord();
+				response->addLine(line);
+			} else if (response->linesCount() > 0) {
+				if (line[0] == '+' || line[0] == '*' || line[0] == '^') {
+					handleUnsolicitedLine(line);
 				} else {
-					m_curr_response->lines.back() += "\r\n" + m_buffer;
+					response->appendToLastLine(line);
 				}
 			}
 		} else {
-			handleUnsolicitedLine();
+			handleUnsolicitedLine(line);
 		}
 	} else {
-		handleUnsolicitedLine();
+		handleUnsolicitedLine(line);
 	}
 }
 
+void AtChannel::flushRecord() {
+	Response *response = &m_curr_request->response;
+	if (!response->linesCount())
+		return;
+	
+	if (m_verbose)
+		LOGD("AT << %s\n", response->line(0));
+	
+	m_curr_request->record_callback(response->line(0));
+	response->clear();
+}
+
 bool AtChannel::checkCommandExists(const std::string &cmd, int timeout) {
 	Response response;
 	
@@ -230,87 +808,799 @@ bool AtChannel::checkCommandExists(const std::string &cmd, int timeout) {
 	return false;
 }
 
-int AtChannel::sendCommand(ResultType type, const std::string &cmd, const std::string &prefix, Response *response, int timeout) {
-	at_cmd_mutex.lock();
+int AtChannel::resolveTimeout(const std::string &cmd, int timeout) {
+	if (!timeout) {
+		int static_timeout = m_timeout_callback ? m_timeout_callback(cmd) : 0;
+		timeout = static_timeout ? static_timeout : m_default_at_timeout;
+		
+		// Explicit static timeout means command waits for network, its latency is not predictable
+		if (m_adaptive_timeouts && !static_timeout)
+			timeout = getAdaptiveTimeout(cmd, timeout);
+	}
+	return timeout;
+}
+
+/*
+ * Adaptive timeouts
+ * */
+std::string AtChannel::getCommandFamily(const std::string &cmd) {
+	// Basic commands: ATE0, ATQ0, ATD*99#
+	if (cmd.size() < 3 || isalnum(cmd[2]))
+		return cmd.substr(0, 3);
+	
+	// Extended commands: set, read and test have different latency
+	size_t end = cmd.find_first_of("=?;", 2);
+	if (end == std::string::npos || cmd[end] == ';')
+		return cmd.substr(2, end == std::string::npos ? std::string::npos : end - 2);
+	
+	if (cmd.compare(end, 2, "=?") == 0)
+		return cmd.substr(2, end - 2) + "=?";
+	
+	return cmd.substr(2, end - 2 + 1);
+}
+
+int AtChannel::getAdaptiveTimeout(const std::string &cmd, int max_timeout) {
+	std::string family = getCommandFamily(cmd);
+	
+	// Network-bound commands can't be predicted by latency of previous runs
+	for (auto &prefix: m_adaptive_exclude) {
+		if (strStartsWith(family, prefix))
+			return max_timeout;
+	}
+	
+	std::lock_guard<std::mutex> lock(m_latency_mutex);
+	
+	auto it = m_latency.find(family);
+	if (it == m_latency.end() || it->second.getCount() < m_adaptive_min_samples)
+		return max_timeout;
+	
+	int timeout = it->second.getPercentile(0.999) * m_adaptive_factor;
+	return std::clamp(timeout, std::min(m_adaptive_min_timeout, max_timeout), max_timeout);
+}
+
+void AtChannel::addLatencySample(const std::shared_ptr<Request> &request) {
+	// Chain latency depends on commands count
+	if (request->type == CHAINED)
+		return;
+	
+	// Only real modem responses, timeouts are recorded too for widening too short deadlines
+	Errors error = request->response.error;
+	if (error != AT_SUCCESS && error != AT_ERROR && error != AT_TIMEOUT)
+		return;
+	
+	uint32_t elapsed = getCurrentTimestamp() - request->start;
+	
+	std::lock_guard<std::mutex> lock(m_latency_mutex);
+	m_latency[request->family].add(elapsed);
+}
+
+std::map<std::string, Histogram> AtChannel::getLatencyStats() {
+	std::lock_guard<std::mutex> lock(m_latency_mutex);
+	return m_latency;
+}
+
+bool AtChannel::loadLatencyStats(const std::string &path) {
+	std::string data = readFile(path);
+	if (!data.size())
+		return false;
+	
+	std::map<std::string, Histogram> latency;
+	
+	size_t start = 0;
+	while (start < data.size()) {
+		size_t end = data.find('\n', start);
+		if (end == std::string::npos)
+			end = data.size();
+		
+		// <family> <histogram>
+		std::string line = data.substr(start, end - start);
+		size_t sep = line.find(' ');
+		
+		if (sep != std::string::npos && !latency[line.substr(0, sep)].unserialize(line.substr(sep + 1))) {
+			LOGE("Invalid latency stats in %s: %s\n", path.c_str(), line.c_str());
+			return false;
+		}
+		
+		start = end + 1;
+	}
+	
+	std::lock_guard<std::mutex> lock(m_latency_mutex);
+	m_latency = std::move(latency);
+	
+	return true;
+}
+
+bool AtChannel::saveLatencyStats(const std::string &path) {
+	std::string data;
+	
+	m_latency_mutex.lock();
+	for (auto &it: m_latency)
+		data += it.first + " " + it.second.serialize() + "\n";
+	m_latency_mutex.unlock();
+	
+	if (!writeFile(path + ".tmp", data)) {
+		LOGE("Can't write latency stats to %s\n", path.c_str());
+		return false;
+	}
+	
+	return rename((path + ".tmp").c_str(), path.c_str()) == 0;
+}
+
+std::shared_ptr<AtChannel::Request> AtChannel::createRequest(ResultType type, const std::string &cmd, const std::string &prefix, int timeout, Priority priority) {
+	auto request = std::make_shared<Request>();
 	
 	if ((type == DEFAULT || type == MULTILINE) && prefix == "")
 		type = NO_RESPONSE;
 	
-	if (m_stop) {
-		LOGE("[ %s ] error, AT channel already closed...\n", cmd.c_str());
-		return AT_IO_BROKEN;
+	request->id = ++m_next_request_id;
+	request->type = type;
+	request->priority = priority;
+	request->cmd = cmd;
+	request->family = type == CHAINED ? "<chain>" : getCommandFamily(cmd);
+	request->prefix = prefix;
+	request->timeout = resolveTimeout(cmd, timeout);
+	request->response.error = AT_IO_ERROR;
+	
+	return request;
+}
+
+void AtChannel::submitRequest(const std::shared_ptr<Request> &request) {
+	// Served from cache without modem
+	if (m_cache && request->type != CHAINED && !request->record_callback && !request->cache_checked) {
+		if (m_cache->lookup(request->type, request->cmd, request->prefix, &request->response)) {
+			if (m_verbose)
+				LOGD("AT >> %s [cached]\n", request->cmd.c_str());
+			completeRequest(request);
+			return;
+		}
 	}
 	
-	if (!timeout) {
-		timeout = m_timeout_callback ? m_timeout_callback(cmd) : 0;
+	m_queue_mutex.lock();
+	if (m_stop || !(m_at_thread_created || m_loop_started)) {
+		m_queue_mutex.unlock();
+		LOGE("[ %s ] error, AT channel already closed...\n", request->cmd.c_str());
+		request->response.error = AT_IO_BROKEN;
+		completeRequest(request);
+		return;
+	}
+	
+	// Same query already queued or in flight, wait for its response
+	bool coalescable = isCoalescable(request);
+	std::string key;
+	
+	if (coalescable) {
+		key = std::to_string(request->type) + ":" + request->prefix + ":" + request->cmd;
 		
-		if (!timeout)
-			timeout = m_default_at_timeout;
+		auto it = m_inflight_queries.find(key);
+		if (it != m_inflight_queries.end() && it->second->priority <= request->priority) {
+			it->second->followers.push_back(request);
+			m_coalesced_leaders[request->id] = it->second;
+			m_coalesced++;
+			m_queue_mutex.unlock();
+			
+			if (m_verbose)
+				LOGD("AT >> %s [coalesced]\n", request->cmd.c_str());
+			return;
+		}
 	}
 	
-	int64_t start = getCurrentTimestamp();
+	auto &queue = m_queue[request->priority];
+	auto &stats = m_queue_stats[request->priority];
 	
-	// Make sure response is clean
-	response->error = AT_IO_ERROR;
-	response->lines.clear();
-	response->status.clear();
+	if (queue.size() >= m_queue_limit[request->priority]) {
+		stats.rejected++;
+		m_queue_mutex.unlock();
+		LOGE("[ %s ] error, %s queue is full...\n", request->cmd.c_str(), getPriorityName(request->priority));
+		request->response.error = AT_QUEUE_FULL;
+		completeRequest(request);
+		return;
+	}
 	
-	m_curr_response = response;
-	m_curr_prefix = prefix;
-	m_curr_type = type;
+	if (coalescable) {
+		request->coalesce_key = key;
+		m_inflight_queries[key] = request;
+	} else {
+		// Queries queued before this command can return old state, don't join them anymore
+		m_inflight_queries.clear();
+	}
 	
-	if (m_verbose)
-		LOGD("AT >> %s\n", cmd.c_str());
+	request->queued = getCurrentTimestamp();
+	queue.push_back(request);
+	stats.requests++;
+	m_queue_mutex.unlock();
+	
+	if (m_io_mode == IO_LOOP) {
+		// Send immediately, if channel is idle
+		scheduleLoopIo();
+	} else {
+		// Wake up reader loop
+		m_serial->breakTransfer();
+	}
+}
+
+std::shared_ptr<AtChannel::Request> AtChannel::popNextRequest() {
+	int64_t now = getCurrentTimestamp();
+	int next = -1;
 	
-	// Write AT command to modem
-	std::string complete_cmd = cmd + "\r";
-	int ret = m_serial->write(complete_cmd.c_str(), complete_cmd.size(), getNewTimeout(start, timeout));
+	std::lock_guard<std::mutex> lock(m_queue_mutex);
 	
-	if (ret < 0 || ret != complete_cmd.size()) {
-		response->error = AT_IO_ERROR;
-		LOGE("[ %s ] serial io error\n", cmd.c_str());
+	// Control commands always go first
+	if (!m_queue[PRIORITY_CONTROL].empty()) {
+		next = PRIORITY_CONTROL;
 	} else {
-		// Wait for command finish
-		struct timespec tm;
-		do {
-			setTimespecTimeout(&tm, getNewTimeout(start, timeout));
-			ret = sem_timedwait(&at_cmd_sem, &tm);
-		} while (ret == -1 && errno == EINTR && !m_stop);
-		
-		// Command timeout
-		if (ret == -1) {
-			if (errno == ETIMEDOUT) {
-				response->error = AT_TIMEOUT;
-				uint32_t elapsed = getCurrentTimestamp() - start;
-				LOGE("[ %s ] command timeout, elapsed = %u\n", cmd.c_str(), elapsed);
-			} else {
-				LOGE("[ %s ] sem_timedwait = %d\n", cmd.c_str(), errno);
-				
-				if (errno != EINTR)
-					throw std::runtime_error("sem_timedwait fatal error");
+		// Starving commands go before other priorities
+		for (int i = PRIORITY_CONTROL + 1; i < PRIORITY_MAX; i++) {
+			if (!m_queue[i].empty() && m_queue_aging[i] > 0 && now - m_queue[i].front()->queued >= m_queue_aging[i]) {
+				next = i;
+				m_queue_stats[i].aged++;
+				break;
+			}
+		}
+		
+		if (next < 0) {
+			for (int i = PRIORITY_CONTROL + 1; i < PRIORITY_MAX; i++) {
+				if (!m_queue[i].empty()) {
+					next = i;
+					break;
+				}
 			}
 		}
 	}
 	
+	if (next < 0)
+		return nullptr;
+	
+	auto request = m_queue[next].front();
+	m_queue[next].pop_front();
+	m_curr_request_id = request->id;
+	
+	uint32_t wait = now - request->queued;
+	m_queue_stats[next].wait_total += wait;
+	m_queue_stats[next].wait_max = std::max(m_queue_stats[next].wait_max, wait);
+	
+	return request;
+}
+
+AtChannel::QueueStats AtChannel::getQueueStats(Priority priority) {
+	std::lock_guard<std::mutex> lock(m_queue_mutex);
+	QueueStats stats = m_queue_stats[priority];
+	stats.depth = m_queue[priority].size();
+	return stats;
+}
+
+const char *AtChannel::getPriorityName(Priority priority) {
+	switch (priority) {
+		case PRIORITY_CONTROL:		return "control";
+		case PRIORITY_INTERACTIVE:	return "interactive";
+		case PRIORITY_BULK:			return "bulk";
+		case PRIORITY_MAX:			break;
+	}
+	return "unknown";
+}
+
+void AtChannel::sendNextRequest() {
+	// Modem can still answer to aborted command
+	if (isResyncActive())
+		return;
+	
+	while (!m_stop) {
+		m_curr_request = popNextRequest();
+		if (!m_curr_request)
+			return;
+		
+		m_curr_request->start = getCurrentTimestamp();
+		
+		if (m_verbose)
+			LOGD("AT >> %s\n", m_curr_request->cmd.c_str());
+		
+		// Wait for response
+		if (writeRequest(m_curr_request))
+			return;
+		
+		LOGE("[ %s ] serial io error\n", m_curr_request->cmd.c_str());
+		finishRequest(AT_IO_ERROR);
+	}
+}
+
+bool AtChannel::writeRequest(const std::shared_ptr<Request> &request) {
+	std::string complete_cmd = request->cmd + "\r";
+	
+	int written = 0;
+	while (written < complete_cmd.size()) {
+		int ret = m_serial->writeChunk(complete_cmd.c_str() + written, complete_cmd.size() - written, getNewTimeout(request->start, request->timeout));
+		
+		// Interrupted by new command in queue
+		if (ret == Serial::ERR_INTR && !m_stop)
+			continue;
+		
+		if (ret <= 0)
+			return false;
+		
+		written += ret;
+	}
+	
+	request->written = getCurrentTimestamp();
+	
+	m_stats_mutex.lock();
+	m_bytes_written += written;
+	m_stats_mutex.unlock();
+	
+	return true;
+}
+
+void AtChannel::finishRequest(Errors error) {
+	auto request = m_curr_request;
+	Response *response = &request->response;
+	
+	m_curr_request = nullptr;
+	m_curr_request_id = 0;
+	response->error = error;
+	
+	addLatencySample(request);
+	addCommandStats(request);
+	
+	if (m_cache) {
+		m_cache->handleCommand(request->cmd);
+		if (request->type != CHAINED && !request->record_callback)
+			m_cache->store(request->type, request->cmd, request->prefix, *response);
+	}
+	
 	if (response->error)
-		LOGE("[ %s ] error = %d, status = %s\n", cmd.c_str(), response->error, response->status.c_str());
+		LOGE("[ %s ] error = %d, status = %s\n", request->cmd.c_str(), response->error, response->status.c_str());
 	
 	if (m_verbose) {
-		if (type != NO_PREFIX) {
-			for (int i = 0; i < response->lines.size(); i++)
-				LOGD("AT << %s\n", response->lines[i].c_str());
+		if (request->type != NO_PREFIX) {
+			for (size_t i = 0; i < response->linesCount(); i++)
+				LOGD("AT << %s\n", response->line(i));
 		}
 		
 		if (response->status.size() > 0)
 			LOGD("AT << %s\n", response->status.c_str());
 	}
 	
-	m_curr_response = nullptr;
+	completeRequest(request);
+}
+
+void AtChannel::checkRequestTimeout() {
+	if (m_curr_request && !getNewTimeout(m_curr_request->start, m_curr_request->timeout)) {
+		uint32_t elapsed = getCurrentTimestamp() - m_curr_request->start;
+		LOGE("[ %s ] command timeout, elapsed = %u\n", m_curr_request->cmd.c_str(), elapsed);
+		
+		// Modem can still process command, abort it for not mix up with responses of next commands
+		abortRequest(AT_TIMEOUT);
+	}
+}
+
+bool AtChannel::isResyncActive() {
+	if (m_resync_until && getCurrentTimestamp() >= m_resync_until)
+		m_resync_until = 0;
+	return m_resync_until != 0;
+}
+
+void AtChannel::abortRequest(Errors error) {
+	LOGD("[ %s ] aborting...\n", m_curr_request->cmd.c_str());
+	
+	finishRequest(error);
+	
+	// Drop partial line of aborted command
+	m_framer.reset();
+	m_resync_until = getCurrentTimestamp() + m_resync_timeout;
+	
+	if (!m_abort_sequence.size()) {
+		if (m_serial->sendBreak() != 0)
+			LOGE("Can't send break for abort command\n");
+		return;
+	}
+	
+	int written = 0;
+	while (written < m_abort_sequence.size()) {
+		int ret = m_serial->writeChunk(m_abort_sequence.c_str() + written, m_abort_sequence.size() - written, m_resync_timeout);
+		if (ret == Serial::ERR_INTR && !m_stop)
+			continue;
+		if (ret <= 0) {
+			LOGE("Can't send abort sequence\n");
+			return;
+		}
+		written += ret;
+	}
+}
+
+void AtChannel::checkCancel() {
+	int id = m_cancel_request_id.exchange(0);
+	if (id && m_curr_request && m_curr_request->id == id) {
+		m_curr_request->canceled = true;
+		abortRequest(AT_CANCELED);
+	}
+}
+
+bool AtChannel::cancel(int id) {
+	std::shared_ptr<Request> request;
+	bool in_flight = false;
+	
+	m_queue_mutex.lock();
+	for (auto &queue: m_queue) {
+		for (auto it = queue.begin(); it != queue.end(); it++) {
+			if ((*it)->id == id) {
+				request = *it;
+				queue.erase(it);
+				break;
+			}
+		}
+		if (request)
+			break;
+	}
+	
+	// Coalesced, waits for response of other request
+	auto leader = m_coalesced_leaders.find(id);
+	if (!request && leader != m_coalesced_leaders.end()) {
+		auto &followers = leader->second->followers;
+		for (auto it = followers.begin(); it != followers.end(); it++) {
+			if ((*it)->id == id) {
+				request = *it;
+				followers.erase(it);
+				break;
+			}
+		}
+		m_coalesced_leaders.erase(leader);
+	}
+	
+	if (!request && id && m_curr_request_id == id) {
+		m_cancel_request_id = id;
+		in_flight = true;
+	}
+	m_queue_mutex.unlock();
+	
+	// Not sent yet
+	if (request) {
+		LOGD("[ %s ] canceled\n", request->cmd.c_str());
+		request->canceled = true;
+		request->response.error = AT_CANCELED;
+		completeRequest(request);
+		return true;
+	}
+	
+	if (!in_flight)
+		return false;
+	
+	if (m_io_mode == IO_LOOP) {
+		checkCancel();
+		scheduleLoopIo();
+	} else {
+		// Reader thread aborts command
+		m_serial->breakTransfer();
+	}
+	
+	return true;
+}
+
+void AtChannel::cancelAll() {
+	abortAllRequests(AT_CANCELED);
+	
+	int id = m_curr_request_id;
+	if (id)
+		cancel(id);
+}
+
+bool AtChannel::isCoalescable(const std::shared_ptr<Request> &request) {
+	if (request->type == CHAINED || request->type == DIAL || request->record_callback || !request->cmd.size())
+		return false;
 	
-	at_cmd_mutex.unlock();
+	if (request->cmd.back() == '?')
+		return true;
+	
+	return m_coalesce_commands.find(request->cmd) != m_coalesce_commands.end();
+}
+
+void AtChannel::completeRequest(const std::shared_ptr<Request> &request) {
+	// Same queries, which waited for this response
+	if (request->coalesce_key.size()) {
+		m_queue_mutex.lock();
+		auto it = m_inflight_queries.find(request->coalesce_key);
+		if (it != m_inflight_queries.end() && it->second == request)
+			m_inflight_queries.erase(it);
+		auto followers = std::move(request->followers);
+		request->followers.clear();
+		for (auto &follower: followers)
+			m_coalesced_leaders.erase(follower->id);
+		m_queue_mutex.unlock();
+		
+		for (auto &follower: followers) {
+			// Only this request was canceled, others still want response
+			if (request->canceled) {
+				submitRequest(follower);
+				continue;
+			}
+			
+			follower->response = request->response;
+			follower->start = request->start;
+			completeRequest(follower);
+		}
+	}
+	
+	request->finished = true;
+	
+	if (request->done) {
+		postSem(request->done);
+		return;
+	}
+	
+	if (m_io_mode == IO_LOOP) {
+		// Sync requests are checked by caller, async - called on next uloop iteration
+		if (!request->sync) {
+			m_completed.push_back(request);
+			uloop_timeout_set(&m_complete_timeout.timeout, 0);
+		}
+		return;
+	}
+	
+	Loop::setTimeout([this, request]() {
+		runRequestCallback(request);
+	}, 0);
+}
+
+void AtChannel::runRequestCallback(const std::shared_ptr<Request> &request) {
+	if (request->response.error && m_global_error_handler)
+		m_global_error_handler(request->response.error, request->start);
+	
+	if (request->callback)
+		request->callback(request->response);
+}
+
+void AtChannel::abortAllRequests(Errors error) {
+	std::vector<std::shared_ptr<Request>> requests;
+	
+	m_queue_mutex.lock();
+	for (auto &queue: m_queue) {
+		requests.insert(requests.end(), queue.begin(), queue.end());
+		queue.clear();
+	}
+	m_queue_mutex.unlock();
+	
+	for (auto &request: requests) {
+		request->response.error = error;
+		completeRequest(request);
+	}
+}
+
+int AtChannel::sendCommandAsync(ResultType type, const std::string &cmd, const std::string &prefix, const ResponseCallback &callback, int timeout, Priority priority) {
+	auto request = createRequest(type, cmd, prefix, timeout, priority);
+	request->callback = callback;
+	submitRequest(request);
+	return request->id;
+}
+
+int AtChannel::sendCommandStreamAsync(const std::string &cmd, const std::string &prefix, const RecordCallback &record_callback, const ResponseCallback &callback, int timeout, Priority priority) {
+	auto request = createRequest(MULTILINE, cmd, prefix, timeout, priority);
+	request->record_callback = record_callback;
+	request->callback = callback;
+	submitRequest(request);
+	return request->id;
+}
+
+int AtChannel::sendCommand(ResultType type, const std::string &cmd, const std::string &prefix, Response *response, int timeout, Priority priority) {
+	return executeRequest(createRequest(type, cmd, prefix, timeout, priority), response);
+}
+
+int AtChannel::executeRequest(const std::shared_ptr<Request> &request, Response *response) {
+	// Called from line handler (streaming record callback): nobody can read response
+	if (isInsideReader()) {
+		LOGE("[ %s ] sync command from AT reader is not allowed\n", request->cmd.c_str());
+		*response = std::move(request->response);
+		return response->error;
+	}
+	
+	if (m_io_mode == IO_LOOP) {
+		request->sync = true;
+		submitRequest(request);
+		
+		// Read serial until command finished
+		while (!request->finished) {
+			if (!m_curr_request)
+				sendNextRequest();
+			pumpLoopIo(getReadTimeout());
+		}
+		
+		scheduleLoopIo();
+	} else {
+		sem_t done = {};
+		if (sem_init(&done, 0, 0) != 0) {
+			LOGE("sem_init() failed, errno = %d\n", errno);
+			throw std::runtime_error("sem_init fatal error");
+		}
+		
+		request->done = &done;
+		submitRequest(request);
+		
+		// Wait for command finish
+		int ret;
+		do {
+			ret = sem_wait(&done);
+		} while (ret == -1 && errno == EINTR);
+		
+		sem_destroy(&done);
+	}
+	
+	*response = std::move(request->response);
 	
 	if (response->error && m_global_error_handler)
-		m_global_error_handler(response->error, start);
+		m_global_error_handler(response->error, request->start);
 	
 	return response->error;
 }
+
+/*
+ * Commands chaining
+ * */
+bool AtChannel::isChainableCommand(const BatchCommand &command) {
+	if (command.type != NO_RESPONSE && !(command.type == DEFAULT && command.prefix.size() > 0))
+		return false;
+	
+	// Only extended commands: AT+XXX, AT^XXX, AT*XXX, ...
+	if (command.cmd.size() < 4 || !strStartsWith(command.cmd, "AT") || isalnum(command.cmd[2]))
+		return false;
+	
+	return command.cmd.find(';') == std::string::npos;
+}
+
+size_t AtChannel::findChainEnd(const std::vector<BatchCommand> &commands, size_t start) {
+	size_t length = 2;
+	size_t end = start;
+	
+	while (end < commands.size() && isChainableCommand(commands[end])) {
+		auto &command = commands[end];
+		
+		length += command.cmd.size() - 2 + (end > start ? 1 : 0);
+		if (end > start && length > m_max_chain_length)
+			break;
+		
+		// Response prefixes must be unambiguous
+		bool conflict = false;
+		for (size_t i = start; i < end && command.prefix.size() > 0; i++) {
+			auto &prev_prefix = commands[i].prefix;
+			if (prev_prefix.size() > 0 && (strStartsWith(prev_prefix, command.prefix) || strStartsWith(command.prefix, prev_prefix))) {
+				conflict = true;
+				break;
+			}
+		}
+		
+		if (conflict)
+			break;
+		
+		end++;
+	}
+	
+	return end;
+}
+
+int AtChannel::sendChain(const std::vector<BatchCommand> &commands, size_t start, size_t end, std::vector<Response> *responses, int timeout) {
+	std::string cmd = commands[start].cmd;
+	std::vector<std::string> prefixes;
+	int chain_timeout = 0;
+	
+	for (size_t i = start; i < end; i++) {
+		if (i > start)
+			cmd += ";" + commands[i].cmd.substr(2);
+		prefixes.push_back(commands[i].type == NO_RESPONSE ? "" : commands[i].prefix);
+		chain_timeout += resolveTimeout(commands[i].cmd, timeout);
+	}
+	
+	auto request = createRequest(CHAINED, cmd, "", chain_timeout, PRIORITY_CONTROL);
+	request->chain_prefixes = std::move(prefixes);
+	
+	Response response;
+	executeRequest(request, &response);
+	
+	if (response.error) {
+		for (size_t i = start; i < end; i++) {
+			(*responses)[i].error = response.error;
+			(*responses)[i].status = response.status;
+		}
+		return response.error;
+	}
+	
+	// Split response by commands
+	for (size_t j = 0; j < response.linesCount(); j++) {
+		std::string_view line = response.lineView(j);
+		for (size_t i = start; i < end; i++) {
+			auto &prefix = request->chain_prefixes[i - start];
+			if (prefix.size() > 0 && strStartsWith(line, prefix)) {
+				(*responses)[i].addLine(line);
+				break;
+			}
+		}
+	}
+	
+	for (size_t i = start; i < end; i++) {
+		(*responses)[i].error = AT_SUCCESS;
+		(*responses)[i].status = response.status;
+		
+		if (m_cache)
+			m_cache->store(commands[i].type, commands[i].cmd, commands[i].prefix, (*responses)[i]);
+	}
+	
+	return AT_SUCCESS;
+}
+
+int AtChannel::sendBatchCommand(const BatchCommand &command, Response *response, int timeout) {
+	auto request = createRequest(command.type, command.cmd, command.prefix, timeout, PRIORITY_CONTROL);
+	request->cache_checked = true;
+	return executeRequest(request, response);
+}
+
+void AtChannel::sendBatch(const std::vector<BatchCommand> &commands, std::vector<Response> *responses, int timeout) {
+	size_t start = 0;
+	
+	while (start < commands.size()) {
+		size_t end = m_chaining_enabled ? findChainEnd(commands, start) : start;
+		
+		if (end - start > 1) {
+			int error = sendChain(commands, start, end, responses, timeout);
+			
+			if (error == AT_ERROR) {
+				LOGD("Commands chain failed, trying send commands one by one...\n");
+				
+				// Fallback to sequential mode
+				bool all_success = true;
+				for (size_t i = start; i < end; i++) {
+					if (sendBatchCommand(commands[i], &(*responses)[i], timeout) != AT_SUCCESS)
+						all_success = false;
+				}
+				
+				// Chain of valid commands failed, modem not supports chaining
+				if (all_success) {
+					LOGD("Commands chaining not supported by modem, disabled.\n");
+					m_chaining_enabled = false;
+				}
+			} else if (error != AT_SUCCESS) {
+				// Modem not responding, don't try other commands
+				for (size_t i = end; i < commands.size(); i++)
+					(*responses)[i].error = static_cast<Errors>(error);
+				break;
+			}
+			
+			start = end;
+		} else {
+			int error = sendBatchCommand(commands[start], &(*responses)[start], timeout);
+			
+			if (error != AT_SUCCESS && error != AT_ERROR) {
+				// Modem not responding, don't try other commands
+				for (size_t i = start + 1; i < commands.size(); i++)
+					(*responses)[i].error = static_cast<Errors>(error);
+				break;
+			}
+			
+			start++;
+		}
+	}
+}
+
+std::vector<AtChannel::Response> AtChannel::sendCommandBatch(const std::vector<BatchCommand> &commands, int timeout) {
+	std::vector<Response> responses(commands.size());
+	
+	if (!m_cache) {
+		sendBatch(commands, &responses, timeout);
+		return responses;
+	}
+	
+	// Send only commands without cached response
+	std::vector<BatchCommand> pending;
+	std::vector<size_t> pending_index;
+	
+	for (size_t i = 0; i < commands.size(); i++) {
+		auto &command = commands[i];
+		if (!m_cache->lookup(command.type, command.cmd, command.prefix, &responses[i])) {
+			pending.push_back(command);
+			pending_index.push_back(i);
+		}
+	}
+	
+	if (pending.size() > 0) {
+		std::vector<Response> pending_responses(pending.size());
+		sendBatch(pending, &pending_responses, timeout);
+		
+		for (size_t i = 0; i < pending.size(); i++)
+			responses[pending_index[i]] = std::move(pending_responses[i]);
+	}
+	
+	return responses;
+}
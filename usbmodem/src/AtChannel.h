@@ -6,12 +6,23 @@
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <deque>
 #include <mutex>
+#include <map>
+#include <set>
+#include <atomic>
 #include <sys/types.h>
 
 #include "Serial.h"
+#include "LineFramer.h"
+#include "Histogram.h"
+#include "SpscQueue.h"
+#include "Loop.h"
 #include "Log.h"
 
+class AtCache;
+
 class AtChannel {
 	public:
 		static const std::string empty_line;
@@ -23,32 +34,171 @@ class AtChannel {
 			AT_TIMEOUT		= -1,
 			AT_ERROR		= -2,
 			AT_IO_ERROR		= -3,
-			AT_IO_BROKEN	= -4
+			AT_IO_BROKEN	= -4,
+			AT_QUEUE_FULL	= -5,
+			AT_CANCELED		= -6
 		};
 		
-		struct Response {
-			Errors error;
-			std::vector<std::string> lines;
-			std::string status;
-			
-			const inline std::string &data() const {
-				return lines.size() ? lines[0] : AtChannel::empty_line;
-			}
+		enum IoMode {
+			IO_THREAD,	// Separate reader thread
+			IO_LOOP		// Serial fd handled directly in uloop, without any threads
+		};
+		
+		// Command scheduling classes, lower value goes first
+		enum Priority {
+			PRIORITY_CONTROL		= 0,	// Connection management, recovery, SIM/network state
+			PRIORITY_INTERACTIVE	= 1,	// User API requests
+			PRIORITY_BULK			= 2,	// Background bulk transfers (SMS list, etc)
+			PRIORITY_MAX
+		};
+		
+		struct QueueStats {
+			uint64_t requests;
+			uint64_t rejected;
+			uint64_t aged;
+			uint64_t wait_total;
+			uint32_t wait_max;
+			uint32_t depth;
+		};
+		
+		// Metrics of command family (ms)
+		struct CommandStats {
+			uint64_t count = 0;
+			uint64_t errors = 0;
+			uint64_t timeouts = 0;
 			
-			const inline int isCmeError() const {
-				return getCmeError() >= 0;
-			}
+			// Lines received while command was active
+			uint64_t bytes_read = 0;
+			uint64_t bytes_written = 0;
+			Histogram queue_wait;
+			Histogram write_time;
+			Histogram response_time;
+		};
+		
+		struct Stats {
+			// Time since last reset (ms)
+			int64_t elapsed;
 			
-			const inline int isCmsError() const {
-				return getCmsError() >= 0;
-			}
+			// All serial traffic, including unsolicited
+			uint64_t bytes_read;
+			uint64_t bytes_written;
+			uint64_t unsolicited;
 			
-			const inline int isGeneralError() const {
-				return !isCmeError() && !isCmsError() && error;
-			}
+			// Queries served by response of same query already in flight
+			uint64_t coalesced;
 			
-			const int getCmeError() const;
-			const int getCmsError() const;
+			std::map<std::string, CommandStats> commands;
+			std::map<std::string, uint64_t> unsolicited_handlers;
+			QueueStats queues[PRIORITY_MAX];
+		};
+		
+		/*
+		 * Response of command
+		 * All lines stored in one buffer (each line terminated with '\0') and offsets table.
+		 * Buffers are taken from small pool and returned back when response destroyed.
+		 * */
+		class Response {
+			protected:
+				std::string m_buffer;
+				std::vector<uint32_t> m_offsets;
+				
+				// Storage is taken from pool and must be returned on destroy
+				bool m_pooled = false;
+				
+				void acquireStorage();
+				void releaseStorage();
+				void copyLines(const Response &other);
+			public:
+				Errors error = AT_SUCCESS;
+				std::string status;
+				
+				Response() = default;
+				
+				Response(const Response &other) : error(other.error), status(other.status) {
+					copyLines(other);
+				}
+				
+				Response &operator=(const Response &other) {
+					if (this != &other) {
+						error = other.error;
+						status = other.status;
+						copyLines(other);
+					}
+					return *this;
+				}
+				
+				Response(Response &&other) noexcept :
+					m_buffer(std::move(other.m_buffer)), m_offsets(std::move(other.m_offsets)), m_pooled(other.m_pooled),
+					error(other.error), status(std::move(other.status))
+				{
+					other.m_pooled = false;
+				}
+				
+				Response &operator=(Response &&other) noexcept {
+					if (this != &other) {
+						releaseStorage();
+						m_buffer = std::move(other.m_buffer);
+						m_offsets = std::move(other.m_offsets);
+						m_pooled = other.m_pooled;
+						error = other.error;
+						status = std::move(other.status);
+						other.m_pooled = false;
+					}
+					return *this;
+				}
+				
+				~Response() {
+					releaseStorage();
+				}
+				
+				inline size_t capacity() const {
+					return m_buffer.capacity();
+				}
+				
+				void addLine(std::string_view line);
+				
+				// Remove all lines, storage is kept
+				void clear();
+				
+				// Multiline responses: continuation of last line, separated by "\r\n"
+				void appendToLastLine(std::string_view line);
+				
+				inline size_t linesCount() const {
+					return m_offsets.size();
+				}
+				
+				// Null-terminated line, valid until response modified or destroyed
+				inline const char *line(size_t index) const {
+					return m_buffer.c_str() + m_offsets[index];
+				}
+				
+				inline std::string_view lineView(size_t index) const {
+					size_t end = index + 1 < m_offsets.size() ? m_offsets[index + 1] : m_buffer.size();
+					return std::string_view(m_buffer.c_str() + m_offsets[index], end - m_offsets[index] - 1);
+				}
+				
+				// First line or empty string
+				inline const char *data() const {
+					return m_offsets.size() ? line(0) : "";
+				}
+				
+				// Compatibility: copy of all lines
+				std::vector<std::string> lines() const;
+				
+				const inline int isCmeError() const {
+					return getCmeError() >= 0;
+				}
+				
+				const inline int isCmsError() const {
+					return getCmsError() >= 0;
+				}
+				
+				const inline int isGeneralError() const {
+					return !isCmeError() && !isCmsError() && error;
+				}
+				
+				const int getCmeError() const;
+				const int getCmsError() const;
 		};
 		
 		enum ResultType {
@@ -57,16 +207,101 @@ class AtChannel {
 			NUMERIC,
 			NO_RESPONSE,
 			DIAL,
-			NO_PREFIX
+			NO_PREFIX,
+			CHAINED
+		};
+		
+		// Command for sendCommandBatch()
+		struct BatchCommand {
+			ResultType type;
+			std::string cmd;
+			std::string prefix;
 		};
+		
+		typedef std::function<void(const Response &response)> ResponseCallback;
+		
+		// One record of multiline response (prefixed line with continuation), valid only during call
+		typedef std::function<void(const char *record)> RecordCallback;
 	protected:
-		struct UnsolHandler {
+		/*
+		 * Prefix trie of unsolicited handlers
+		 * Dispatch cost depends only on length of matched prefix, not on count of handlers.
+		 * */
+		struct UnsolNode {
+			std::vector<std::pair<char, int>> children;
+			std::vector<std::function<void(const std::string &)>> handlers;
+			std::string prefix;
+			uint64_t dispatched = 0;
+		};
+		
+		/*
+		 * Queued AT command
+		 * All fields owned by reader thread after request pushed to queue.
+		 * */
+		struct Request {
+			int id = 0;
+			ResultType type = DEFAULT;
+			Priority priority = PRIORITY_CONTROL;
+			std::string cmd;
+			std::string family;
 			std::string prefix;
-			std::function<void(std::string)> handler;
+			std::vector<std::string> chain_prefixes;
+			int timeout = 0;
+			int64_t queued = 0;
+			int64_t start = 0;
+			int64_t written = 0;
+			uint32_t bytes_read = 0;
+			Response response;
+			
+			// Async requests: called on Loop
+			ResponseCallback callback;
+			
+			// Streaming multiline requests: called on reader thread for every record, records are not collected
+			RecordCallback record_callback;
+			
+			// Sync requests: posted by reader thread
+			sem_t *done = nullptr;
+			
+			// Loop mode: sync request, waited by pumping serial in caller
+			bool sync = false;
+			bool finished = false;
+			
+			// Already missed in cache (batch commands)
+			bool cache_checked = false;
+			
+			// Coalesced query: same requests, completed with response of this one
+			std::string coalesce_key;
+			std::vector<std::shared_ptr<Request>> followers;
+			
+			// Canceled by id, followers are not canceled and queued again
+			bool canceled = false;
+		};
+		
+		struct UloopFd {
+			// Must be a first item of struct!!!
+			uloop_fd fd;
+			AtChannel *self;
 		};
 		
-		std::vector<UnsolHandler> m_unsol_handlers;
-		std::vector<std::string> m_unsol_queue;
+		struct UloopTimeout {
+			// Must be a first item of struct!!!
+			uloop_timeout timeout;
+			AtChannel *self;
+		};
+		
+		std::vector<UnsolNode> m_unsol_trie{1};
+		std::mutex m_unsol_mutex;
+		uint64_t m_unsol_count = 0;
+		AtChannel *m_unsol_target = nullptr;
+		
+		AtCache *m_cache = nullptr;
+		
+		// Metrics
+		std::map<std::string, CommandStats> m_cmd_stats;
+		std::mutex m_stats_mutex;
+		uint64_t m_bytes_read = 0;
+		uint64_t m_bytes_written = 0;
+		int64_t m_stats_start = getCurrentTimestamp();
 		
 		int m_fd = -1;
 		Serial *m_serial = nullptr;
@@ -75,31 +310,154 @@ class AtChannel {
 		
 		static constexpr int MAX_AT_RESPONSE = 8 * 1024;
 		
-		std::string m_buffer = "";
-		Response *m_curr_response = nullptr;
-		std::string m_curr_prefix = "";
-		ResultType m_curr_type = DEFAULT;
-		sem_t at_cmd_sem = {};
-		std::mutex at_cmd_mutex;
+		LineFramer m_framer{MAX_AT_RESPONSE};
+		
+		// Commands queue per priority
+		std::deque<std::shared_ptr<Request>> m_queue[PRIORITY_MAX];
+		std::mutex m_queue_mutex;
+		std::shared_ptr<Request> m_curr_request;
+		
+		// Ids for cancel() from any thread, in-flight request is aborted by reader
+		std::atomic<int> m_next_request_id{0};
+		std::atomic<int> m_curr_request_id{0};
+		std::atomic<int> m_cancel_request_id{0};
+		
+		/*
+		 * Abort of command in progress (V.250: any character aborts command)
+		 * After abort, result code of aborted command is dropped, new commands wait until it received or resync timeout.
+		 * */
+		std::string m_abort_sequence = "\x1B";
+		int m_resync_timeout = 500;
+		int64_t m_resync_until = 0;
+		
+		// Max queued commands per priority
+		size_t m_queue_limit[PRIORITY_MAX] = {64, 16, 4};
+		
+		// Max wait time (ms), after which command goes before higher priorities (except control)
+		int m_queue_aging[PRIORITY_MAX] = {0, 0, 10 * 1000};
+		
+		QueueStats m_queue_stats[PRIORITY_MAX] = {};
+		
+		// Queued or in flight idempotent queries, by type + prefix + command
+		std::map<std::string, std::shared_ptr<Request>> m_inflight_queries;
+		
+		// Follower id -> request, which response it waits (for cancel)
+		std::map<int, std::shared_ptr<Request>> m_coalesced_leaders;
+		std::set<std::string> m_coalesce_commands;
+		uint64_t m_coalesced = 0;
+		
 		TimeoutSetCallback m_timeout_callback;
 		int m_default_at_timeout = 10 * 1000;
 		
+		/*
+		 * Adaptive timeouts
+		 * Timeout of command family = p99.9 of observed response time * factor,
+		 * but not greater than default timeout.
+		 * Commands with static timeout (from m_timeout_callback) and network-bound families are not adapted.
+		 * */
+		std::map<std::string, Histogram> m_latency;
+		std::mutex m_latency_mutex;
+		bool m_adaptive_timeouts = false;
+		uint32_t m_adaptive_min_samples = 50;
+		int m_adaptive_factor = 4;
+		int m_adaptive_min_timeout = 500;
+		std::vector<std::string> m_adaptive_exclude = {"+CGDATA", "+CGACT", "+CGATT", "+CFUN", "+COPS", "+CPIN", "+CUSD", "ATD"};
+		
+		// Commands chaining: AT+CMD1;+CMD2;+CMD3
+		bool m_chaining_enabled = true;
+		size_t m_max_chain_length = 128;
+		
 		std::function<void()> m_broken_io_handler;
 		std::function<void(Errors error, int64_t start)> m_global_error_handler;
 		
+		IoMode m_io_mode = IO_THREAD;
+		
 		// thread
 		pthread_t m_at_thread = 0;
 		bool m_at_thread_created = false;
 		
-		static void *readerThread(void *arg);
+		// loop
+		UloopFd m_uloop_fd = {};
+		UloopTimeout m_request_timeout = {};
+		UloopTimeout m_complete_timeout = {};
+		std::deque<std::shared_ptr<Request>> m_completed;
+		bool m_loop_started = false;
 		
-		static bool isErrorResponse(const std::string &line, bool dial = false);
-		static bool isSuccessResponse(const std::string &line, bool dial = false);
+		// Lines from serial are handled now, sync commands can't be sent
+		bool m_in_reader = false;
 		
-		void handleLine();
-		void handleUnsolicitedLine();
+		// Unsolicited lines handed from reader to Loop, handlers called in batches on one wakeup
+		static constexpr size_t UNSOL_QUEUE_SIZE = 256;
 		
-		void postAtCmdSem();
+		bool m_unsol_on_loop = false;
+		SpscQueue<std::string, UNSOL_QUEUE_SIZE> m_unsol_queue;
+		std::atomic<bool> m_unsol_wakeup{false};
+		UloopFd m_unsol_waker_r = {};
+		int m_unsol_waker_w = -1;
+		
+		// Used only when queue is full, keeps order of lines
+		std::deque<std::string> m_unsol_overflow;
+		std::mutex m_unsol_overflow_mutex;
+		std::atomic<bool> m_unsol_overflowed{false};
+		
+		// Overflowed lines taken by Loop, not handled yet
+		std::deque<std::string> m_unsol_pending;
+		
+		static void *readerThread(void *arg);
+		
+		bool startLoopIo();
+		void stopLoopIo();
+		void scheduleLoopIo();
+		int pumpLoopIo(int timeout);
+		bool isInsideReader();
+		
+		static void uloopReadHandler(uloop_fd *fd, unsigned int events);
+		static void uloopRequestTimeoutHandler(uloop_timeout *timeout);
+		static void uloopCompleteHandler(uloop_timeout *timeout);
+		static void uloopUnsolicitedHandler(uloop_fd *fd, unsigned int events);
+		
+		bool startUnsolicitedQueue();
+		void stopUnsolicitedQueue();
+		void queueUnsolicitedLine(std::string_view line);
+		void drainUnsolicitedQueue();
+		void dispatchUnsolicitedLine(std::string_view line);
+		
+		static bool isErrorResponse(std::string_view line, bool dial = false);
+		static bool isSuccessResponse(std::string_view line, bool dial = false);
+		
+		void handleLine(std::string_view line);
+		void handleUnsolicitedLine(std::string_view line);
+		
+		int resolveTimeout(const std::string &cmd, int timeout);
+		int getAdaptiveTimeout(const std::string &cmd, int max_timeout);
+		void addLatencySample(const std::shared_ptr<Request> &request);
+		void addCommandStats(const std::shared_ptr<Request> &request);
+		void addBytesRead(int size);
+		std::shared_ptr<Request> createRequest(ResultType type, const std::string &cmd, const std::string &prefix, int timeout, Priority priority);
+		void submitRequest(const std::shared_ptr<Request> &request);
+		int executeRequest(const std::shared_ptr<Request> &request, Response *response);
+		std::shared_ptr<Request> popNextRequest();
+		void sendNextRequest();
+		bool writeRequest(const std::shared_ptr<Request> &request);
+		void finishRequest(Errors error);
+		void checkRequestTimeout();
+		void checkCancel();
+		bool isCoalescable(const std::shared_ptr<Request> &request);
+		void flushRecord();
+		void abortRequest(Errors error);
+		bool isResyncActive();
+		void completeRequest(const std::shared_ptr<Request> &request);
+		void runRequestCallback(const std::shared_ptr<Request> &request);
+		void abortAllRequests(Errors error);
+		int getReadTimeout();
+		
+		static bool isChainableCommand(const BatchCommand &command);
+		size_t findChainEnd(const std::vector<BatchCommand> &commands, size_t start);
+		int sendChain(const std::vector<BatchCommand> &commands, size_t start, size_t end, std::vector<Response> *responses, int timeout);
+		int sendBatchCommand(const BatchCommand &command, Response *response, int timeout);
+		void sendBatch(const std::vector<BatchCommand> &commands, std::vector<Response> *responses, int timeout);
+		
+		static void postSem(sem_t *sem);
 	public:
 		AtChannel();
 		~AtChannel();
@@ -107,11 +465,43 @@ class AtChannel {
 		inline void setSerial(Serial *serial) {
 			m_serial = serial;
 		}
-
+		
+		// Responses cache, can be shared between channels
+		inline void setCache(AtCache *cache) {
+			m_cache = cache;
+		}
+		
+		inline AtCache *getCache() {
+			return m_cache;
+		}
+		
+		/*
+		 * Identical concurrent queries share one round trip to modem, response is copied to every caller
+		 * Coalesced: all "?" queries and commands added here (must be idempotent, without args).
+		 * Not thread safe, call before start().
+		 * */
+		inline void addCoalescedCommand(const std::string &cmd) {
+			m_coalesce_commands.insert(cmd);
+		}
+		
 		inline void setVerbose(bool verbose) {
 			m_verbose = verbose;
 		}
 		
+		// Must be called before start()
+		inline void setIoMode(IoMode mode) {
+			m_io_mode = mode;
+		}
+		
+		inline IoMode getIoMode() {
+			return m_io_mode;
+		}
+		
+		// Request is written to modem and waits for response
+		inline bool isInFlight(int id) {
+			return id && m_curr_request_id == id;
+		}
+		
 		inline void setDefaultTimeout(int timeout) {
 			m_default_at_timeout = timeout;
 		}
@@ -120,9 +510,100 @@ class AtChannel {
 			m_timeout_callback = callback;
 		}
 		
+		inline void setQueueLimit(Priority priority, size_t limit) {
+			m_queue_limit[priority] = limit;
+		}
+		
+		inline void setQueueAging(Priority priority, int max_wait) {
+			m_queue_aging[priority] = max_wait;
+		}
+		
+		inline void setChainingEnabled(bool enabled) {
+			m_chaining_enabled = enabled;
+		}
+		
+		inline bool isChainingEnabled() {
+			return m_chaining_enabled;
+		}
+		
+		inline void setMaxChainLength(size_t length) {
+			m_max_chain_length = length;
+		}
+		
+		// Sent for abort command in progress, empty - send break
+		inline void setAbortSequence(const std::string &sequence) {
+			m_abort_sequence = sequence;
+		}
+		
+		// Max time for waiting result code of aborted command (ms)
+		inline void setResyncTimeout(int timeout) {
+			m_resync_timeout = timeout;
+		}
+		
+		inline void setAdaptiveTimeouts(bool enable) {
+			m_adaptive_timeouts = enable;
+		}
+		
+		// Load/save learned latency of command families
+		bool loadLatencyStats(const std::string &path);
+		bool saveLatencyStats(const std::string &path);
+		std::map<std::string, Histogram> getLatencyStats();
+		
+		// AT+CFUN=1 -> +CFUN=, AT+CFUN? -> +CFUN?, ATE0 -> ATE
+		static std::string getCommandFamily(const std::string &cmd);
+		
+		QueueStats getQueueStats(Priority priority);
+		static const char *getPriorityName(Priority priority);
+		
 		void readerLoop();
 		
-		int sendCommand(ResultType type, const std::string &cmd, const std::string &prefix, Response *response, int timeout = 0);
+		/*
+		 * Async API
+		 * Command queued and callback called on Loop when command finished.
+		 * Returns request id for cancel().
+		 * */
+		int sendCommandAsync(ResultType type, const std::string &cmd, const std::string &prefix, const ResponseCallback &callback, int timeout = 0, Priority priority = PRIORITY_CONTROL);
+		
+		inline int sendCommandAsync(const std::string &cmd, const std::string &prefix, const ResponseCallback &callback, int timeout = 0, Priority priority = PRIORITY_CONTROL) {
+			return sendCommandAsync(DEFAULT, cmd, prefix, callback, timeout, priority);
+		}
+		
+		inline int sendCommandNoPrefixAsync(const std::string &cmd, const ResponseCallback &callback, int timeout = 0, Priority priority = PRIORITY_CONTROL) {
+			return sendCommandAsync(NO_PREFIX, cmd, "", callback, timeout, priority);
+		}
+		
+		inline int sendCommandMultilineAsync(const std::string &cmd, const std::string &prefix, const ResponseCallback &callback, int timeout = 0, Priority priority = PRIORITY_CONTROL) {
+			return sendCommandAsync(MULTILINE, cmd, prefix, callback, timeout, priority);
+		}
+		
+		/*
+		 * Multiline command with streaming: record_callback called on reader thread as soon as each record is received,
+		 * so records can be processed while modem is still sending others. Must not send sync commands.
+		 * Final callback called on Loop with status only (response without lines).
+		 * */
+		int sendCommandStreamAsync(const std::string &cmd, const std::string &prefix, const RecordCallback &record_callback, const ResponseCallback &callback, int timeout = 0, Priority priority = PRIORITY_CONTROL);
+		
+		inline int sendCommandNoResponseAsync(const std::string &cmd, const ResponseCallback &callback, int timeout = 0, Priority priority = PRIORITY_CONTROL) {
+			return sendCommandAsync(NO_RESPONSE, cmd, "", callback, timeout, priority);
+		}
+		
+		inline int sendCommandDialAsync(const std::string &cmd, const ResponseCallback &callback, int timeout = 0, Priority priority = PRIORITY_CONTROL) {
+			return sendCommandAsync(DIAL, cmd, "", callback, timeout, priority);
+		}
+		
+		/*
+		 * Sync API
+		 * Blocks caller until command finished. Never call from reader thread (unsolicited handlers).
+		 * In loop mode serial is read by caller until command finished, other commands and events handled as usual.
+		 * */
+		int sendCommand(ResultType type, const std::string &cmd, const std::string &prefix, Response *response, int timeout = 0, Priority priority = PRIORITY_CONTROL);
+		
+		/*
+		 * Cancel queued or in-flight command, caller completed with AT_CANCELED
+		 * In-flight command is aborted in modem (abort sequence or break). Can be called from any thread.
+		 * */
+		bool cancel(int id);
+		void cancelAll();
 		
 		void onUnsolicited(const std::string &prefix, const std::function<void(const std::string &)> &handler);
 		
@@ -136,6 +617,27 @@ class AtChannel {
 		
 		void resetUnsolicitedHandlers();
 		
+		/*
+		 * Call unsolicited handlers on Loop instead of reader thread
+		 * Lines are passed by lock-free queue and handled in batches, handlers can send sync commands.
+		 * Always enabled in IO_LOOP mode. Call before start().
+		 * */
+		inline void setUnsolicitedOnLoop(bool enable) {
+			m_unsol_on_loop = enable;
+		}
+		
+		// Dispatch unsolicited lines to handlers of other channel (additional ports of same modem)
+		inline void setUnsolicitedTarget(AtChannel *target) {
+			m_unsol_target = target;
+		}
+		
+		// Count of dispatched unsolicited lines per handler prefix
+		std::map<std::string, uint64_t> getUnsolicitedStats();
+		
+		// Latency and traffic metrics per command family
+		Stats getStats();
+		void resetStats();
+		
 		bool start();
 		void stop();
 		
@@ -176,6 +678,14 @@ class AtChannel {
 		
 		bool checkCommandExists(const std::string &cmd, int timeout = 0);
 		
+		/*
+		 * Send commands using chaining (AT+CMD1;+CMD2;+CMD3) when possible.
+		 * Only DEFAULT (with prefix) and NO_RESPONSE extended commands can be chained,
+		 * other commands sent separately. Returns response for every command.
+		 * When modem rejects chain, commands resent one by one.
+		 * */
+		std::vector<Response> sendCommandBatch(const std::vector<BatchCommand> &commands, int timeout = 0);
+		
 		inline Response sendCommandDial(const std::string &cmd, int timeout = 0) {
 			Response response;
 			sendCommand(DIAL, cmd, "", &response, timeout);
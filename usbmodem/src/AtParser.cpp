@@ -1,12 +1,14 @@
 #include "AtParser.h"
 
-bool AtParser::parseNextString(std::string *value) {
-	const char *start, *end;
+#include <charconv>
+
+bool AtParser::parseNextString(std::string_view *value) {
+	const char *start = nullptr, *end = nullptr;
 	m_cursor = parseNextArg(m_cursor, &start, &end);
 	arg_cnt++;
 	
 	if (m_cursor) {
-		value->assign(start, end - start);
+		*value = std::string_view(start, end - start);
 		return true;
 	}
 	
@@ -16,12 +18,20 @@ bool AtParser::parseNextString(std::string *value) {
 	return false;
 }
 
+bool AtParser::parseNextString(std::string *value) {
+	std::string_view view;
+	if (!parseNextString(&view))
+		return false;
+	value->assign(view);
+	return true;
+}
+
 bool AtParser::parseNextInt(int32_t *value, int base) {
-	const char *start, *end;
+	const char *start = nullptr, *end = nullptr;
 	m_cursor = parseNextArg(m_cursor, &start, &end);
 	arg_cnt++;
 	
-	if (parseNumeric(start, end, base, false, value))
+	if (parseNumeric(start, end, base, value))
 		return true;
 	
 	LOGE("AtParser:%s: can't parse #%d argument in '%s'\n", __FUNCTION__, arg_cnt, m_str);
@@ -31,11 +41,39 @@ bool AtParser::parseNextInt(int32_t *value, int base) {
 }
 
 bool AtParser::parseNextUInt(uint32_t *value, int base) {
-	const char *start, *end;
+	const char *start = nullptr, *end = nullptr;
 	m_cursor = parseNextArg(m_cursor, &start, &end);
 	arg_cnt++;
 	
-	if (parseNumeric(start, end, base, true, value))
+	if (parseNumeric(start, end, base, value))
+		return true;
+	
+	LOGE("AtParser:%s: can't parse #%d argument in '%s'\n", __FUNCTION__, arg_cnt, m_str);
+	
+	m_success = false;
+	return false;
+}
+
+bool AtParser::parseNextInt64(int64_t *value, int base) {
+	const char *start = nullptr, *end = nullptr;
+	m_cursor = parseNextArg(m_cursor, &start, &end);
+	arg_cnt++;
+	
+	if (parseNumeric(start, end, base, value))
+		return true;
+	
+	LOGE("AtParser:%s: can't parse #%d argument in '%s'\n", __FUNCTION__, arg_cnt, m_str);
+	
+	m_success = false;
+	return false;
+}
+
+bool AtParser::parseNextUInt64(uint64_t *value, int base) {
+	const char *start = nullptr, *end = nullptr;
+	m_cursor = parseNextArg(m_cursor, &start, &end);
+	arg_cnt++;
+	
+	if (parseNumeric(start, end, base, value))
 		return true;
 	
 	LOGE("AtParser:%s: can't parse #%d argument in '%s'\n", __FUNCTION__, arg_cnt, m_str);
@@ -58,20 +96,56 @@ bool AtParser::parseNextBool(bool *value) {
 	return false;
 }
 
-bool AtParser::parseNumeric(const char *start, const char *end, int base, bool is_unsigned, void *out) {
-	char *number_end = nullptr;
-	
+static inline bool isBlank(char c) {
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+template <typename T>
+static bool decodeNumeric(const char *start, const char *end, int base, T *out) {
 	if (!start)
 		return false;
 	
-	if (is_unsigned) {
-		uint32_t *ptr = static_cast<uint32_t*>(out);
-		*ptr = strtoul(start, &number_end, base);
-	} else {
-		int32_t *ptr = static_cast<int32_t*>(out);
-		*ptr = strtoul(start, &number_end, base);
-	}
-	return number_end != start && number_end <= end;
+	// Same input as strtoul() accepted: leading spaces, "+" and "0x" for hex
+	while (start < end && isBlank(*start))
+		start++;
+	
+	if (start < end && *start == '+')
+		start++;
+	
+	if (base == 16 && end - start > 2 && start[0] == '0' && (start[1] == 'x' || start[1] == 'X'))
+		start += 2;
+	
+	// Fails on empty value and overflow
+	T value;
+	auto [number_end, error] = std::from_chars(start, end, value, base);
+	if (error != std::errc())
+		return false;
+	
+	// Only trailing spaces allowed after number
+	while (number_end < end && isBlank(*number_end))
+		number_end++;
+	
+	if (number_end != end)
+		return false;
+	
+	*out = value;
+	return true;
+}
+
+bool AtParser::parseNumeric(const char *start, const char *end, int base, int32_t *out) {
+	return decodeNumeric(start, end, base, out);
+}
+
+bool AtParser::parseNumeric(const char *start, const char *end, int base, uint32_t *out) {
+	return decodeNumeric(start, end, base, out);
+}
+
+bool AtParser::parseNumeric(const char *start, const char *end, int base, int64_t *out) {
+	return decodeNumeric(start, end, base, out);
+}
+
+bool AtParser::parseNumeric(const char *start, const char *end, int base, uint64_t *out) {
+	return decodeNumeric(start, end, base, out);
 }
 
 bool AtParser::parseNextNewLine() {
@@ -91,31 +165,43 @@ bool AtParser::parseNextNewLine() {
 	return true;
 }
 
-bool AtParser::parseNextList(std::vector<std::string> *values) {
-	std::string list_raw;
-	if (!parseNextString(&list_raw))
+bool AtParser::parseNextList(std::vector<std::string_view> *values) {
+	std::string_view list;
+	if (!parseNextString(&list))
 		return false;
 	
-	const char *start, *end, *cursor = list_raw.c_str();
+	// Items are parsed in place, up to the end of list
+	const char *start, *end, *cursor = list.data(), *limit = list.data() + list.size();
 	int count = 0;
 	do {
 		count++;
 		
-		cursor = parseNextArg(cursor, &start, &end);
+		cursor = parseNextArg(cursor, &start, &end, limit);
 		if (!cursor) {
-			LOGE("AtParser:%s: can't parse #%d argument in '%s'\n", __FUNCTION__, count, list_raw.c_str());
+			LOGE("AtParser:%s: can't parse #%d item of #%d argument in '%s'\n", __FUNCTION__, count, arg_cnt, m_str);
 			m_success = false;
 			return false;
 		}
 		
-		values->push_back(std::string(start, end - start));
-	} while (cursor && *cursor);
+		values->push_back(std::string_view(start, end - start));
+	} while (cursor < limit);
+	
+	return true;
+}
+
+bool AtParser::parseNextList(std::vector<std::string> *values) {
+	std::vector<std::string_view> views;
+	if (!parseNextList(&views))
+		return false;
+	
+	for (auto &view: views)
+		values->emplace_back(view);
 	
 	return true;
 }
 
 bool AtParser::parseNextSkip() {
-	const char *start, *end;
+	const char *start = nullptr, *end = nullptr;
 	m_cursor = parseNextArg(m_cursor, &start, &end);
 	arg_cnt++;
 	
@@ -128,8 +214,8 @@ bool AtParser::parseNextSkip() {
 	return false;
 }
 
-int AtParser::getArgCnt(const std::string &value) {
-	const char *start, *end, *cursor = value.c_str();
+int AtParser::getArgCnt(const char *value) {
+	const char *start, *end, *cursor = value;
 	int count = 0;
 	do {
 		cursor = parseNextArg(cursor, &start, &end);
@@ -145,9 +231,14 @@ const char *AtParser::skipSpaces(const char *cursor) {
 	return cursor;
 }
 
-const char *AtParser::parseNextArg(const char *str, const char **start, const char **end) {
+const char *AtParser::parseNextArg(const char *str, const char **start, const char **end, const char *limit) {
 	const char *cursor = str;
 	
+	// End of string or end of list, when parsing list items
+	auto eof = [limit](const char *c) {
+		return !*c || (limit && c >= limit);
+	};
+	
 	if (!cursor)
 		return nullptr;
 	
@@ -164,7 +255,7 @@ const char *AtParser::parseNextArg(const char *str, const char **start, const ch
 		
 		*start = cursor;
 		
-		while (*cursor) {
+		while (!eof(cursor)) {
 			if (wait_char) {
 				if (*cursor == wait_char)
 					wait_char = 0;
@@ -179,8 +270,8 @@ const char *AtParser::parseNextArg(const char *str, const char **start, const ch
 						
 						cursor = skipSpaces(cursor);
 						
-						if (!*cursor || *cursor == ',' || *cursor == '\n')
-							return *cursor == ',' ? cursor + 1 : cursor;
+						if (eof(cursor) || *cursor == ',' || *cursor == '\n')
+							return !eof(cursor) && *cursor == ',' ? cursor + 1 : cursor;
 						return nullptr;
 					}
 				} else if (*cursor == '(') {
@@ -201,12 +292,12 @@ const char *AtParser::parseNextArg(const char *str, const char **start, const ch
 		*start = cursor;
 		
 		// Wait for next "
-		while (*cursor && *cursor != '"')
+		while (!eof(cursor) && *cursor != '"')
 			cursor++;
 		
 		*end = cursor;
 		
-		if (*cursor != '"')
+		if (eof(cursor))
 			return nullptr;
 		
 		cursor++;
@@ -214,20 +305,20 @@ const char *AtParser::parseNextArg(const char *str, const char **start, const ch
 		cursor = skipSpaces(cursor);
 		
 		// Success, if next char is arg separator or string ended
-		if (!*cursor || *cursor == ',' || *cursor == '\n')
-			return *cursor == ',' ? cursor + 1 : cursor;
+		if (eof(cursor) || *cursor == ',' || *cursor == '\n')
+			return !eof(cursor) && *cursor == ',' ? cursor + 1 : cursor;
 	}
 	// Is raw value
 	else {
 		*start = cursor;
 		
 		// Wait for next argument or EOF
-		while (*cursor && (*cursor != ',' && *cursor != '\n'))
+		while (!eof(cursor) && (*cursor != ',' && *cursor != '\n'))
 			cursor++;
 		
 		*end = cursor;
 		
-		return *cursor == ',' ? cursor + 1 : cursor;
+		return !eof(cursor) && *cursor == ',' ? cursor + 1 : cursor;
 	}
 	
 	return nullptr;
@@ -1,19 +1,31 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
 #include <vector>
+#include <string_view>
 
 #include "Log.h"
 
+template <typename... Fields>
+class AtSchema;
+
+/*
+ * Sequential parser of AT response arguments
+ * Overloads with std::string_view don't copy: values point into parsed line and valid only while
+ * that line is alive and not modified. Use std::string overloads when value must outlive the line.
+ * */
 class AtParser {
+	template <typename... Fields>
+	friend class AtSchema;
 	protected:
 		const char *m_str = nullptr;
 		const char *m_cursor = nullptr;
 		int arg_cnt = 0;
 		bool m_success = false;
 		
-		static const char *parseNextArg(const char *str, const char **start, const char **end);
-		static bool parseNumeric(const char *start, const char *end, int base, bool is_unsigned, void *out);
+		// Optional limit: stop at end of list instead of end of string
+		static const char *parseNextArg(const char *str, const char **start, const char **end, const char *limit = nullptr);
 		
 		static const char *skipSpaces(const char *cursor);
 	public:
@@ -27,7 +39,17 @@ class AtParser {
 		
 		AtParser() { }
 		
-		static int getArgCnt(const std::string &value);
+		static int getArgCnt(const char *value);
+		
+		static inline int getArgCnt(const std::string &value) {
+			return getArgCnt(value.c_str());
+		}
+		
+		// Decode number from exact [start, end) range, NUL not required. Fails on overflow or garbage after number.
+		static bool parseNumeric(const char *start, const char *end, int base, int32_t *out);
+		static bool parseNumeric(const char *start, const char *end, int base, uint32_t *out);
+		static bool parseNumeric(const char *start, const char *end, int base, int64_t *out);
+		static bool parseNumeric(const char *start, const char *end, int base, uint64_t *out);
 		
 		inline AtParser &parse(const char *s) {
 			m_str = s;
@@ -62,6 +84,11 @@ class AtParser {
 			return *this;
 		}
 		
+		inline AtParser &parseString(std::string_view *value) {
+			parseNextString(value);
+			return *this;
+		}
+		
 		inline AtParser &parseInt(int32_t *value, int base = 10) {
 			parseNextInt(value, base);
 			return *this;
@@ -72,6 +99,16 @@ class AtParser {
 			return *this;
 		}
 		
+		inline AtParser &parseInt64(int64_t *value, int base = 10) {
+			parseNextInt64(value, base);
+			return *this;
+		}
+		
+		inline AtParser &parseUInt64(uint64_t *value, int base = 10) {
+			parseNextUInt64(value, base);
+			return *this;
+		}
+		
 		inline AtParser &parseBool(bool *value) {
 			parseNextBool(value);
 			return *this;
@@ -82,6 +119,11 @@ class AtParser {
 			return *this;
 		}
 		
+		inline AtParser &parseList(std::vector<std::string_view> *values) {
+			parseNextList(values);
+			return *this;
+		}
+		
 		inline AtParser &parseNewLine() {
 			parseNextNewLine();
 			return *this;
@@ -93,10 +135,14 @@ class AtParser {
 		}
 		
 		bool parseNextString(std::string *value);
+		bool parseNextString(std::string_view *value);
 		bool parseNextInt(int32_t *value, int base = 10);
 		bool parseNextUInt(uint32_t *value, int base = 10);
+		bool parseNextInt64(int64_t *value, int base = 10);
+		bool parseNextUInt64(uint64_t *value, int base = 10);
 		bool parseNextBool(bool *value);
 		bool parseNextList(std::vector<std::string> *values);
+		bool parseNextList(std::vector<std::string_view> *values);
 		bool parseNextNewLine();
 		bool parseNextSkip();
 };
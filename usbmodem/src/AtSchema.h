@@ -0,0 +1,195 @@
+#pragma once
+
+#include <tuple>
+#include <string>
+#include <cstdint>
+#include <optional>
+#include <string_view>
+#include <type_traits>
+
+#include "AtParser.h"
+
+/*
+ * Field types for AtSchema
+ * */
+namespace AtField {
+	// Argument must be present, but value is not returned
+	struct Skip {
+		typedef std::nullptr_t type;
+	};
+	
+	struct Int {
+		typedef int32_t type;
+	};
+	
+	struct UInt {
+		typedef uint32_t type;
+	};
+	
+	struct HexU32 {
+		typedef uint32_t type;
+	};
+	
+	struct Int64 {
+		typedef int64_t type;
+	};
+	
+	struct UInt64 {
+		typedef uint64_t type;
+	};
+	
+	struct HexU64 {
+		typedef uint64_t type;
+	};
+	
+	// Only 0 or 1
+	struct Bool {
+		typedef bool type;
+	};
+	
+	// Points to parsed line, without quotes
+	struct Str {
+		typedef std::string_view type;
+	};
+	
+	// Missing argument is std::nullopt, empty too (except Str), allowed only at the end of schema
+	template <typename T>
+	struct Opt {
+		
+	};
+}
+
+/*
+ * Compile-time typed AT response, parsed in one pass over line:
+ *   auto cusd = AtSchema<Int, Opt<Str>, Opt<Int>>::parse(event);
+ *   if (cusd) { auto [code, data, dcs] = *cusd; }
+ * Skip fields are excluded from result tuple.
+ * */
+template <typename... Fields>
+class AtSchema {
+	protected:
+		template <typename F>
+		struct Traits {
+			typedef F field;
+			static constexpr bool optional = false;
+		};
+		
+		template <typename F>
+		struct Traits<AtField::Opt<F>> {
+			typedef F field;
+			static constexpr bool optional = true;
+		};
+		
+		template <typename F>
+		static constexpr bool isSkip() {
+			return std::is_same_v<typename Traits<F>::field, AtField::Skip>;
+		}
+		
+		template <typename F>
+		using Value = std::conditional_t<Traits<F>::optional,
+			std::optional<typename Traits<F>::field::type>, typename Traits<F>::field::type>;
+		
+		template <typename F>
+		using ValueTuple = std::conditional_t<isSkip<F>(), std::tuple<>, std::tuple<Value<F>>>;
+		
+		static constexpr bool isOptionalTail() {
+			bool optional[] = {Traits<Fields>::optional...};
+			for (size_t i = 1; i < sizeof...(Fields); i++) {
+				if (optional[i - 1] && !optional[i])
+					return false;
+			}
+			return true;
+		}
+		
+		static_assert(sizeof...(Fields) > 0, "Empty AT schema");
+		static_assert(isOptionalTail(), "Required field after Opt<> in AT schema");
+	public:
+		typedef decltype(std::tuple_cat(std::declval<ValueTuple<Fields>>()...)) Values;
+	protected:
+		static inline bool convert(AtField::Int, const char *start, const char *end, int32_t *out) {
+			return AtParser::parseNumeric(start, end, 10, out);
+		}
+		
+		static inline bool convert(AtField::UInt, const char *start, const char *end, uint32_t *out) {
+			return AtParser::parseNumeric(start, end, 10, out);
+		}
+		
+		static inline bool convert(AtField::HexU32, const char *start, const char *end, uint32_t *out) {
+			return AtParser::parseNumeric(start, end, 16, out);
+		}
+		
+		static inline bool convert(AtField::Int64, const char *start, const char *end, int64_t *out) {
+			return AtParser::parseNumeric(start, end, 10, out);
+		}
+		
+		static inline bool convert(AtField::UInt64, const char *start, const char *end, uint64_t *out) {
+			return AtParser::parseNumeric(start, end, 10, out);
+		}
+		
+		static inline bool convert(AtField::HexU64, const char *start, const char *end, uint64_t *out) {
+			return AtParser::parseNumeric(start, end, 16, out);
+		}
+		
+		static inline bool convert(AtField::Bool, const char *start, const char *end, bool *out) {
+			int32_t value;
+			if (!AtParser::parseNumeric(start, end, 10, &value) || (value != 0 && value != 1))
+				return false;
+			*out = value == 1;
+			return true;
+		}
+		
+		static inline bool convert(AtField::Str, const char *start, const char *end, std::string_view *out) {
+			*out = std::string_view(start, end - start);
+			return true;
+		}
+		
+		template <size_t I, size_t O>
+		static bool parseField(const char *cursor, Values *values) {
+			if constexpr (I == sizeof...(Fields)) {
+				return true;
+			} else {
+				typedef std::tuple_element_t<I, std::tuple<Fields...>> F;
+				typedef typename Traits<F>::field Field;
+				constexpr size_t next = isSkip<F>() ? O : O + 1;
+				
+				// No more arguments, all remaining fields are optional
+				cursor = AtParser::skipSpaces(cursor);
+				if (!*cursor || *cursor == '\n')
+					return Traits<F>::optional;
+				
+				const char *start, *end;
+				cursor = AtParser::parseNextArg(cursor, &start, &end);
+				if (!cursor)
+					return false;
+				
+				if constexpr (!isSkip<F>()) {
+					if (!Traits<F>::optional || start != end || std::is_same_v<Field, AtField::Str>) {
+						typename Field::type value;
+						if (!convert(Field(), start, end, &value))
+							return false;
+						std::get<O>(*values) = value;
+					}
+				}
+				
+				return parseField<I + 1, next>(cursor, values);
+			}
+		}
+	public:
+		static std::optional<Values> parse(const char *line) {
+			const char *cursor = line;
+			
+			// Skip prefix
+			while (*cursor && *cursor != ':')
+				cursor++;
+			cursor = *cursor ? cursor + 1 : line;
+			
+			Values values = {};
+			if (!parseField<0, 0>(cursor, &values))
+				return std::nullopt;
+			return values;
+		}
+		
+		static inline std::optional<Values> parse(const std::string &line) {
+			return parse(line.c_str());
+		}
+};
@@ -0,0 +1,152 @@
+#include "AtWatchdog.h"
+
+#include <algorithm>
+
+#include "Log.h"
+#include "Loop.h"
+#include "Utils.h"
+
+AtWatchdog::AtWatchdog() {
+	
+}
+
+AtWatchdog::~AtWatchdog() {
+	stop();
+}
+
+void AtWatchdog::start() {
+	m_started = true;
+	m_failures = 0;
+	m_state = HEALTHY;
+}
+
+void AtWatchdog::stop() {
+	m_started = false;
+	
+	if (m_probe_timeout_id != -1) {
+		Loop::clearTimeout(m_probe_timeout_id);
+		m_probe_timeout_id = -1;
+	}
+	
+	clearDeadline();
+}
+
+void AtWatchdog::reportError() {
+	// Error handlers can be called from reader thread or inside sync command
+	Loop::setTimeout([=]() {
+		handleError();
+	}, 0);
+}
+
+void AtWatchdog::handleError() {
+	if (!m_started || m_state != HEALTHY)
+		return;
+	
+	LOGE("Detected IO error on AT channel... start probing\n");
+	
+	m_failures = 0;
+	m_unanswered_time = 0;
+	m_last_tick = getCurrentTimestamp();
+	setState(DEGRADED);
+	scheduleProbe(0);
+	
+	// Total time to broken state is limited, checked with small steps
+	m_deadline_interval_id = Loop::setInterval([=]() {
+		handleDeadlineTick();
+	}, DEADLINE_TICK);
+}
+
+void AtWatchdog::handleDeadlineTick() {
+	int64_t now = getCurrentTimestamp();
+	int64_t elapsed = now - m_last_tick;
+	m_last_tick = now;
+	
+	if (!m_started || m_state != DEGRADED)
+		return;
+	
+	// Probe waits behind other command (e.g. AT+CGDATA), modem is busy, but not hung
+	if (m_probe_pending && !m_at->isInFlight(m_probe_id))
+		return;
+	
+	// Probe on the wire or backoff between probes
+	m_unanswered_time += elapsed;
+	
+	if (m_unanswered_time >= m_broken_timeout) {
+		LOGE("AT channel is broken, no response for %d ms!!!\n", static_cast<int>(m_unanswered_time));
+		clearDeadline();
+		setState(BROKEN);
+	}
+}
+
+void AtWatchdog::clearDeadline() {
+	if (m_deadline_interval_id != -1) {
+		Loop::clearInterval(m_deadline_interval_id);
+		m_deadline_interval_id = -1;
+	}
+}
+
+void AtWatchdog::scheduleProbe(int delay) {
+	if (m_probe_timeout_id != -1 || m_probe_pending)
+		return;
+	
+	m_probe_timeout_id = Loop::setTimeout([=]() {
+		m_probe_timeout_id = -1;
+		probe();
+	}, delay);
+}
+
+void AtWatchdog::probe() {
+	if (!m_started || m_state != DEGRADED)
+		return;
+	
+	m_probe_pending = true;
+	m_probe_id = m_at->sendCommandNoResponseAsync("AT", [=](const auto &response) {
+		m_probe_pending = false;
+		handleProbe(response.error);
+	}, m_probe_timeout, AtChannel::PRIORITY_CONTROL);
+}
+
+void AtWatchdog::handleProbe(int error) {
+	if (!m_started || m_state != DEGRADED)
+		return;
+	
+	if (!error) {
+		LOGD("AT channel is alive after %d failed probes\n", m_failures);
+		m_failures = 0;
+		clearDeadline();
+		setState(HEALTHY);
+		return;
+	}
+	
+	m_failures++;
+	
+	if (m_failures >= m_max_failures) {
+		LOGE("AT channel is broken!!!\n");
+		clearDeadline();
+		setState(BROKEN);
+		return;
+	}
+	
+	int delay = std::min(m_min_interval << std::min(m_failures - 1, 16), m_max_interval);
+	LOGE("AT probe failed (%d/%d), next after %d ms\n", m_failures, m_max_failures, delay);
+	scheduleProbe(delay);
+}
+
+void AtWatchdog::setState(State state) {
+	if (m_state == state)
+		return;
+	
+	m_state = state;
+	
+	if (m_state_callback)
+		m_state_callback(state);
+}
+
+const char *AtWatchdog::getStateName(State state) {
+	switch (state) {
+		case HEALTHY:	return "healthy";
+		case DEGRADED:	return "degraded";
+		case BROKEN:	return "broken";
+	}
+	return "unknown";
+}
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <functional>
+
+#include "AtChannel.h"
+
+/*
+ * Health monitor of AT channel
+ * Errors only start probing, probes are async "AT" commands with exponential backoff between them,
+ * so Loop is never blocked while modem is not responding.
+ * Channel is broken after m_max_failures probes or m_broken_timeout without answer, what comes first.
+ * Time while probe waits in queue behind other command is not counted.
+ * All methods except reportError() must be called from Loop thread.
+ * */
+class AtWatchdog {
+	public:
+		// Step of m_broken_timeout accounting (ms)
+		static constexpr int DEADLINE_TICK = 100;
+		
+		enum State {
+			HEALTHY,	// Channel works
+			DEGRADED,	// Detected errors, probing
+			BROKEN		// No response for all probes
+		};
+		
+		typedef std::function<void(State state)> StateCallback;
+	protected:
+		AtChannel *m_at = nullptr;
+		
+		State m_state = HEALTHY;
+		bool m_started = false;
+		int m_failures = 0;
+		int m_probe_timeout_id = -1;
+		int m_deadline_interval_id = -1;
+		bool m_probe_pending = false;
+		int m_probe_id = 0;
+		
+		// Time of probing, when modem must answer
+		int64_t m_unanswered_time = 0;
+		int64_t m_last_tick = 0;
+		
+		int m_probe_timeout = 1000;
+		int m_min_interval = 250;
+		int m_max_interval = 2000;
+		int m_max_failures = 8;
+		int m_broken_timeout = 10000;
+		
+		StateCallback m_state_callback;
+		
+		void handleError();
+		void scheduleProbe(int delay);
+		void probe();
+		void handleProbe(int error);
+		void handleDeadlineTick();
+		void clearDeadline();
+		void setState(State state);
+	public:
+		AtWatchdog();
+		~AtWatchdog();
+		
+		inline void setChannel(AtChannel *at) {
+			m_at = at;
+		}
+		
+		// Timeout of one probe (ms)
+		inline void setProbeTimeout(int timeout) {
+			m_probe_timeout = timeout;
+		}
+		
+		// Delay before next probe, doubled after every failed probe (ms)
+		inline void setBackoff(int min_interval, int max_interval) {
+			m_min_interval = min_interval;
+			m_max_interval = max_interval;
+		}
+		
+		// Failed probes in row before channel is broken
+		inline void setMaxFailures(int count) {
+			m_max_failures = count;
+		}
+		
+		// Max time without answer to broken state (ms)
+		inline void setBrokenTimeout(int timeout) {
+			m_broken_timeout = timeout;
+		}
+		
+		inline void onStateChanged(const StateCallback &callback) {
+			m_state_callback = callback;
+		}
+		
+		inline State getState() {
+			return m_state;
+		}
+		
+		inline int getFailures() {
+			return m_failures;
+		}
+		
+		void start();
+		void stop();
+		
+		// IO error or timeout on channel, can be called from any thread
+		void reportError();
+		
+		static const char *getStateName(State state);
+};
@@ -0,0 +1,1405 @@
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <thread>
+#include <atomic>
+#include <new>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Log.h"
+#include "Utils.h"
+#include "Serial.h"
+#include "AtChannel.h"
+#include "CmuxLoopback.h"
+#include "SerialReplay.h"
+#include "Asr1802Simulator.h"
+#include "Modem/Asr1802.h"
+#include "LineFramer.h"
+#include "Loop.h"
+#include "GsmUtils.h"
+#include "AtParser.h"
+
+typedef std::function<int(int argc, char *argv[])> BenchmarkCallback;
+
+/*
+ * Heap allocations counter, enabled only while benchmark measures it
+ * Replaces global allocator of usbmodem-bench only, this file is never linked into daemon.
+ * */
+static std::atomic<bool> count_allocations = false;
+static std::atomic<size_t> allocations = 0;
+
+void *operator new(size_t size) {
+	if (count_allocations.load(std::memory_order_relaxed))
+		allocations.fetch_add(1, std::memory_order_relaxed);
+	
+	void *ptr = malloc(size ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void *ptr) noexcept {
+	free(ptr);
+}
+
+void operator delete(void *ptr, size_t) noexcept {
+	free(ptr);
+}
+
+static size_t countAllocations(const std::function<void()> &callback) {
+	allocations = 0;
+	count_allocations = true;
+	callback();
+	count_allocations = false;
+	return allocations;
+}
+
+/*
+ * Run callback N times and print average time per iteration
+ * */
+static void measure(const char *name, int iterations, size_t bytes_per_iteration, const std::function<void()> &callback) {
+	// Warmup
+	callback();
+	
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < iterations; i++)
+		callback();
+	auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+	
+	double ns_per_iteration = elapsed / iterations;
+	
+	if (bytes_per_iteration > 0) {
+		double mb_per_sec = (bytes_per_iteration / (ns_per_iteration / 1000000000.0)) / (1024.0 * 1024.0);
+		LOGD("%-32s %12.0f ns/iter %10.2f MB/s\n", name, ns_per_iteration, mb_per_sec);
+	} else {
+		LOGD("%-32s %12.0f ns/iter\n", name, ns_per_iteration);
+	}
+}
+
+/*
+ * Synthetic "AT+CMGL=4" response, used when no recorded dump specified
+ * */
+static std::string generateCmglDump(int messages) {
+	std::string dump;
+	uint32_t seed = 1;
+	
+	for (int i = 0; i < messages; i++) {
+		std::string pdu = "07919730071111F1440B919761989901F00008" "12504121000021" "8C" "050003A70301";
+		while (pdu.size() < 318) {
+			seed = seed * 1103515245 + 12345;
+			pdu += strprintf("%02X", (seed >> 16) & 0xFF);
+		}
+		dump += "\r\n+CMGL: " + std::to_string(i) + ",1,," + std::to_string(pdu.size() / 2 - 8) + "\r\n" + pdu;
+	}
+	dump += "\r\n\r\nOK\r\n";
+	
+	return dump;
+}
+
+static std::string loadDumpOrGenerate(int argc, char *argv[], int index, const std::function<std::string()> &generator) {
+	if (argc > index) {
+		std::string data = readFile(argv[index]);
+		if (!data.size())
+			LOGE("Can't read dump: %s\n", argv[index]);
+		return data;
+	}
+	return generator();
+}
+
+/*
+ * Line framers
+ * */
+static int benchFramer(int argc, char *argv[]) {
+	static constexpr size_t READ_CHUNK = 256;
+	
+	std::string dump = loadDumpOrGenerate(argc, argv, 2, []() {
+		return generateCmglDump(500);
+	});
+	
+	if (!dump.size())
+		return -1;
+	
+	LOGD("Input: %d bytes\n", static_cast<int>(dump.size()));
+	
+	size_t checksum_old = 0, checksum_new = 0;
+	
+	// Old framer: per-byte append and EOL check
+	measure("framer: std::string per byte", 100, dump.size(), [&]() {
+		std::string buffer;
+		for (size_t offset = 0; offset < dump.size(); offset += READ_CHUNK) {
+			size_t readed = std::min(READ_CHUNK, dump.size() - offset);
+			for (size_t i = 0; i < readed; i++) {
+				buffer += dump[offset + i];
+				if (strHasEol(buffer)) {
+					buffer.erase(buffer.size() - 2);
+					if (buffer.size() > 0)
+						checksum_old += buffer.size();
+					buffer = "";
+				}
+			}
+		}
+	});
+	
+	// New framer: reads directly to ring buffer, memchr EOL
+	LineFramer framer(8 * 1024);
+	measure("framer: LineFramer", 100, dump.size(), [&]() {
+		framer.reset();
+		for (size_t offset = 0; offset < dump.size(); offset += READ_CHUNK) {
+			size_t readed = std::min(READ_CHUNK, dump.size() - offset);
+			memcpy(framer.writePtr(), dump.c_str() + offset, readed);
+			framer.commit(readed, [&](std::string_view line) {
+				checksum_new += line.size();
+			});
+		}
+	});
+	
+	if (checksum_old != checksum_new) {
+		LOGE("Framers output mismatch: %d != %d\n", static_cast<int>(checksum_old), static_cast<int>(checksum_new));
+		return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * Multiline response storage (+CMGL)
+ * */
+static int benchResponse(int argc, char *argv[]) {
+	std::string dump = loadDumpOrGenerate(argc, argv, 2, []() {
+		return generateCmglDump(50);
+	});
+	
+	if (!dump.size())
+		return -1;
+	
+	// Pre-split lines, only storage is measured
+	std::vector<std::string_view> lines;
+	LineFramer framer(dump.size() + 1);
+	memcpy(framer.writePtr(), dump.c_str(), dump.size());
+	
+	std::string copy;
+	framer.commit(dump.size(), [&](std::string_view line) {
+		copy.append(line).push_back('\n');
+	});
+	
+	size_t start = 0;
+	while (start < copy.size()) {
+		size_t end = copy.find('\n', start);
+		lines.emplace_back(copy.c_str() + start, end - start);
+		start = end + 1;
+	}
+	
+	LOGD("Input: %d lines\n", static_cast<int>(lines.size()));
+	
+	size_t checksum_old = 0, checksum_new = 0;
+	
+	// Old storage: vector of strings, continuation appended with temporary
+	auto storeOld = [&]() {
+		std::vector<std::string> response;
+		for (auto line: lines) {
+			if (strStartsWith(line, "+CMGL")) {
+				response.emplace_back(line);
+			} else if (response.size() > 0 && line != "OK") {
+				response.back() += "\r\n" + std::string(line);
+			}
+		}
+		checksum_old += response.size();
+	};
+	
+	// New storage: pooled arena
+	auto storeNew = [&]() {
+		AtChannel::Response response;
+		for (auto line: lines) {
+			if (strStartsWith(line, "+CMGL")) {
+				response.addLine(line);
+			} else if (response.linesCount() > 0 && line != "OK") {
+				response.appendToLastLine(line);
+			}
+		}
+		checksum_new += response.linesCount();
+	};
+	
+	measure("response: vector<string>", 10000, dump.size(), storeOld);
+	measure("response: pooled arena", 10000, dump.size(), storeNew);
+	
+	LOGD("Allocations per response: vector<string> %d, pooled arena %d\n",
+		static_cast<int>(countAllocations(storeOld)), static_cast<int>(countAllocations(storeNew)));
+	
+	if (checksum_old != checksum_new) {
+		LOGE("Responses mismatch: %d != %d\n", static_cast<int>(checksum_old), static_cast<int>(checksum_new));
+		return -1;
+	}
+	
+	// Buffer of destroyed response must be reused with its capacity
+	size_t capacity;
+	{
+		AtChannel::Response response;
+		response.addLine(dump);
+		capacity = response.capacity();
+	}
+	
+	AtChannel::Response reused;
+	reused.addLine("OK");
+	if (reused.capacity() != capacity) {
+		LOGE("Response storage is not reused: capacity %d, expected %d\n", static_cast<int>(reused.capacity()), static_cast<int>(capacity));
+		return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * Fake modem on PTY
+ * Emulates 115200 baud line (optional) and fixed command processing time.
+ * */
+class FakeModem {
+	protected:
+		int m_master = -1;
+		int m_turnaround = 0;
+		bool m_emulate_line = true;
+		int m_lines = 0;
+		std::string m_slave;
+		std::thread m_thread;
+		std::map<std::string, std::string> m_responses;
+		
+		void emulateLine(size_t bytes) {
+			// 10 bits per byte at 115200 baud
+			if (m_emulate_line)
+				usleep(bytes * 10 * 1000000 / 115200);
+		}
+		
+		std::string handleCommand(const std::string &cmd) {
+			if (cmd.empty())
+				return "";
+			
+			auto it = m_responses.find(cmd);
+			if (it != m_responses.end())
+				return it->second;
+			
+			// Query and action commands without args returns "+CMD: value"
+			if (cmd.find('=') == std::string::npos || cmd.back() == '?') {
+				std::string name = cmd.substr(0, cmd.find('?'));
+				return "\r\n" + name + ": \"value\"\r\n";
+			}
+			return "";
+		}
+		
+		void run() {
+			char buffer[256];
+			std::string line;
+			
+			while (true) {
+				int readed = read(m_master, buffer, sizeof(buffer));
+				if (readed <= 0)
+					break;
+				
+				line.append(buffer, readed);
+				
+				size_t pos;
+				while ((pos = line.find('\r')) != std::string::npos) {
+					std::string cmd = line.substr(0, pos);
+					line.erase(0, pos + 1);
+					
+					if (!strStartsWith(cmd, "AT"))
+						continue;
+					
+					m_lines++;
+					emulateLine(cmd.size() + 1);
+					if (m_turnaround > 0)
+						usleep(m_turnaround * 1000);
+					
+					std::string response;
+					size_t start = 2;
+					while (start <= cmd.size()) {
+						size_t end = std::min(cmd.find(';', start), cmd.size());
+						response += handleCommand(cmd.substr(start, end - start));
+						start = end + 1;
+					}
+					response += "\r\nOK\r\n";
+					
+					// Response arrives gradually, like on real line
+					for (size_t offset = 0; offset < response.size(); offset += 256) {
+						size_t chunk = std::min<size_t>(256, response.size() - offset);
+						emulateLine(chunk);
+						write(m_master, response.c_str() + offset, chunk);
+					}
+				}
+			}
+		}
+	public:
+		explicit FakeModem(int turnaround, bool emulate_line = true) : m_turnaround(turnaround), m_emulate_line(emulate_line) { }
+		
+		~FakeModem() {
+			if (m_master != -1)
+				close(m_master);
+			if (m_thread.joinable())
+				m_thread.join();
+		}
+		
+		bool start() {
+			m_master = posix_openpt(O_RDWR | O_NOCTTY);
+			if (m_master < 0 || grantpt(m_master) != 0 || unlockpt(m_master) != 0)
+				return false;
+			m_slave = ptsname(m_master);
+			m_thread = std::thread([this]() {
+				run();
+			});
+			return true;
+		}
+		
+		// Custom response for command (without "AT" and final "OK")
+		inline void setResponse(const std::string &cmd, const std::string &response) {
+			m_responses[cmd] = response;
+		}
+		
+		inline const std::string &getTty() {
+			return m_slave;
+		}
+		
+		inline int getLines() {
+			return m_lines;
+		}
+};
+
+/*
+ * Commands chaining vs sequential commands
+ * */
+static int benchChain(int argc, char *argv[]) {
+	int turnaround = argc > 2 ? strToInt(argv[2]) : 20;
+	
+	std::vector<AtChannel::BatchCommand> commands = {
+		{AtChannel::NO_RESPONSE, "AT+CMEE=1", ""},
+		{AtChannel::NO_RESPONSE, "AT+CREG=2", ""},
+		{AtChannel::NO_RESPONSE, "AT+CGREG=2", ""},
+		{AtChannel::NO_RESPONSE, "AT+CEREG=2", ""},
+		{AtChannel::NO_RESPONSE, "AT+CGEREP=2,0", ""},
+		{AtChannel::NO_RESPONSE, "AT+CNMI=0,1,0,2,0", ""},
+		{AtChannel::NO_RESPONSE, "AT+CIND=1", ""},
+		{AtChannel::NO_RESPONSE, "AT+CUSD=1", ""},
+		{AtChannel::NO_RESPONSE, "AT+BGLTEPLMN=1,30", ""},
+		{AtChannel::DEFAULT, "AT+CGMI", "+CGMI"},
+		{AtChannel::DEFAULT, "AT+CGMM", "+CGMM"},
+		{AtChannel::DEFAULT, "AT+CGMR", "+CGMR"},
+		{AtChannel::NUMERIC, "AT+CGSN", "+CGSN"},
+	};
+	
+	LOGD("Commands: %d, modem turnaround: %d ms\n", static_cast<int>(commands.size()), turnaround);
+	
+	for (bool chaining: {false, true}) {
+		FakeModem modem(turnaround);
+		Serial serial;
+		AtChannel at;
+		
+		if (!modem.start() || serial.open(modem.getTty(), 115200) != 0) {
+			LOGE("Can't create fake modem\n");
+			return -1;
+		}
+		
+		at.setSerial(&serial);
+		at.setChainingEnabled(chaining);
+		at.start();
+		
+		bool success = true;
+		measure(chaining ? "init: chained" : "init: sequential", 5, 0, [&]() {
+			for (auto &response: at.sendCommandBatch(commands)) {
+				if (response.error)
+					success = false;
+			}
+		});
+		
+		at.stop();
+		serial.close();
+		
+		LOGD("  %d command lines per init\n", modem.getLines() / 6);
+		
+		if (!success) {
+			LOGE("Some commands failed\n");
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * Command round trip in threaded and loop IO modes
+ * */
+static int benchIoMode(int argc, char *argv[]) {
+	int count = argc > 2 ? strToInt(argv[2]) : 2000;
+	
+	LOGD("Commands: %d, modem turnaround: 0 ms\n", count);
+	
+	for (auto mode: {AtChannel::IO_THREAD, AtChannel::IO_LOOP}) {
+		FakeModem modem(0, false);
+		Serial serial;
+		AtChannel at;
+		
+		if (!modem.start() || serial.open(modem.getTty(), 115200) != 0) {
+			LOGE("Can't create fake modem\n");
+			return -1;
+		}
+		
+		if (!Loop::init()) {
+			LOGE("Can't init loop\n");
+			return -1;
+		}
+		
+		at.setSerial(&serial);
+		at.setIoMode(mode);
+		at.start();
+		
+		int done = 0, errors = 0;
+		std::function<void()> next;
+		
+		// Every next command sent from callback of previous
+		next = [&]() {
+			at.sendCommandNoResponseAsync("AT", [&](const auto &response) {
+				if (response.error)
+					errors++;
+				
+				if (++done < count) {
+					next();
+				} else {
+					at.stop();
+					Loop::stop();
+				}
+			});
+		};
+		
+		auto start = std::chrono::steady_clock::now();
+		Loop::setTimeout(next, 0);
+		Loop::run();
+		auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		
+		serial.close();
+		
+		LOGD("%-32s %12.0f ns/cmd\n", mode == AtChannel::IO_LOOP ? "io: loop" : "io: thread", elapsed / count);
+		
+		if (errors > 0) {
+			LOGE("Failed commands: %d\n", errors);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * AT round trip and bulk read with different serial profiles
+ * */
+static int benchSerial(int argc, char *argv[]) {
+	std::string device = argc > 2 ? argv[2] : "";
+	int speed = argc > 3 ? strToInt(argv[3]) : 115200;
+	int count = 500;
+	
+	std::vector<std::pair<std::string, Serial::Profile>> profiles(3);
+	profiles[0].first = "default";
+	profiles[1].first = "low_latency";
+	profiles[1].second.low_latency = true;
+	profiles[2].first = "read_chunk=256";
+	profiles[2].second.read_chunk = 256;
+	
+	if (!device.size())
+		LOGD("No device specified, using fake modem (speed and low latency are ignored by PTY)\n");
+	
+	for (auto &it: profiles) {
+		Serial::Profile profile = it.second;
+		profile.speed = speed;
+		
+		FakeModem modem(0, false);
+		Serial serial;
+		AtChannel at;
+		
+		if (!device.size()) {
+			std::string dump = generateCmglDump(200);
+			modem.setResponse("+CMGL=4", dump.substr(0, dump.size() - strlen("\r\nOK\r\n")));
+			
+			if (!modem.start()) {
+				LOGE("Can't create fake modem\n");
+				return -1;
+			}
+		}
+		
+		if (serial.open(device.size() ? device : modem.getTty(), profile) != 0) {
+			LOGE("Can't open serial\n");
+			return -1;
+		}
+		
+		at.setSerial(&serial);
+		at.start();
+		
+		// AT round trip
+		std::vector<double> latency;
+		int errors = 0;
+		for (int i = 0; i < count; i++) {
+			auto start = std::chrono::steady_clock::now();
+			if (at.sendCommandNoResponse("AT") != 0)
+				errors++;
+			latency.push_back(std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count());
+		}
+		std::sort(latency.begin(), latency.end());
+		
+		// Bulk read
+		uint64_t bytes_before = at.getStats().bytes_read;
+		auto start = std::chrono::steady_clock::now();
+		auto response = at.sendCommandMultiline("AT+CMGL=4", "+CMGL");
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		uint64_t bytes = at.getStats().bytes_read - bytes_before;
+		
+		at.stop();
+		serial.close();
+		
+		LOGD("%-16s AT: p50 %8.0f us, p99 %8.0f us | CMGL: %6d bytes, %8.2f KB/s\n", it.first.c_str(),
+			latency[latency.size() / 2], latency[latency.size() * 99 / 100],
+			static_cast<int>(bytes), bytes / elapsed / 1024.0);
+		
+		if (errors > 0 || response.error) {
+			LOGE("Failed commands: %d\n", errors + (response.error ? 1 : 0));
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * Control commands latency while SMS listing running, with single channel and over CMUX
+ * */
+static int benchCmux(int argc, char *argv[]) {
+	int list_time = argc > 2 ? strToInt(argv[2]) : 300;
+	int count = 20;
+	
+	// 50 messages, "+CMGL" with PDU per message
+	std::string dump = generateCmglDump(50);
+	
+	LOGD("Commands: %d, SMS list time: %d ms\n", count, list_time);
+	
+	for (bool cmux: {false, true}) {
+		CmuxLoopback modem;
+		Serial serial;
+		Cmux mux;
+		AtChannel control, bulk;
+		
+		modem.onCommand([&](int, const std::string &cmd) -> std::string {
+			if (strStartsWith(cmd, "AT+CMGL")) {
+				usleep(list_time * 1000);
+				return dump;
+			}
+			return "\r\nOK\r\n";
+		});
+		
+		if (!modem.start() || serial.open(modem.getTty(), 115200) != 0) {
+			LOGE("Can't create fake modem\n");
+			return -1;
+		}
+		
+		control.setSerial(&serial);
+		control.start();
+		
+		if (cmux) {
+			bool success = control.sendCommandNoResponse("AT+CMUX=0") == 0;
+			control.stop();
+			
+			if (!success || !mux.open(&serial, 2)) {
+				LOGE("Can't open CMUX\n");
+				return -1;
+			}
+			
+			control.setSerial(mux.getChannel(1));
+			bulk.setSerial(mux.getChannel(2));
+			control.start();
+			bulk.start();
+		}
+		
+		AtChannel &bulk_at = cmux ? bulk : control;
+		
+		// Background SMS listing
+		bool stop = false;
+		int lists = 0, errors = 0;
+		std::thread bulk_thread([&]() {
+			while (!stop) {
+				auto response = bulk_at.sendCommandMultiline("AT+CMGL=4", "+CMGL");
+				if (response.error || response.linesCount() != 50) {
+					errors++;
+				} else {
+					lists++;
+				}
+			}
+		});
+		
+		// Wait for first list started
+		usleep(50 * 1000);
+		
+		std::vector<double> latency;
+		for (int i = 0; i < count; i++) {
+			auto start = std::chrono::steady_clock::now();
+			if (control.sendCommandNoResponse("AT") != 0)
+				errors++;
+			latency.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+			usleep(10 * 1000);
+		}
+		std::sort(latency.begin(), latency.end());
+		
+		stop = true;
+		bulk_thread.join();
+		
+		control.stop();
+		bulk.stop();
+		mux.close();
+		serial.close();
+		
+		LOGD("%-16s AT: p50 %8.2f ms, max %8.2f ms | SMS lists: %d\n", cmux ? "cmux" : "single channel",
+			latency[latency.size() / 2], latency.back(), lists);
+		
+		if (errors > 0) {
+			LOGE("Failed commands: %d\n", errors);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * Record session with fake modem, then replay it in realtime and fast modes
+ * */
+static int benchReplay(int argc, char *argv[]) {
+	std::string trace = argc > 2 ? argv[2] : "";
+	
+	if (!trace.size()) {
+		trace = "/tmp/usbmodem-bench.trace";
+		
+		FakeModem modem(5);
+		Serial serial;
+		AtChannel at;
+		
+		std::string dump = generateCmglDump(20);
+		modem.setResponse("+CMGL=4", dump.substr(0, dump.size() - strlen("\r\nOK\r\n")));
+		
+		if (!modem.start() || serial.open(modem.getTty(), 115200) != 0) {
+			LOGE("Can't create fake modem\n");
+			return -1;
+		}
+		
+		serial.startRecording(trace);
+		at.setSerial(&serial);
+		at.start();
+		
+		for (int i = 0; i < 5; i++) {
+			at.sendCommandNoResponse("ATE0");
+			at.sendCommand("AT+CGMI", "+CGMI");
+			at.sendCommand("AT+CSQ", "+CSQ");
+			at.sendCommandMultiline("AT+CMGL=4", "+CMGL");
+		}
+		
+		at.stop();
+		serial.stopRecording();
+		serial.close();
+		
+		LOGD("Recorded session with fake modem to %s\n", trace.c_str());
+	}
+	
+	// Commands of original session
+	std::vector<SerialTrace::Record> records;
+	if (!SerialTrace::load(trace, &records))
+		return -1;
+	
+	std::vector<std::string> commands;
+	std::string write_stream;
+	for (auto &record: records) {
+		if (record.dir == SerialTrace::WRITE)
+			write_stream += record.data;
+	}
+	size_t pos, start = 0;
+	while ((pos = write_stream.find('\r', start)) != std::string::npos) {
+		std::string cmd = write_stream.substr(start, pos - start);
+		if (strStartsWith(cmd, "AT"))
+			commands.push_back(cmd);
+		start = pos + 1;
+	}
+	
+	LOGD("Trace: %d records, %d commands\n", static_cast<int>(records.size()), static_cast<int>(commands.size()));
+	
+	for (bool realtime: {true, false}) {
+		SerialReplay replay;
+		AtChannel at;
+		
+		if (replay.open(trace, realtime) != 0) {
+			LOGE("Can't open trace\n");
+			return -1;
+		}
+		
+		at.setSerial(&replay);
+		at.start();
+		
+		int errors = 0;
+		size_t lines = 0;
+		auto begin = std::chrono::steady_clock::now();
+		for (auto &cmd: commands) {
+			// "+NAME" or "*NAME" commands has response with same prefix
+			std::string name = cmd.substr(2, cmd.find_first_of("=?") - 2);
+			bool has_prefix = strStartsWith(name, "+") || strStartsWith(name, "*");
+			
+			AtChannel::Response response;
+			if (at.sendCommand(has_prefix ? AtChannel::MULTILINE : AtChannel::NO_RESPONSE, cmd, has_prefix ? name : "", &response) != 0)
+				errors++;
+			lines += response.linesCount();
+		}
+		double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+		
+		at.stop();
+		replay.close();
+		
+		LOGD("%-16s %8.2f ms | response lines: %d, diverged: %s\n", realtime ? "realtime" : "fast",
+			elapsed, static_cast<int>(lines), replay.isDiverged() ? "yes" : "no");
+		
+		if (errors > 0 || replay.isDiverged()) {
+			LOGE("Failed commands: %d\n", errors);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * ModemAsr1802 over simulator: time to connected, API latency during URC storm, SMS listing
+ * */
+static int benchAsr1802(int argc, char *argv[]) {
+	int sms_count = argc > 2 ? strToInt(argv[2]) : 100;
+	int latency = argc > 3 ? strToInt(argv[3]) : 5;
+	int count = 50;
+	
+	Asr1802Simulator sim;
+	sim.setLatency(latency, latency / 2);
+	sim.setAttachDelay(300);
+	sim.generateSms(sms_count);
+	
+	if (!sim.start()) {
+		LOGE("Can't create simulator\n");
+		return -1;
+	}
+	
+	if (!Loop::init()) {
+		LOGE("Can't init loop\n");
+		return -1;
+	}
+	
+	LOGD("Simulator: %s, latency: %d ms, SMS: %d\n", sim.getTty().c_str(), latency, sms_count);
+	
+	ModemAsr1802 modem;
+	modem.setSerial(sim.getTty(), 115200);
+	modem.setPdpConfig("IP", "internet", "", "", "");
+	modem.getAtChannel()->setVerbose(false);
+	
+	bool success = false;
+	int64_t start = getCurrentTimestamp();
+	std::vector<double> api_latency;
+	std::function<void()> next;
+	
+	// API commands, while modem floods with signal levels
+	next = [&]() {
+		auto cmd_start = std::chrono::steady_clock::now();
+		modem.sendAtCommand("AT+CESQ", [&, cmd_start](bool cmd_success, const std::string &response) {
+			if (!cmd_success) {
+				LOGE("AT+CESQ failed: %s\n", response.c_str());
+				Loop::stop();
+				return;
+			}
+			
+			api_latency.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - cmd_start).count());
+			
+			if (api_latency.size() < static_cast<size_t>(count)) {
+				next();
+				return;
+			}
+			
+			std::sort(api_latency.begin(), api_latency.end());
+			LOGD("%-24s p50 %8.2f ms, max %8.2f ms (URC's sent: %d)\n", "API during URC storm",
+				api_latency[api_latency.size() / 2], api_latency.back(), static_cast<int>(sim.getStats().urcs));
+			
+			// SMS listing
+			auto list_start = std::chrono::steady_clock::now();
+			modem.getSmsList(Modem::SMS_DIR_ALL, [&, list_start](bool list_success, const auto &list) {
+				double elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - list_start).count();
+				LOGD("%-24s %8.2f ms, %d messages\n", "SMS list", elapsed, static_cast<int>(list.size()));
+				
+				success = list_success && list.size() > 0;
+				Loop::stop();
+			});
+		});
+	};
+	
+	modem.on<Modem::EvDataConnected>([&](const auto &event) {
+		if (event.is_update)
+			return;
+		
+		LOGD("%-24s %8d ms\n", "Time to connected", static_cast<int>(getCurrentTimestamp() - start));
+		
+		sim.startUrcStorm("+CESQ: 99,99,255,255,20,50", 20000, 0);
+		
+		// SMS are initialized in background after open()
+		Loop::setTimeout(next, 100);
+	});
+	
+	if (!modem.open()) {
+		LOGE("Can't open modem\n");
+		return -1;
+	}
+	
+	LOGD("%-24s %8d ms\n", "Time to open", static_cast<int>(getCurrentTimestamp() - start));
+	
+	Loop::setTimeout([&]() {
+		LOGE("Timeout\n");
+		Loop::stop();
+	}, 30 * 1000);
+	
+	Loop::run();
+	
+	modem.close();
+	sim.stop();
+	
+	return success ? 0 : -1;
+}
+
+/*
+ * SMS list on 115200 line: decode after final "OK" vs streaming decode of every record while receiving
+ * */
+static int benchStream(int argc, char *argv[]) {
+	int sms_count = argc > 2 ? strToInt(argv[2]) : 100;
+	
+	// Fake modem adds final "OK"
+	std::string dump = generateCmglDump(sms_count);
+	dump.erase(dump.rfind("\r\nOK\r\n"));
+	
+	LOGD("SMS: %d, response: %d bytes\n", sms_count, static_cast<int>(dump.size()));
+	
+	// "+CMGL: <id>,<stat>,,<len>\r\n<pdu>"
+	auto decode = [](const char *record) {
+		const char *pdu_hex = strstr(record, "\r\n");
+		Pdu pdu;
+		PduUserDataHeader hdr;
+		if (!pdu_hex || !decodePdu(hex2bin(pdu_hex + 2), &pdu, false))
+			return false;
+		return decodeSmsDcsData(&pdu, &hdr).first;
+	};
+	
+	int decoded_results[2] = {};
+	
+	for (bool stream: {false, true}) {
+		FakeModem modem(0);
+		Serial serial;
+		AtChannel at;
+		
+		modem.setResponse("+CMGL=4", dump);
+		
+		if (!modem.start() || serial.open(modem.getTty(), 115200) != 0) {
+			LOGE("Can't create fake modem\n");
+			return -1;
+		}
+		
+		if (!Loop::init()) {
+			LOGE("Can't init loop\n");
+			return -1;
+		}
+		
+		at.setSerial(&serial);
+		at.start();
+		
+		int records = 0, decoded = 0, errors = 0;
+		size_t peak = 0;
+		double first = 0;
+		
+		auto start = std::chrono::steady_clock::now();
+		auto elapsed = [&]() {
+			return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		};
+		
+		if (stream) {
+			at.sendCommandStreamAsync("AT+CMGL=4", "+CMGL", [&](const char *record) {
+				if (!records++)
+					first = elapsed();
+				peak = std::max(peak, strlen(record) + 1);
+				decoded += decode(record) ? 1 : 0;
+			}, [&](const auto &response) {
+				errors += response.error ? 1 : 0;
+				at.stop();
+				Loop::stop();
+			}, 0, AtChannel::PRIORITY_BULK);
+		} else {
+			at.sendCommandMultilineAsync("AT+CMGL=4", "+CMGL", [&](const auto &response) {
+				errors += response.error ? 1 : 0;
+				first = elapsed();
+				
+				for (size_t i = 0; i < response.linesCount(); i++) {
+					records++;
+					peak += strlen(response.line(i)) + 1;
+					decoded += decode(response.line(i)) ? 1 : 0;
+				}
+				
+				at.stop();
+				Loop::stop();
+			}, 0, AtChannel::PRIORITY_BULK);
+		}
+		
+		Loop::run();
+		double total = elapsed();
+		
+		serial.close();
+		
+		LOGD("%-10s first SMS %8.2f ms, all decoded %8.2f ms, peak response %7d bytes, records: %d\n",
+			stream ? "stream" : "buffered", first, total, static_cast<int>(peak), records);
+		
+		if (errors > 0 || records != sms_count) {
+			LOGE("Failed: errors %d, records %d\n", errors, records);
+			return -1;
+		}
+		
+		decoded_results[stream] = decoded;
+	}
+	
+	if (decoded_results[0] != decoded_results[1]) {
+		LOGE("Decoded SMS mismatch: %d != %d\n", decoded_results[0], decoded_results[1]);
+		return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * Unsolicited lines from reader thread to Loop: timer per line vs lock-free queue with batched wakeups
+ * */
+static int benchHandoff(int argc, char *argv[]) {
+	int count = argc > 2 ? strToInt(argv[2]) : 50000;
+	
+	LOGD("URC's: %d\n", count);
+	
+	for (bool queue: {false, true}) {
+		Asr1802Simulator sim;
+		Serial serial;
+		AtChannel at;
+		
+		if (!sim.start() || serial.open(sim.getTty(), 115200) != 0) {
+			LOGE("Can't create simulator\n");
+			return -1;
+		}
+		
+		if (!Loop::init()) {
+			LOGE("Can't init loop\n");
+			return -1;
+		}
+		
+		int handled = 0;
+		
+		auto handler = [&]() {
+			if (++handled == count)
+				Loop::stop();
+		};
+		
+		at.setSerial(&serial);
+		at.setUnsolicitedOnLoop(queue);
+		at.onUnsolicited("+CEREG", [&](const std::string &) {
+			// Already on Loop with queue, old way - hop by timer
+			if (queue) {
+				handler();
+			} else {
+				Loop::setTimeout(handler, 0);
+			}
+		});
+		at.start();
+		
+		if (at.sendCommandNoResponse("ATE0") != 0) {
+			LOGE("Simulator is not responding\n");
+			return -1;
+		}
+		
+		auto start = std::chrono::steady_clock::now();
+		sim.startUrcStorm("+CEREG: 1,\"1A2B\",\"0123ABCD\",7", count, 0);
+		Loop::run();
+		auto elapsed = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count();
+		
+		at.stop();
+		serial.close();
+		sim.stop();
+		
+		LOGD("%-24s %10.0f ns/urc\n", queue ? "handoff: spsc queue" : "handoff: timer per urc", elapsed / count);
+		
+		if (handled != count) {
+			LOGE("Handled %d of %d\n", handled, count);
+			return -1;
+		}
+	}
+	
+	return 0;
+}
+
+/*
+ * AtParser: copying vs string_view results
+ * */
+static int benchParser(int argc, char *argv[]) {
+	struct Sample {
+		const char *line;
+		int args;
+		int lists; // first N arguments are lists
+	};
+	
+	static const Sample corpus[] = {
+		{"+CPMS: (\"SM\",\"ME\",\"SR\"),(\"SM\",\"ME\"),(\"SM\",\"ME\")", 3, 3},
+		{"+CPMS: (\"ME\",\"MT\",\"SM\",\"SR\"),(\"ME\",\"MT\",\"SM\",\"SR\"),(\"ME\",\"MT\",\"SM\",\"SR\")", 3, 3},
+		{"+COPS: (2,\"MegaFon\",\"MegaFon\",\"25002\",7),(3,\"Beeline\",\"Beeline\",\"25099\",7),(3,\"MTS RUS\",\"MTS RUS\",\"25001\",2),"
+			"(1,\"Tele2\",\"Tele2\",\"25020\",7),,(0,1,2,3,4),(0,1,2)", 7, 7},
+		{"+CGCONTRDP: 1,5,\"internet.mts.ru\",\"10.123.45.67\",\"255.255.255.0\",\"10.123.45.1\",\"217.118.66.243\",\"217.118.66.244\"", 8, 0},
+		{"+CGCONTRDP: 1,5,\"internet.mts.ru\",\"254.128.0.0.0.0.0.0.0.0.0.0.0.0.0.1\",\"\",\"\",\"32.1.72.96.72.96.0.0.0.0.0.0.0.0.136.136\"", 7, 0},
+		{"*CGDFLT: \"IP\",\"internet\",0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,1,0,0", 21, 0},
+	};
+	
+	int iterations = argc > 2 ? atoi(argv[2]) : 100000;
+	
+	size_t checksum_copy = 0, checksum_view = 0;
+	
+	auto parseCorpus = [&](auto &list, auto &value, size_t *checksum) {
+		for (size_t i = 0; i < std::size(corpus); i++) {
+			AtParser parser(corpus[i].line);
+			for (int arg = 0; arg < corpus[i].args; arg++) {
+				if (arg < corpus[i].lists) {
+					list.clear();
+					parser.parseList(&list);
+					*checksum += list.size();
+				} else {
+					parser.parseString(&value);
+					*checksum += value.size();
+				}
+			}
+			if (!parser.success())
+				LOGE("Can't parse: %s\n", corpus[i].line);
+		}
+	};
+	
+	std::vector<std::string> copy_list;
+	std::string copy_value;
+	
+	std::vector<std::string_view> view_list;
+	std::string_view view_value;
+	
+	// Containers are reused, so only steady state allocations are counted
+	parseCorpus(copy_list, copy_value, &checksum_copy);
+	parseCorpus(view_list, view_value, &checksum_view);
+	
+	size_t allocs_copy = countAllocations([&]() {
+		parseCorpus(copy_list, copy_value, &checksum_copy);
+	});
+	size_t allocs_view = countAllocations([&]() {
+		parseCorpus(view_list, view_value, &checksum_view);
+	});
+	
+	LOGD("Corpus: %d lines, allocations per corpus: std::string %d, std::string_view %d\n",
+		static_cast<int>(std::size(corpus)), static_cast<int>(allocs_copy), static_cast<int>(allocs_view));
+	
+	measure("parser: std::string", iterations, 0, [&]() {
+		parseCorpus(copy_list, copy_value, &checksum_copy);
+	});
+	
+	measure("parser: std::string_view", iterations, 0, [&]() {
+		parseCorpus(view_list, view_value, &checksum_view);
+	});
+	
+	if (checksum_copy != checksum_view) {
+		LOGE("Parsers output mismatch: %d != %d\n", static_cast<int>(checksum_copy), static_cast<int>(checksum_view));
+		return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * AtParser: numeric fields decoding
+ * */
+static int benchNumeric(int argc, char *argv[]) {
+	struct Field {
+		std::string_view value;
+		int base;
+	};
+	
+	// Fields of +CEREG, +CSQ, +CESQ, +CGDFLT and +CMGL, as they appear in line (not NUL terminated)
+	static const char *line = "2,1,\"1A2B\",\"0123ABCD\",7,31,99,99,255,-1,12,255,0,0,0,0,0,1,0,0,156,4294967295,\"FFFFFFFFF\"";
+	
+	std::vector<Field> fields;
+	const char *cursor = line;
+	while (*cursor) {
+		const char *start = cursor;
+		while (*cursor && *cursor != ',')
+			cursor++;
+		
+		bool quoted = *start == '"';
+		fields.push_back({std::string_view(start + quoted, cursor - start - 2 * quoted), quoted ? 16 : 10});
+		
+		if (*cursor)
+			cursor++;
+	}
+	
+	int iterations = argc > 2 ? atoi(argv[2]) : 1000000;
+	
+	int64_t checksum_old = 0, checksum_new = 0;
+	int overflow_old = 0, overflow_new = 0;
+	
+	// Old decoder: strtoul() for everything, 32 bit result
+	measure("numeric: strtoul", iterations, 0, [&]() {
+		for (auto &field: fields) {
+			char *number_end = nullptr;
+			uint32_t value = strtoul(field.value.data(), &number_end, field.base);
+			if (number_end != field.value.data() && number_end <= field.value.data() + field.value.size()) {
+				checksum_old += static_cast<int32_t>(value);
+			} else {
+				overflow_old++;
+			}
+		}
+	});
+	
+	// New decoder: std::from_chars() on exact range
+	measure("numeric: from_chars", iterations, 0, [&]() {
+		for (auto &field: fields) {
+			int32_t value;
+			if (AtParser::parseNumeric(field.value.data(), field.value.data() + field.value.size(), field.base, &value)) {
+				checksum_new += value;
+			} else {
+				overflow_new++;
+			}
+		}
+	});
+	
+	measure("numeric: from_chars 64 bit", iterations, 0, [&]() {
+		for (auto &field: fields) {
+			int64_t value;
+			if (AtParser::parseNumeric(field.value.data(), field.value.data() + field.value.size(), field.base, &value))
+				checksum_new += value;
+		}
+	});
+	
+	// Values not fitting to int32_t silently truncated by old decoder
+	LOGD("Fields: %d, rejected per pass: strtoul %d, from_chars %d\n", static_cast<int>(fields.size()),
+		overflow_old / (iterations + 1), overflow_new / (iterations + 1));
+	
+	return checksum_new != 0 && checksum_old != 0 ? 0 : -1;
+}
+
+/*
+ * GSM 7-bit unpacking
+ * */
+static int benchUnpack7bit(int argc, char *argv[]) {
+	// Concatenated SMS part: 6 bytes UDH + 153 septets
+	size_t chars = argc > 2 ? atoi(argv[2]) : 160;
+	
+	std::string data;
+	uint32_t seed = 1;
+	for (size_t i = 0; i < (chars * 7 + 7) / 8; i++) {
+		seed = seed * 1103515245 + 12345;
+		data += static_cast<char>((seed >> 16) & 0xFF);
+	}
+	
+	size_t udh_chars = (6 * 8 + 6) / 7;
+	size_t checksum_old = 0, checksum_new = 0;
+	
+	// Old unpacker: per-char shifts and masks, append by byte, UDH removed with substr()
+	auto unpackOld = [](const std::string &data, size_t max_chars) {
+		size_t total_chars = std::min(max_chars, data.size() * 8 / 7);
+		
+		std::string out;
+		out.reserve(total_chars);
+		
+		const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.c_str());
+		for (size_t i = 0; i < total_chars; i++) {
+			size_t bit_off = i * 7;
+			size_t byte_off = bit_off / 8;
+			
+			uint8_t shift = bit_off % 8;
+			uint8_t size = std::min(7, 8 - shift);
+			
+			uint8_t value = (bytes[byte_off] >> shift) & ((1 << size) - 1);
+			
+			if (size < 7)
+				value |= (bytes[byte_off + 1] & ((1 << (7 - size)) - 1)) << size;
+			
+			out += static_cast<char>(value);
+		}
+		
+		return out;
+	};
+	
+	measure("unpack7bit: per char", 100000, data.size(), [&]() {
+		checksum_old += unpackOld(data, chars).size();
+	});
+	
+	measure("unpack7bit: 64-bit blocks", 100000, data.size(), [&]() {
+		checksum_new += unpack7bit(data, chars).size();
+	});
+	
+	measure("unpack7bit: per char + substr", 100000, data.size(), [&]() {
+		checksum_old += unpackOld(data, chars).substr(udh_chars).size();
+	});
+	
+	measure("unpack7bit: skip udh", 100000, data.size(), [&]() {
+		checksum_new += unpack7bit(data, chars, udh_chars).size();
+	});
+	
+	if (checksum_old != checksum_new || unpackOld(data, chars).substr(udh_chars) != unpack7bit(data, chars, udh_chars)) {
+		LOGE("Unpackers output mismatch\n");
+		return -1;
+	}
+	
+	return 0;
+}
+
+/*
+ * GSM 7-bit to UTF-8 conversion
+ * */
+static int benchGsm7(int argc, char *argv[]) {
+	static const uint16_t gsm7[] = {
+		0x0040, 0x00A3, 0x0024, 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC, 0x00F2, 0x00C7, 0x000A, 0x00D8, 0x00F8, 0x000D, 0x00C5, 0x00E5,
+		0x0394, 0x005F, 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8, 0x03A3, 0x0398, 0x039E, 0x00A0, 0x00C6, 0x00E6, 0x00DF, 0x00C9,
+		0x0020, 0x0021, 0x0022, 0x0023, 0x00A4, 0x0025, 0x0026, 0x0027, 0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
+		0x0030, 0x0031, 0x0032, 0x0033, 0x0034, 0x0035, 0x0036, 0x0037, 0x0038, 0x0039, 0x003A, 0x003B, 0x003C, 0x003D, 0x003E, 0x003F,
+		0x00A1, 0x0041, 0x0042, 0x0043, 0x0044, 0x0045, 0x0046, 0x0047, 0x0048, 0x0049, 0x004A, 0x004B, 0x004C, 0x004D, 0x004E, 0x004F,
+		0x0050, 0x0051, 0x0052, 0x0053, 0x0054, 0x0055, 0x0056, 0x0057, 0x0058, 0x0059, 0x005A, 0x00C4, 0x00D6, 0x00D1, 0x00DC, 0x00A7,
+		0x00BF, 0x0061, 0x0062, 0x0063, 0x0064, 0x0065, 0x0066, 0x0067, 0x0068, 0x0069, 0x006A, 0x006B, 0x006C, 0x006D, 0x006E, 0x006F,
+		0x0070, 0x0071, 0x0072, 0x0073, 0x0074, 0x0075, 0x0076, 0x0077, 0x0078, 0x0079, 0x007A, 0x00E4, 0x00F6, 0x00F1, 0x00FC, 0x00E0
+	};
+	
+	static const std::map<uint8_t, uint16_t> gsm7_ext = {
+		{0x0A, 0x000C}, {0x14, 0x005E}, {0x1B, 0x0020}, {0x28, 0x007B},
+		{0x29, 0x007D}, {0x2F, 0x005C}, {0x3C, 0x005B}, {0x3D, 0x007E},
+		{0x3E, 0x005D}, {0x40, 0x007C}, {0x65, 0x20AC}
+	};
+	
+	// Concatenated SMS, 153 septets per part
+	int parts = argc > 2 ? atoi(argv[2]) : 1000;
+	
+	// Mostly latin text, some national chars and escaped symbols (€, [, ])
+	std::string corpus;
+	uint32_t seed = 1;
+	while (corpus.size() < static_cast<size_t>(parts) * 153) {
+		seed = seed * 1103515245 + 12345;
+		uint32_t rnd = (seed >> 16) & 0x7FFF;
+		
+		if (rnd % 50 == 0) {
+			corpus += '\x1B';
+			corpus += "\x65\x3C\x3E"[rnd % 3];
+		} else if (rnd % 20 == 0) {
+			corpus += static_cast<char>(rnd % 0x20);
+		} else {
+			corpus += static_cast<char>(0x20 + rnd % 0x60);
+		}
+	}
+	
+	std::vector<std::string> messages;
+	for (size_t offset = 0; offset < corpus.size(); offset += 153)
+		messages.push_back(corpus.substr(offset, 153));
+	
+	LOGD("Input: %d parts, %d septets\n", static_cast<int>(messages.size()), static_cast<int>(corpus.size()));
+	
+	// Old converter: std::map lookup after escape, codepoint encoded for every char
+	auto convertOld = [](const std::string &data) {
+		std::string out;
+		out.reserve(data.size());
+		
+		bool escape = false;
+		for (auto c: data) {
+			uint8_t byte = static_cast<uint8_t>(c);
+			if (escape) {
+				auto found = gsm7_ext.find(byte);
+				if (found != gsm7_ext.cend()) {
+					strAppendCodepoint(out, found->second);
+				} else {
+					out += ' ';
+					strAppendCodepoint(out, gsm7[byte & 0x7F]);
+				}
+				escape = false;
+			} else if (byte == 0x1B) {
+				escape = true;
+			} else {
+				strAppendCodepoint(out, byte > 0x7F ? 0xFFFD : gsm7[byte]);
+			}
+		}
+		
+		if (escape)
+			out += ' ';
+		
+		return out;
+	};
+	
+	size_t checksum_old = 0, checksum_new = 0;
+	
+	measure("gsm7: codepoint + map", 100, corpus.size(), [&]() {
+		for (auto &message: messages)
+			checksum_old += convertOld(message).size();
+	});
+	
+	measure("gsm7: utf-8 tables", 100, corpus.size(), [&]() {
+		for (auto &message: messages)
+			checksum_new += convertGsmToUtf8(message).size();
+	});
+	
+	for (auto &message: messages) {
+		if (convertOld(message) != convertGsmToUtf8(message)) {
+			LOGE("Converters output mismatch\n");
+			return -1;
+		}
+	}
+	
+	if (checksum_old != checksum_new) {
+		LOGE("Converters output mismatch: %d != %d\n", static_cast<int>(checksum_old), static_cast<int>(checksum_new));
+		return -1;
+	}
+	
+	return 0;
+}
+
+int main(int argc, char *argv[]) {
+	static std::map<std::string, BenchmarkCallback> benchmarks = {
+		{"framer", benchFramer},
+		{"response", benchResponse},
+		{"chain", benchChain},
+		{"io", benchIoMode},
+		{"serial", benchSerial},
+		{"cmux", benchCmux},
+		{"replay", benchReplay},
+		{"asr1802", benchAsr1802},
+		{"stream", benchStream},
+		{"handoff", benchHandoff},
+		{"parser", benchParser},
+		{"numeric", benchNumeric},
+		{"unpack7bit", benchUnpack7bit},
+		{"gsm7", benchGsm7},
+	};
+	
+	if (argc >= 2) {
+		auto it = benchmarks.find(argv[1]);
+		if (it != benchmarks.end())
+			return it->second(argc, argv);
+	}
+	
+	fprintf(stderr, "usage: %s <name> [args]\n", argv[0]);
+	fprintf(stderr, "  %s framer [cmgl_dump] - AT line framers\n", argv[0]);
+	fprintf(stderr, "  %s response [cmgl_dump] - multiline response storage\n", argv[0]);
+	fprintf(stderr, "  %s chain [turnaround_ms] - init commands with and without chaining\n", argv[0]);
+	fprintf(stderr, "  %s io [count] - command round trip in thread and loop IO modes\n", argv[0]);
+	fprintf(stderr, "  %s serial [device] [speed] - AT round trip and CMGL throughput per serial profile\n", argv[0]);
+	fprintf(stderr, "  %s cmux [list_time_ms] - control commands latency during SMS listing, single channel vs CMUX\n", argv[0]);
+	fprintf(stderr, "  %s replay [trace] - replay recorded serial trace in realtime and fast modes\n", argv[0]);
+	fprintf(stderr, "  %s asr1802 [sms_count] [latency_ms] - time to connected, API latency during URC storm and SMS listing on simulator\n", argv[0]);
+	fprintf(stderr, "  %s stream [sms_count] - SMS list decode after full response vs streaming\n", argv[0]);
+	fprintf(stderr, "  %s handoff [count] - unsolicited lines from reader thread to Loop, timer per line vs lock-free queue\n", argv[0]);
+	fprintf(stderr, "  %s parser [iterations] - AtParser allocations and speed, std::string vs std::string_view results\n", argv[0]);
+	fprintf(stderr, "  %s numeric [iterations] - numeric fields decoding, strtoul vs from_chars\n", argv[0]);
+	fprintf(stderr, "  %s unpack7bit [chars] - GSM 7-bit unpacking, per char vs 64-bit blocks\n", argv[0]);
+	fprintf(stderr, "  %s gsm7 [parts] - GSM 7-bit to UTF-8 conversion of multipart SMS, codepoint encoder vs pre-encoded tables\n", argv[0]);
+	
+	return -1;
+}
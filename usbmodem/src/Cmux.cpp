@@ -0,0 +1,551 @@
+#include "Cmux.h"
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+// Max information field length in basic option
+static constexpr size_t MAX_FRAME_DATA = 32767;
+
+// MSC V.24 signals: EA | RTC | RTR | DV
+static constexpr uint8_t MSC_SIGNALS = 0x8D;
+static constexpr uint8_t MSC_FC = 0x02;
+
+// Pending data of DLC, when modem asked to stop sending (AtChannel is too slow)
+static constexpr size_t PEER_FLOW_OFF_SIZE = 16 * 1024;
+
+Cmux::Cmux() {
+	
+}
+
+Cmux::~Cmux() {
+	close();
+}
+
+/*
+ * Frames codec
+ * */
+uint8_t Cmux::calcFcs(const uint8_t *data, size_t size) {
+	// CRC-8, reversed polynom x^8 + x^2 + x + 1
+	uint8_t crc = 0xFF;
+	for (size_t i = 0; i < size; i++) {
+		crc ^= data[i];
+		for (int bit = 0; bit < 8; bit++)
+			crc = (crc & 1) ? (crc >> 1) ^ 0xE0 : (crc >> 1);
+	}
+	return 0xFF - crc;
+}
+
+std::string Cmux::encodeFrame(int dlci, uint8_t type, bool cr, bool pf, const char *data, size_t size) {
+	std::string frame;
+	frame.reserve(size + 7);
+	
+	frame += static_cast<char>(FLAG);
+	frame += static_cast<char>((dlci << 2) | (cr ? 0x02 : 0) | 0x01);
+	frame += static_cast<char>(type | (pf ? PF : 0));
+	
+	if (size > 127) {
+		frame += static_cast<char>((size & 0x7F) << 1);
+		frame += static_cast<char>(size >> 7);
+	} else {
+		frame += static_cast<char>((size << 1) | 0x01);
+	}
+	
+	// UIH checksum covers only header
+	size_t fcs_size = frame.size() - 1;
+	
+	if (size > 0)
+		frame.append(data, size);
+	
+	if (type != FRAME_UIH)
+		fcs_size = frame.size() - 1;
+	
+	frame += static_cast<char>(calcFcs(reinterpret_cast<const uint8_t *>(frame.data() + 1), fcs_size));
+	frame += static_cast<char>(FLAG);
+	
+	return frame;
+}
+
+std::string Cmux::encodeControl(uint8_t type, bool cr, const std::string &value) {
+	std::string msg;
+	msg += static_cast<char>(type | (cr ? 0x02 : 0) | 0x01);
+	msg += static_cast<char>((value.size() << 1) | 0x01);
+	msg += value;
+	return msg;
+}
+
+void Cmux::Decoder::feed(const char *data, size_t size, const std::function<void(const Frame &)> &callback) {
+	m_buffer.append(data, size);
+	
+	const uint8_t *buffer = reinterpret_cast<const uint8_t *>(m_buffer.data());
+	size_t pos = 0;
+	
+	while (true) {
+		// Opening flag
+		while (pos < m_buffer.size() && buffer[pos] != FLAG)
+			pos++;
+		
+		// Closing flag of previous frame can be followed by opening flag of next
+		size_t start = pos;
+		while (start < m_buffer.size() && buffer[start] == FLAG)
+			start++;
+		
+		size_t avail = m_buffer.size() - start;
+		if (avail < 3)
+			break;
+		
+		// Address without EA bit is not supported in basic option
+		if (!(buffer[start] & 0x01)) {
+			pos = start;
+			continue;
+		}
+		
+		size_t header_size = 3;
+		size_t data_size = buffer[start + 2] >> 1;
+		if (!(buffer[start + 2] & 0x01)) {
+			if (avail < 4)
+				break;
+			data_size |= buffer[start + 3] << 7;
+			header_size = 4;
+		}
+		
+		if (data_size > MAX_FRAME_DATA) {
+			pos = start;
+			continue;
+		}
+		
+		// Wait for full frame
+		size_t frame_size = header_size + data_size + 2;
+		if (avail < frame_size)
+			break;
+		
+		uint8_t type = buffer[start + 1] & ~PF;
+		size_t fcs_size = type == FRAME_UIH ? header_size : header_size + data_size;
+		
+		if (buffer[start + frame_size - 1] != FLAG || calcFcs(buffer + start, fcs_size) != buffer[start + header_size + data_size]) {
+			LOGD("CMUX: broken frame, skip...\n");
+			pos = start;
+			continue;
+		}
+		
+		Frame frame = {};
+		frame.dlci = buffer[start] >> 2;
+		frame.cr = (buffer[start] & 0x02) != 0;
+		frame.pf = (buffer[start + 1] & PF) != 0;
+		frame.type = type;
+		frame.data.assign(m_buffer, start + header_size, data_size);
+		callback(frame);
+		
+		// Buffer can't be modified by callback
+		pos = start + frame_size - 1;
+	}
+	
+	m_buffer.erase(0, pos);
+}
+
+/*
+ * Multiplexer
+ * */
+bool Cmux::open(Serial *tty, int channels, int timeout) {
+	if (channels < 1 || channels > MAX_CHANNELS) {
+		LOGE("CMUX: invalid channels count: %d\n", channels);
+		return false;
+	}
+	
+	close();
+	
+	m_tty = tty;
+	m_channels_count = channels;
+	m_flow_off = false;
+	m_broken = false;
+	m_decoder.reset();
+	
+	if (!connectChannel(0, timeout)) {
+		LOGE("CMUX: control channel is not accepted\n");
+		// Modem can be in mux mode even without UA
+		sendCloseDown();
+		return false;
+	}
+	
+	for (int dlci = 1; dlci <= channels; dlci++) {
+		int fds[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+			LOGE("CMUX: socketpair() failed, errno = %d\n", errno);
+			close();
+			return false;
+		}
+		
+		fcntl(fds[1], F_SETFL, fcntl(fds[1], F_GETFL) | O_NONBLOCK);
+		m_peer_fds[dlci] = fds[1];
+		
+		if (m_channels[dlci].attach(fds[0]) != 0 || !connectChannel(dlci, timeout)) {
+			LOGE("CMUX: DLC %d is not accepted\n", dlci);
+			close();
+			return false;
+		}
+		
+		// DTR/RTS on
+		sendModemStatus(dlci, false);
+	}
+	
+	m_stop = false;
+	if (pthread_create(&m_thread, nullptr, muxThread, this) != 0) {
+		LOGE("CMUX: can't create mux thread, errno=%d\n", errno);
+		close();
+		return false;
+	}
+	m_thread_created = true;
+	
+	LOGD("CMUX: opened %d channels\n", channels);
+	
+	return true;
+}
+
+void Cmux::close() {
+	if (m_thread_created) {
+		m_stop = true;
+		m_tty->breakTransfer();
+		pthread_join(m_thread, nullptr);
+		m_thread_created = false;
+	}
+	
+	// Return modem to AT mode
+	if (m_connected[0] && !m_broken)
+		sendCloseDown();
+	
+	closePeers();
+	
+	for (int dlci = 0; dlci <= MAX_CHANNELS; dlci++) {
+		m_channels[dlci].close();
+		m_connected[dlci] = false;
+	}
+	
+	m_channels_count = 0;
+}
+
+bool Cmux::writeFrame(const std::string &frame) {
+	return m_tty->write(frame.data(), frame.size(), 1000) == static_cast<int>(frame.size());
+}
+
+bool Cmux::waitFrame(const std::function<bool(const Frame &)> &filter, int timeout) {
+	int64_t start = getCurrentTimestamp();
+	bool found = false;
+	char buffer[256];
+	
+	while (!found) {
+		int next_timeout = timeout - (getCurrentTimestamp() - start);
+		if (next_timeout <= 0)
+			break;
+		
+		int readed = m_tty->readChunk(buffer, sizeof(buffer), next_timeout);
+		if (readed == Serial::ERR_INTR)
+			continue;
+		if (readed < 0)
+			break;
+		
+		m_decoder.feed(buffer, readed, [&](const Frame &frame) {
+			if (!found && filter(frame)) {
+				found = true;
+			} else {
+				handleFrame(frame);
+			}
+		});
+	}
+	
+	return found;
+}
+
+void Cmux::sendCloseDown() {
+	std::string cld = encodeControl(CTRL_CLD, true, "");
+	writeFrame(encodeFrame(0, FRAME_UIH, true, false, cld.data(), cld.size()));
+	
+	waitFrame([](const Frame &frame) {
+		return frame.dlci == 0 && frame.data.size() > 0 && (frame.data[0] & ~0x03) == CTRL_CLD;
+	}, 1000);
+}
+
+void Cmux::sendModemStatus(int dlci, bool flow_off) {
+	std::string msc = encodeControl(CTRL_MSC, true, {
+		static_cast<char>((dlci << 2) | 0x03),
+		static_cast<char>(MSC_SIGNALS | (flow_off ? MSC_FC : 0))
+	});
+	writeFrame(encodeFrame(0, FRAME_UIH, true, false, msc.data(), msc.size()));
+	m_peer_flow_off[dlci] = flow_off;
+}
+
+bool Cmux::connectChannel(int dlci, int timeout) {
+	if (!writeFrame(encodeFrame(dlci, FRAME_SABM, true, true)))
+		return false;
+	
+	uint8_t reply = 0;
+	bool success = waitFrame([&](const Frame &frame) {
+		if (frame.dlci == dlci && (frame.type == FRAME_UA || frame.type == FRAME_DM)) {
+			reply = frame.type;
+			return true;
+		}
+		return false;
+	}, timeout);
+	
+	m_connected[dlci] = success && reply == FRAME_UA;
+	
+	return m_connected[dlci];
+}
+
+void Cmux::closePeer(int dlci) {
+	if (m_peer_fds[dlci] != -1) {
+		::close(m_peer_fds[dlci]);
+		m_peer_fds[dlci] = -1;
+	}
+	m_pending[dlci].clear();
+	m_peer_flow_off[dlci] = false;
+}
+
+void Cmux::closePeers() {
+	for (int dlci = 0; dlci <= MAX_CHANNELS; dlci++)
+		closePeer(dlci);
+}
+
+void Cmux::writePeer(int dlci, const char *data, size_t size) {
+	// Keep order of data, when something already pending
+	if (m_pending[dlci].empty()) {
+		int ret = ::send(m_peer_fds[dlci], data, size, MSG_NOSIGNAL);
+		if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+			// AtChannel side closed
+			closePeer(dlci);
+			return;
+		}
+		
+		if (ret > 0) {
+			data += ret;
+			size -= ret;
+		}
+	}
+	
+	if (size > 0) {
+		m_pending[dlci].append(data, size);
+		
+		if (!m_peer_flow_off[dlci] && m_pending[dlci].size() >= PEER_FLOW_OFF_SIZE) {
+			LOGD("CMUX: DLC %d is too slow, flow off\n", dlci);
+			sendModemStatus(dlci, true);
+		}
+	}
+}
+
+void Cmux::flushPeer(int dlci) {
+	std::string &pending = m_pending[dlci];
+	
+	int ret = ::send(m_peer_fds[dlci], pending.data(), pending.size(), MSG_NOSIGNAL);
+	if (ret < 0 && errno != EAGAIN && errno != EINTR) {
+		closePeer(dlci);
+		return;
+	}
+	
+	if (ret > 0)
+		pending.erase(0, ret);
+	
+	if (m_peer_flow_off[dlci] && pending.empty()) {
+		LOGD("CMUX: DLC %d flow on\n", dlci);
+		sendModemStatus(dlci, false);
+	}
+}
+
+void Cmux::handleFrame(const Frame &frame) {
+	if (frame.dlci > MAX_CHANNELS) {
+		LOGD("CMUX: frame for unknown DLC %d\n", frame.dlci);
+		return;
+	}
+	
+	switch (frame.type) {
+		case FRAME_UIH:
+		case FRAME_UI:
+			if (frame.dlci == 0) {
+				handleControl(frame);
+			} else if (m_peer_fds[frame.dlci] != -1) {
+				writePeer(frame.dlci, frame.data.data(), frame.data.size());
+			}
+		break;
+		
+		case FRAME_DISC:
+			writeFrame(encodeFrame(frame.dlci, FRAME_UA, true, true));
+			
+			// Whole multiplexer closed
+			if (frame.dlci == 0) {
+				LOGE("CMUX: closed by modem\n");
+				m_broken = true;
+				m_stop = true;
+				closePeers();
+			} else if (m_peer_fds[frame.dlci] != -1) {
+				LOGE("CMUX: DLC %d closed by modem\n", frame.dlci);
+				closePeer(frame.dlci);
+			}
+			m_connected[frame.dlci] = false;
+		break;
+		
+		case FRAME_DM:
+			if (m_connected[frame.dlci] && m_peer_fds[frame.dlci] != -1) {
+				LOGE("CMUX: DLC %d disconnected by modem\n", frame.dlci);
+				closePeer(frame.dlci);
+			}
+			m_connected[frame.dlci] = false;
+		break;
+		
+		case FRAME_SABM:
+			// Only initiator can open DLC's
+			writeFrame(encodeFrame(frame.dlci, FRAME_DM, true, true));
+		break;
+	}
+}
+
+void Cmux::handleControl(const Frame &frame) {
+	if (frame.data.size() < 2)
+		return;
+	
+	uint8_t type = frame.data[0] & ~0x03;
+	bool command = (frame.data[0] & 0x02) != 0;
+	size_t value_size = static_cast<uint8_t>(frame.data[1]) >> 1;
+	std::string value = frame.data.substr(2, value_size);
+	
+	// Responses to our commands is not interesting
+	if (!command)
+		return;
+	
+	switch (type) {
+		case CTRL_FCON:
+			m_flow_off = false;
+		break;
+		
+		case CTRL_FCOFF:
+			m_flow_off = true;
+		break;
+		
+		case CTRL_MSC:
+		case CTRL_TEST:
+		case CTRL_CLD:
+			// Echo value in response
+		break;
+		
+		default:
+			// Not supported command
+			LOGD("CMUX: unsupported control message %02X\n", type);
+			value = {static_cast<char>(frame.data[0])};
+			type = CTRL_NSC;
+		break;
+	}
+	
+	std::string response = encodeControl(type, false, value);
+	writeFrame(encodeFrame(0, FRAME_UIH, true, false, response.data(), response.size()));
+	
+	if (type == CTRL_CLD) {
+		LOGE("CMUX: closed by modem\n");
+		m_broken = true;
+		m_stop = true;
+		closePeers();
+	}
+}
+
+void *Cmux::muxThread(void *arg) {
+	Cmux *self = static_cast<Cmux *>(arg);
+	self->muxLoop();
+	return nullptr;
+}
+
+void Cmux::muxLoop() {
+	char buffer[4096];
+	
+	while (!m_stop) {
+		struct pollfd pfd[MAX_CHANNELS + 2];
+		int dlci_by_index[MAX_CHANNELS + 2] = {};
+		int count = 0;
+		
+		pfd[count++] = {.fd = m_tty->getFd(), .events = POLLIN, .revents = 0};
+		pfd[count++] = {.fd = m_tty->getWakeFd(), .events = POLLIN, .revents = 0};
+		
+		for (int dlci = 1; dlci <= m_channels_count; dlci++) {
+			if (m_peer_fds[dlci] == -1)
+				continue;
+			
+			short events = 0;
+			
+			// Data from AtChannel's to modem
+			if (m_connected[dlci] && !m_flow_off)
+				events |= POLLIN;
+			
+			// Data from modem to AtChannel's
+			if (!m_pending[dlci].empty())
+				events |= POLLOUT;
+			
+			if (events) {
+				dlci_by_index[count] = dlci;
+				pfd[count++] = {.fd = m_peer_fds[dlci], .events = events, .revents = 0};
+			}
+		}
+		
+		int ret = ::poll(pfd, count, -1);
+		if (ret < 0) {
+			if (errno == EINTR)
+				continue;
+			LOGE("CMUX: poll error: %d\n", errno);
+			break;
+		}
+		
+		if ((pfd[0].revents & (POLLERR | POLLHUP))) {
+			LOGE("CMUX: tty is broken...\n");
+			m_broken = true;
+			break;
+		}
+		
+		if ((pfd[0].revents & POLLIN)) {
+			// Through Serial, for traffic recording
+			int readed = m_tty->readChunk(buffer, sizeof(buffer), 0);
+			if (readed < 0 && readed != Serial::ERR_INTR) {
+				LOGE("CMUX: read error: %d\n", readed);
+				m_broken = true;
+				break;
+			}
+			
+			if (readed > 0) {
+				m_decoder.feed(buffer, readed, [=](const Frame &frame) {
+					handleFrame(frame);
+				});
+			}
+		}
+		
+		if ((pfd[1].revents & POLLIN)) {
+			m_tty->clearBreak();
+			continue;
+		}
+		
+		for (int i = 2; i < count; i++) {
+			int dlci = dlci_by_index[i];
+			if (!pfd[i].revents || m_peer_fds[dlci] == -1)
+				continue;
+			
+			if ((pfd[i].revents & POLLOUT))
+				flushPeer(dlci);
+			
+			if (!(pfd[i].revents & (POLLIN | POLLHUP | POLLERR)) || m_peer_fds[dlci] == -1)
+				continue;
+			
+			int readed = ::read(m_peer_fds[dlci], buffer, std::min(m_frame_size, static_cast<int>(sizeof(buffer))));
+			if (readed > 0) {
+				if (!writeFrame(encodeFrame(dlci, FRAME_UIH, true, false, buffer, readed))) {
+					LOGE("CMUX: write error\n");
+					m_broken = true;
+					m_stop = true;
+					break;
+				}
+			} else if (readed == 0 || (errno != EAGAIN && errno != EINTR)) {
+				// AtChannel side closed
+				closePeer(dlci);
+			}
+		}
+	}
+	
+	// Break all AtChannel's over this multiplexer
+	if (m_broken)
+		closePeers();
+}
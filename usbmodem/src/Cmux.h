@@ -0,0 +1,145 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <functional>
+
+#include "Serial.h"
+
+/*
+ * 3GPP TS 27.010 multiplexer (basic option), initiator side
+ * Every DLC exposed as Serial, so any AtChannel can work over it without changes.
+ * */
+class Cmux {
+	public:
+		static constexpr int MAX_CHANNELS = 4;
+		
+		static constexpr uint8_t FLAG = 0xF9;
+		static constexpr uint8_t PF = 0x10;
+		
+		enum FrameType: uint8_t {
+			FRAME_SABM	= 0x2F,
+			FRAME_UA	= 0x63,
+			FRAME_DM	= 0x0F,
+			FRAME_DISC	= 0x43,
+			FRAME_UIH	= 0xEF,
+			FRAME_UI	= 0x03
+		};
+		
+		// Control channel (DLCI 0) messages, without C/R and EA bits
+		enum ControlType: uint8_t {
+			CTRL_PN		= 0x80,
+			CTRL_PSC	= 0x40,
+			CTRL_CLD	= 0xC0,
+			CTRL_TEST	= 0x20,
+			CTRL_FCON	= 0xA0,
+			CTRL_FCOFF	= 0x60,
+			CTRL_MSC	= 0xE0,
+			CTRL_NSC	= 0x10
+		};
+		
+		struct Frame {
+			int dlci;
+			uint8_t type;
+			bool cr;
+			bool pf;
+			std::string data;
+		};
+		
+		/*
+		 * Stream to frames, broken frames are skipped
+		 * */
+		class Decoder {
+			protected:
+				std::string m_buffer;
+			public:
+				void feed(const char *data, size_t size, const std::function<void(const Frame &)> &callback);
+				
+				inline void reset() {
+					m_buffer.clear();
+				}
+		};
+		
+		static uint8_t calcFcs(const uint8_t *data, size_t size);
+		static std::string encodeFrame(int dlci, uint8_t type, bool cr, bool pf, const char *data = nullptr, size_t size = 0);
+		static std::string encodeControl(uint8_t type, bool cr, const std::string &value);
+	protected:
+		Serial *m_tty = nullptr;
+		Decoder m_decoder;
+		
+		int m_frame_size = 31;
+		int m_channels_count = 0;
+		
+		// Index is DLCI, 0 - control channel
+		Serial m_channels[MAX_CHANNELS + 1];
+		int m_peer_fds[MAX_CHANNELS + 1] = {-1, -1, -1, -1, -1};
+		bool m_connected[MAX_CHANNELS + 1] = {};
+		
+		// Data from modem, not yet accepted by AtChannel side of socketpair
+		std::string m_pending[MAX_CHANNELS + 1];
+		
+		// We asked modem to stop sending to DLC (MSC with FC bit)
+		bool m_peer_flow_off[MAX_CHANNELS + 1] = {};
+		
+		// Remote side asked to stop sending (FCoff)
+		bool m_flow_off = false;
+		
+		// TTY lost or multiplexer closed by remote side
+		std::atomic<bool> m_broken = false;
+		
+		std::atomic<bool> m_stop = false;
+		bool m_thread_created = false;
+		pthread_t m_thread = 0;
+		
+		static void *muxThread(void *arg);
+		void muxLoop();
+		
+		bool writeFrame(const std::string &frame);
+		bool connectChannel(int dlci, int timeout);
+		bool waitFrame(const std::function<bool(const Frame &)> &filter, int timeout);
+		void sendCloseDown();
+		void sendModemStatus(int dlci, bool flow_off);
+		
+		void writePeer(int dlci, const char *data, size_t size);
+		void flushPeer(int dlci);
+		void closePeer(int dlci);
+		
+		void handleFrame(const Frame &frame);
+		void handleControl(const Frame &frame);
+		void closePeers();
+	public:
+		Cmux();
+		~Cmux();
+		
+		Cmux(const Cmux &) = delete;
+		Cmux &operator=(const Cmux &) = delete;
+		
+		/*
+		 * Modem must be already switched to mux mode (AT+CMUX=0)
+		 * On failure modem is asked to leave mux mode, but it is not guaranteed
+		 * All AtChannel's over DLC's must be stopped before close()
+		 * */
+		bool open(Serial *tty, int channels, int timeout = 3000);
+		void close();
+		
+		inline bool isOpened() {
+			return m_thread_created;
+		}
+		
+		// DLCI 1..channels
+		inline Serial *getChannel(int dlci) {
+			return dlci > 0 && dlci <= m_channels_count ? &m_channels[dlci] : nullptr;
+		}
+		
+		inline int getChannelsCount() {
+			return m_channels_count;
+		}
+		
+		// Max information field length (N1), must match AT+CMUX
+		inline void setFrameSize(int size) {
+			m_frame_size = size;
+		}
+};
@@ -0,0 +1,211 @@
+#include "CmuxLoopback.h"
+
+#include <poll.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Log.h"
+#include "Utils.h"
+
+CmuxLoopback::CmuxLoopback() {
+	m_handler = [](int, const std::string &) {
+		return "\r\nOK\r\n";
+	};
+}
+
+CmuxLoopback::~CmuxLoopback() {
+	stop();
+}
+
+bool CmuxLoopback::start() {
+	m_master = posix_openpt(O_RDWR | O_NOCTTY | O_CLOEXEC);
+	if (m_master < 0 || grantpt(m_master) != 0 || unlockpt(m_master) != 0) {
+		LOGE("Can't create PTY, errno = %d\n", errno);
+		return false;
+	}
+	
+	m_slave = ptsname(m_master);
+	m_stop = false;
+	m_mux_mode = false;
+	m_decoder.reset();
+	
+	// Every DLC has own queue, so slow command on one channel doesn't block others
+	for (int dlci = 1; dlci <= Cmux::MAX_CHANNELS; dlci++) {
+		m_workers[dlci].thread = std::thread([=]() {
+			runWorker(dlci);
+		});
+	}
+	
+	m_thread = std::thread([=]() {
+		run();
+	});
+	
+	return true;
+}
+
+void CmuxLoopback::stop() {
+	m_mutex.lock();
+	m_stop = true;
+	m_mutex.unlock();
+	m_cond.notify_all();
+	
+	for (auto &worker: m_workers) {
+		if (worker.thread.joinable())
+			worker.thread.join();
+		worker.commands.clear();
+	}
+	
+	if (m_thread.joinable())
+		m_thread.join();
+	
+	if (m_master != -1) {
+		close(m_master);
+		m_master = -1;
+	}
+}
+
+void CmuxLoopback::run() {
+	char buffer[4096];
+	
+	while (!m_stop) {
+		struct pollfd pfd = {.fd = m_master, .events = POLLIN, .revents = 0};
+		if (poll(&pfd, 1, 100) <= 0)
+			continue;
+		
+		// Slave side is not opened yet or already closed
+		if (!(pfd.revents & POLLIN)) {
+			usleep(10000);
+			continue;
+		}
+		
+		int readed = read(m_master, buffer, sizeof(buffer));
+		if (readed <= 0)
+			continue;
+		
+		if (m_mux_mode) {
+			m_decoder.feed(buffer, readed, [=](const Cmux::Frame &frame) {
+				handleFrame(frame);
+			});
+		} else {
+			handleInput(0, buffer, readed);
+		}
+	}
+}
+
+void CmuxLoopback::runWorker(int dlci) {
+	auto &worker = m_workers[dlci];
+	
+	while (true) {
+		std::unique_lock<std::mutex> lock(m_mutex);
+		m_cond.wait(lock, [&]() {
+			return m_stop || worker.commands.size() > 0;
+		});
+		
+		if (m_stop)
+			break;
+		
+		std::string cmd = worker.commands.front();
+		worker.commands.pop_front();
+		lock.unlock();
+		
+		send(dlci, m_handler(dlci, cmd));
+	}
+}
+
+void CmuxLoopback::handleInput(int dlci, const char *data, size_t size) {
+	std::string &line = m_lines[dlci];
+	line.append(data, size);
+	
+	size_t pos;
+	while ((pos = line.find_first_of("\r\x1B")) != std::string::npos) {
+		std::string cmd = line.substr(0, pos);
+		bool aborted = line[pos] == '\x1B';
+		line.erase(0, pos + 1);
+		
+		// ESC discards command line, like real modems do
+		if (aborted)
+			continue;
+		
+		if (!strStartsWith(cmd, "AT"))
+			continue;
+		
+		if (dlci == 0) {
+			if (strStartsWith(cmd, "AT+CMUX=")) {
+				// Switch to multiplexer mode right after OK
+				writeRaw("\r\nOK\r\n");
+				m_mux_mode = true;
+				m_decoder.reset();
+				line.clear();
+				return;
+			}
+			writeRaw(m_handler(0, cmd));
+		} else {
+			m_mutex.lock();
+			m_workers[dlci].commands.push_back(cmd);
+			m_mutex.unlock();
+			m_cond.notify_all();
+		}
+	}
+}
+
+void CmuxLoopback::handleFrame(const Cmux::Frame &frame) {
+	if (frame.dlci > Cmux::MAX_CHANNELS)
+		return;
+	
+	switch (frame.type) {
+		case Cmux::FRAME_SABM:
+			writeFrame(frame.dlci, Cmux::FRAME_UA | Cmux::PF);
+		break;
+		
+		case Cmux::FRAME_DISC:
+			writeFrame(frame.dlci, Cmux::FRAME_UA | Cmux::PF);
+			if (frame.dlci == 0)
+				m_mux_mode = false;
+		break;
+		
+		case Cmux::FRAME_UIH:
+		case Cmux::FRAME_UI:
+			if (frame.dlci != 0) {
+				handleInput(frame.dlci, frame.data.data(), frame.data.size());
+			} else if (frame.data.size() >= 2 && (frame.data[0] & 0x02)) {
+				// Control commands: confirm with same value
+				uint8_t type = frame.data[0] & ~0x03;
+				writeFrame(0, Cmux::FRAME_UIH, Cmux::encodeControl(type, false, frame.data.substr(2)));
+				
+				if (type == Cmux::CTRL_CLD)
+					m_mux_mode = false;
+			}
+		break;
+	}
+}
+
+void CmuxLoopback::send(int dlci, const std::string &data) {
+	if (!m_mux_mode) {
+		writeRaw(data);
+		return;
+	}
+	
+	for (size_t offset = 0; offset < data.size(); offset += m_frame_size)
+		writeFrame(dlci, Cmux::FRAME_UIH, data.substr(offset, m_frame_size));
+}
+
+void CmuxLoopback::writeFrame(int dlci, uint8_t type, const std::string &data) {
+	// Responder side: commands with C/R=0, responses with C/R=1
+	bool cr = (type & ~Cmux::PF) != Cmux::FRAME_UIH;
+	writeRaw(Cmux::encodeFrame(dlci, type & ~Cmux::PF, cr, (type & Cmux::PF) != 0, data.data(), data.size()));
+}
+
+void CmuxLoopback::writeRaw(const std::string &data) {
+	std::lock_guard<std::mutex> lock(m_write_mutex);
+	
+	size_t written = 0;
+	while (written < data.size()) {
+		int ret = write(m_master, data.data() + written, data.size() - written);
+		if (ret < 0) {
+			if (errno == EINTR || errno == EAGAIN)
+				continue;
+			break;
+		}
+		written += ret;
+	}
+}
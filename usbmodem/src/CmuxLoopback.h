@@ -0,0 +1,70 @@
+#pragma once
+
+#include <string>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <functional>
+#include <condition_variable>
+
+#include "Cmux.h"
+
+/*
+ * Modem side of CMUX over PTY, for testing multiplexer without hardware
+ * Works as plain AT modem until AT+CMUX, then answers commands on every DLC in parallel.
+ * */
+class CmuxLoopback {
+	public:
+		// Full response for command line, including final result code
+		typedef std::function<std::string(int dlci, const std::string &cmd)> CommandHandler;
+	protected:
+		struct Worker {
+			std::thread thread;
+			std::deque<std::string> commands;
+		};
+		
+		int m_master = -1;
+		std::string m_slave;
+		std::thread m_thread;
+		bool m_stop = false;
+		bool m_mux_mode = false;
+		int m_frame_size = 31;
+		
+		Cmux::Decoder m_decoder;
+		std::string m_lines[Cmux::MAX_CHANNELS + 1];
+		Worker m_workers[Cmux::MAX_CHANNELS + 1];
+		
+		std::mutex m_mutex;
+		std::mutex m_write_mutex;
+		std::condition_variable m_cond;
+		
+		CommandHandler m_handler;
+		
+		void run();
+		void runWorker(int dlci);
+		void handleFrame(const Cmux::Frame &frame);
+		void handleInput(int dlci, const char *data, size_t size);
+		void writeRaw(const std::string &data);
+		void writeFrame(int dlci, uint8_t type, const std::string &data = "");
+	public:
+		CmuxLoopback();
+		~CmuxLoopback();
+		
+		bool start();
+		void stop();
+		
+		// Send data to DLC (or plain tty before AT+CMUX)
+		void send(int dlci, const std::string &data);
+		
+		inline void onCommand(const CommandHandler &handler) {
+			m_handler = handler;
+		}
+		
+		inline const std::string &getTty() {
+			return m_slave;
+		}
+		
+		inline bool isMuxMode() {
+			return m_mux_mode;
+		}
+};
@@ -1,10 +1,12 @@
 #include "GsmUtils.h"
 #include "Log.h"
 #include "Utils.h"
-#include <map>
+#include <array>
+#include <cstring>
+#include <endian.h>
 
 // Default GSM 7bit charset
-static const uint16_t GSM7_TO_UNICODE[] = {
+static constexpr uint16_t GSM7_TO_UNICODE[] = {
 	0x0040, 0x00A3, 0x0024, 0x00A5, 0x00E8, 0x00E9, 0x00F9, 0x00EC, 0x00F2, 0x00C7, 0x000A, 0x00D8, 0x00F8, 0x000D, 0x00C5, 0x00E5,
 	0x0394, 0x005F, 0x03A6, 0x0393, 0x039B, 0x03A9, 0x03A0, 0x03A8, 0x03A3, 0x0398, 0x039E, 0x00A0, 0x00C6, 0x00E6, 0x00DF, 0x00C9,
 	0x0020, 0x0021, 0x0022, 0x0023, 0x00A4, 0x0025, 0x0026, 0x0027, 0x0028, 0x0029, 0x002A, 0x002B, 0x002C, 0x002D, 0x002E, 0x002F,
@@ -16,12 +18,63 @@ static const uint16_t GSM7_TO_UNICODE[] = {
 };
 
 // Default GSM 7bit charset (extended)
-static const std::map<uint8_t, uint16_t> GSM7_TO_UNICODE_EXT = {
+static constexpr uint16_t GSM7_TO_UNICODE_EXT[][2] = {
 	{0x0A, 0x000C}, {0x14, 0x005E}, {0x1B, 0x0020}, {0x28, 0x007B},
 	{0x29, 0x007D}, {0x2F, 0x005C}, {0x3C, 0x005B}, {0x3D, 0x007E},
 	{0x3E, 0x005D}, {0x40, 0x007C}, {0x65, 0x20AC}
 };
 
+// Pre-encoded UTF-8 for one septet (or escape + septet), always copied as 4 bytes
+struct Gsm7Utf8 {
+	char bytes[4];
+	uint8_t size;
+};
+
+static constexpr void gsm7AppendUtf8(Gsm7Utf8 &entry, uint16_t value) {
+	if (value < 0x80) {
+		entry.bytes[entry.size++] = value;
+	} else if (value < 0x800) {
+		entry.bytes[entry.size++] = (value >> 6) | 0xC0;
+		entry.bytes[entry.size++] = (value & 0x3F) | 0x80;
+	} else {
+		entry.bytes[entry.size++] = (value >> 12) | 0xE0;
+		entry.bytes[entry.size++] = ((value >> 6) & 0x3F) | 0x80;
+		entry.bytes[entry.size++] = (value & 0x3F) | 0x80;
+	}
+}
+
+static constexpr std::array<Gsm7Utf8, 256> makeGsm7Utf8Table(bool extended) {
+	std::array<Gsm7Utf8, 256> table = {};
+	
+	for (int byte = 0; byte < 256; byte++) {
+		Gsm7Utf8 &entry = table[byte];
+		
+		if (extended) {
+			bool found = false;
+			for (auto &ext: GSM7_TO_UNICODE_EXT) {
+				if (ext[0] == byte) {
+					gsm7AppendUtf8(entry, ext[1]);
+					found = true;
+				}
+			}
+			
+			if (found)
+				continue;
+			
+			// Unknown extension: space and char from default charset
+			gsm7AppendUtf8(entry, ' ');
+		}
+		
+		// Replacement Character for any invalid GSM7
+		gsm7AppendUtf8(entry, byte > 0x7F ? 0xFFFD : GSM7_TO_UNICODE[byte]);
+	}
+	
+	return table;
+}
+
+static constexpr auto GSM7_TO_UTF8 = makeGsm7Utf8Table(false);
+static constexpr auto GSM7_EXT_TO_UTF8 = makeGsm7Utf8Table(true);
+
 static constexpr uint8_t decodeDateField(uint8_t value) {
 	return ((value & 0xF) * 10) + (value >> 4);
 }
@@ -618,7 +671,7 @@ std::pair<bool, std::string> decodeSmsDcsData(const std::string &data, uint8_t u
 		// Remove UDH from data
 		if (encoding == GSM_ENC_7BIT) {
 			size_t udhl_7bit = (udhl * 8 + 6) / 7;
-			bytes = unpack7bit(data, udl).substr(udhl_7bit);
+			bytes = unpack7bit(data, udl, udhl_7bit);
 		} else {
 			bytes = data.substr(udhl);
 		}
@@ -738,61 +791,85 @@ std::pair<bool, std::string> convertUcs2ToUtf8(const std::string &data, bool be)
 }
 
 std::string convertGsmToUtf8(const std::string &data) {
-	std::string out;
-	out.reserve(data.size());
-	
-	bool escape = false;
-	for (auto c: data) {
-		uint8_t byte = static_cast<uint8_t>(c);
-		if (escape) {
-			auto found = GSM7_TO_UNICODE_EXT.find(byte);
-			if (found != GSM7_TO_UNICODE_EXT.cend()) {
-				strAppendCodepoint(out, found->second);
-			} else {
-				out += ' ';
-				strAppendCodepoint(out, GSM7_TO_UNICODE[byte]);
+	// Worst case: 3 bytes per septet, plus tail of last 4 bytes copy
+	std::string out(data.size() * 3 + sizeof(Gsm7Utf8::bytes), 0);
+	
+	const uint8_t *src = reinterpret_cast<const uint8_t *>(data.c_str());
+	const uint8_t *end = src + data.size();
+	char *dst = &out[0];
+	
+	while (src < end) {
+		const Gsm7Utf8 *entry;
+		if (*src == 0x1B) {
+			// Escape at the end of data
+			if (src + 1 == end) {
+				*dst++ = ' ';
+				break;
 			}
-			escape = false;
+			entry = &GSM7_EXT_TO_UTF8[src[1]];
+			src += 2;
 		} else {
-			if (byte > 0x7F) {
-				// Impossible worst case
-				// Replacement Character for any invalid GSM7
-				strAppendCodepoint(out, 0xFFFD);
-			} else if (byte == 0x1B) {
-				escape = true;
-			} else {
-				strAppendCodepoint(out, GSM7_TO_UNICODE[byte]);
-			}
+			entry = &GSM7_TO_UTF8[*src];
+			src++;
 		}
+		
+		memcpy(dst, entry->bytes, sizeof(entry->bytes));
+		dst += entry->size;
 	}
 	
-	if (escape)
-		out += ' ';
+	out.resize(dst - out.data());
 	
 	return out;
 }
 
-std::string unpack7bit(const std::string &data, size_t max_chars) {
+static inline uint8_t unpackSeptet(const uint8_t *bytes, size_t size, size_t index) {
+	size_t bit_off = index * 7;
+	size_t byte_off = bit_off / 8;
+	
+	uint16_t value = bytes[byte_off];
+	if (byte_off + 1 < size)
+		value |= bytes[byte_off + 1] << 8;
+	
+	return (value >> (bit_off % 8)) & 0x7F;
+}
+
+std::string unpack7bit(const std::string &data, size_t max_chars, size_t skip_chars) {
 	size_t total_chars = std::min(max_chars, data.size() * 8 / 7);
+	if (skip_chars >= total_chars)
+		return "";
 	
-	std::string out;
-	out.reserve(total_chars);
+	std::string out(total_chars - skip_chars, 0);
 	
 	const uint8_t *bytes = reinterpret_cast<const uint8_t *>(data.c_str());
-	for (size_t i = 0; i < total_chars; i++) {
-		size_t bit_off = i * 7;
-		size_t byte_off = bit_off / 8;
+	char *dst = &out[0];
+	size_t i = skip_chars;
+	
+	// Head: up to first 8-septets block
+	while (i < total_chars && (i % 8) != 0)
+		*dst++ = unpackSeptet(bytes, data.size(), i++);
+	
+	// Every 7 bytes are 8 septets, 64-bit load (8th byte is ignored)
+	while (i + 8 <= total_chars && (i / 8) * 7 + 8 <= data.size()) {
+		uint64_t block;
+		memcpy(&block, bytes + (i / 8) * 7, sizeof(block));
+		block = le64toh(block);
 		
-		uint8_t shift = bit_off % 8;
-		uint8_t size = std::min(7, 8 - shift);
+		dst[0] = block & 0x7F;
+		dst[1] = (block >> 7) & 0x7F;
+		dst[2] = (block >> 14) & 0x7F;
+		dst[3] = (block >> 21) & 0x7F;
+		dst[4] = (block >> 28) & 0x7F;
+		dst[5] = (block >> 35) & 0x7F;
+		dst[6] = (block >> 42) & 0x7F;
+		dst[7] = (block >> 49) & 0x7F;
 		
-		uint8_t value = (bytes[byte_off] >> shift) & ((1 << size) - 1);
-		
-		if (size < 7)
-			value |= (bytes[byte_off + 1] & ((1 << (7 - size)) - 1)) << size;
-		
-		out += static_cast<char>(value);
+		dst += 8;
+		i += 8;
 	}
 	
+	// Tail
+	while (i < total_chars)
+		*dst++ = unpackSeptet(bytes, data.size(), i++);
+	
 	return out;
 }
@@ -230,7 +230,8 @@ bool isValidUssd(const std::string &cmd);
 bool strAppendCodepoint(std::string &out, uint32_t value);
 std::pair<bool, std::string> convertUcs2ToUtf8(const std::string &data, bool be);
 std::string convertGsmToUtf8(const std::string &data);
-std::string unpack7bit(const std::string &data, size_t max_chars);
+// Septets [skip_chars, max_chars) as one byte per char
+std::string unpack7bit(const std::string &data, size_t max_chars, size_t skip_chars = 0);
 inline std::string unpack7bit(const std::string &data) {
 	return unpack7bit(data, data.size() * 8 / 7);
 }
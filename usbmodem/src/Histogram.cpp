@@ -0,0 +1,117 @@
+#include "Histogram.h"
+
+#include <array>
+#include <algorithm>
+#include <cstdio>
+
+static constexpr std::array<uint32_t, Histogram::BUCKETS> makeBounds() {
+	std::array<uint32_t, Histogram::BUCKETS> bounds = {};
+	bounds[0] = 1;
+	// b + b / 4 is exactly floor(b * 1.25)
+	for (int i = 1; i < Histogram::BUCKETS; i++)
+		bounds[i] = std::max(bounds[i - 1] + 1, bounds[i - 1] + bounds[i - 1] / 4);
+	return bounds;
+}
+
+// Computed at compile time, no lazy init shared between threads
+static constexpr std::array<uint32_t, Histogram::BUCKETS> BOUNDS = makeBounds();
+
+uint32_t Histogram::getBucketBound(int index) {
+	return BOUNDS[index];
+}
+
+int Histogram::getBucketIndex(uint32_t value) {
+	auto found = std::lower_bound(BOUNDS.begin(), BOUNDS.end(), value);
+	return found == BOUNDS.end() ? BUCKETS - 1 : found - BOUNDS.begin();
+}
+
+void Histogram::add(uint32_t value) {
+	if (m_count >= MAX_SAMPLES)
+		decay();
+	
+	m_buckets[getBucketIndex(value)]++;
+	m_count++;
+	m_sum += value;
+	m_max = std::max(m_max, value);
+}
+
+void Histogram::decay() {
+	uint32_t avg = getAvg();
+	
+	m_count = 0;
+	for (int i = 0; i < BUCKETS; i++) {
+		m_buckets[i] /= 2;
+		m_count += m_buckets[i];
+	}
+	
+	m_sum = static_cast<uint64_t>(avg) * m_count;
+}
+
+void Histogram::reset() {
+	std::fill(m_buckets, m_buckets + BUCKETS, 0);
+	m_count = 0;
+	m_sum = 0;
+	m_max = 0;
+}
+
+uint32_t Histogram::getPercentile(double percentile) const {
+	if (!m_count)
+		return 0;
+	
+	uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(percentile * m_count + 0.5));
+	uint64_t total = 0;
+	
+	for (int i = 0; i < BUCKETS; i++) {
+		total += m_buckets[i];
+		if (total >= rank)
+			return std::min(getBucketBound(i), m_max);
+	}
+	
+	return m_max;
+}
+
+std::string Histogram::serialize() const {
+	std::string out = std::to_string(m_count) + " " + std::to_string(m_sum) + " " + std::to_string(m_max);
+	for (int i = 0; i < BUCKETS; i++) {
+		if (m_buckets[i])
+			out += " " + std::to_string(i) + ":" + std::to_string(m_buckets[i]);
+	}
+	return out;
+}
+
+bool Histogram::unserialize(const std::string &data) {
+	const char *cursor = data.c_str();
+	unsigned long long sum;
+	uint32_t total = 0;
+	int offset = 0;
+	
+	reset();
+	
+	if (sscanf(cursor, "%u %llu %u%n", &m_count, &sum, &m_max, &offset) != 3) {
+		reset();
+		return false;
+	}
+	
+	m_sum = sum;
+	cursor += offset;
+	
+	int index;
+	uint32_t count;
+	while (sscanf(cursor, " %d:%u%n", &index, &count, &offset) == 2) {
+		if (index < 0 || index >= BUCKETS) {
+			reset();
+			return false;
+		}
+		
+		m_buckets[index] = count;
+		total += count;
+		cursor += offset;
+	}
+	
+	if (total != m_count) {
+		reset();
+		return false;
+	}
+	
+	return true;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+
+/*
+ * Log-scale histogram of durations in milliseconds
+ * Every next bucket bound is 25% larger than previous, covers 1 ms ... ~29 min.
+ * */
+class Histogram {
+	public:
+		static constexpr int BUCKETS = 64;
+		
+		// When count of samples reached this limit, all buckets halved for fading old samples
+		static constexpr uint32_t MAX_SAMPLES = 10000;
+	protected:
+		uint32_t m_buckets[BUCKETS] = {};
+		uint32_t m_count = 0;
+		uint64_t m_sum = 0;
+		uint32_t m_max = 0;
+		
+		void decay();
+	public:
+		static uint32_t getBucketBound(int index);
+		static int getBucketIndex(uint32_t value);
+		
+		void add(uint32_t value);
+		void reset();
+		
+		// Upper bound of bucket, which contains requested percentile (0.0 ... 1.0)
+		uint32_t getPercentile(double percentile) const;
+		
+		inline uint32_t getCount() const {
+			return m_count;
+		}
+		
+		inline uint64_t getSum() const {
+			return m_sum;
+		}
+		
+		inline uint32_t getMax() const {
+			return m_max;
+		}
+		
+		inline uint32_t getAvg() const {
+			return m_count > 0 ? m_sum / m_count : 0;
+		}
+		
+		inline uint32_t getBucket(int index) const {
+			return m_buckets[index];
+		}
+		
+		// Text format: "<count> <sum> <max> <index>:<count> ..."
+		std::string serialize() const;
+		bool unserialize(const std::string &data);
+};
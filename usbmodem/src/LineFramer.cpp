@@ -0,0 +1,45 @@
+#include "LineFramer.h"
+#include "Log.h"
+
+LineFramer::LineFramer(size_t capacity): m_capacity(capacity) {
+	m_data = new char[capacity];
+}
+
+LineFramer::~LineFramer() {
+	delete[] m_data;
+}
+
+void LineFramer::reset() {
+	m_start = 0;
+	m_end = 0;
+	m_scan = 0;
+	m_overflow = false;
+}
+
+void LineFramer::compact() {
+	// All lines handled, most common case
+	if (m_start == m_end) {
+		m_start = m_end = m_scan = 0;
+		return;
+	}
+	
+	// Move tail of not completed line to start of buffer
+	if (m_start > 0) {
+		size_t tail = m_end - m_start;
+		memmove(m_data, m_data + m_start, tail);
+		m_start = 0;
+		m_end = tail;
+		m_scan = tail;
+	}
+	
+	// Line is too long, drop it, but keep last byte for case when EOL splitted between reads
+	if (m_end == m_capacity) {
+		if (!m_overflow)
+			LOGE("LineFramer: line exceeds %d bytes, dropped\n", static_cast<int>(m_capacity));
+		
+		m_data[0] = m_data[m_end - 1];
+		m_end = 1;
+		m_scan = 1;
+		m_overflow = true;
+	}
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <cstring>
+#include <cstdint>
+#include <string_view>
+
+/*
+ * Fixed-capacity line framer for serial streams
+ * Serial data is read directly into free space of buffer and every completed line
+ * passed to handler as view into this buffer. View is valid only while handler is running.
+ * Lines are separated by "\r\n", empty lines are skipped.
+ * */
+class LineFramer {
+	protected:
+		char *m_data = nullptr;
+		size_t m_capacity = 0;
+		
+		// Start of current (not completed) line
+		size_t m_start = 0;
+		
+		// End of received data
+		size_t m_end = 0;
+		
+		// Position, from which continue search of EOL
+		size_t m_scan = 0;
+		
+		// Current line is too long, skip it until EOL
+		bool m_overflow = false;
+		
+		void compact();
+	public:
+		explicit LineFramer(size_t capacity);
+		~LineFramer();
+		
+		LineFramer(const LineFramer &) = delete;
+		LineFramer &operator=(const LineFramer &) = delete;
+		
+		inline char *writePtr() {
+			return m_data + m_end;
+		}
+		
+		inline size_t writeAvail() const {
+			return m_capacity - m_end;
+		}
+		
+		inline size_t capacity() const {
+			return m_capacity;
+		}
+		
+		void reset();
+		
+		/*
+		 * Commit N bytes written to writePtr() and handle all completed lines
+		 * */
+		template <typename T>
+		void commit(size_t size, const T &handler) {
+			m_end += size;
+			
+			while (m_scan < m_end) {
+				const char *eol = static_cast<const char *>(memchr(m_data + m_scan, '\n', m_end - m_scan));
+				if (!eol) {
+					m_scan = m_end;
+					break;
+				}
+				
+				size_t eol_pos = eol - m_data;
+				m_scan = eol_pos + 1;
+				
+				// Only "\r\n" is EOL
+				if (eol_pos == m_start || m_data[eol_pos - 1] != '\r')
+					continue;
+				
+				size_t line_len = eol_pos - 1 - m_start;
+				const char *line = m_data + m_start;
+				m_start = m_scan;
+				
+				if (m_overflow) {
+					m_overflow = false;
+					continue;
+				}
+				
+				if (line_len > 0)
+					handler(std::string_view(line, line_len));
+			}
+			
+			compact();
+		}
+};
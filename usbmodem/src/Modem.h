@@ -2,11 +2,14 @@
 
 #include <any>
 #include <string>
+#include <vector>
 #include <functional>
 
 #include "Log.h"
 #include "Events.h"
 
+class AtChannel;
+
 /*
  * Generic modem interface
  * */
@@ -124,6 +127,8 @@ class Modem {
 		
 		typedef std::function<void(bool success, std::vector<Sms>)> SmsReadCallback;
 		
+		typedef std::function<void(bool success, const std::string &response)> AtCommandCallback;
+		
 		enum Features: uint32_t {
 			FEATURE_USSD				= 1 << 0,
 			FEATURE_SMS					= 1 << 1,
@@ -168,6 +173,11 @@ class Modem {
 		// Event when tty device is unrecoverable broken
 		struct EvIoBroken { };
 		
+		// Event when modem stopped responding to AT commands, or responds again
+		struct EvIoHealthChanged {
+			const bool degraded;
+		};
+		
 		// Event when connection timeout reached
 		struct EvDataConnectTimeout { };
 	protected:
@@ -322,7 +332,20 @@ class Modem {
 		/*
 		 * AT command API
 		 * */
-		virtual std::pair<bool, std::string> sendAtCommand(const std::string &cmd, int timeout = 0) = 0;
+		virtual void sendAtCommand(const std::string &cmd, AtCommandCallback callback, int timeout = 0) = 0;
+		
+		// AT channel of modem, nullptr when modem is not AT-based
+		virtual AtChannel *getAtChannel() {
+			return nullptr;
+		}
+		
+		// All AT channels of modem with their role names, main channel first
+		virtual std::vector<std::pair<std::string, AtChannel *>> getAtChannels() {
+			AtChannel *at = getAtChannel();
+			if (!at)
+				return {};
+			return {{"main", at}};
+		}
 		
 		/*
 		 * USSD API
@@ -1,8 +1,11 @@
 #include "Asr1802.h"
 #include "../Loop.h"
+#include "../AtSchema.h"
 
 ModemAsr1802::ModemAsr1802() : ModemBaseAt() {
-	
+	// Default PDP config, changed only by syncApn()
+	m_at_cache.setTtl("AT*CGDFLT=1", 300 * 1000);
+	m_at_cache.setTtl("AT*CGDFAUTH?", 300 * 1000);
 }
 
 /*
@@ -24,60 +27,56 @@ bool ModemAsr1802::setCustomOption(const std::string &name, const std::any &valu
 }
 
 bool ModemAsr1802::initDefaults() {
-	const char *init_commands[] = {
+	std::vector<AtChannel::BatchCommand> init_commands = {
 		// Enable extended error codes
-		"AT+CMEE=1",
+		{AtChannel::NO_RESPONSE, "AT+CMEE=1", ""},
 		
 		// Enable all network registration unsolicited events
-		"AT+CREG=2",
-		"AT+CGREG=2",
-		"AT+CEREG=2",
+		{AtChannel::NO_RESPONSE, "AT+CREG=2", ""},
+		{AtChannel::NO_RESPONSE, "AT+CGREG=2", ""},
+		{AtChannel::NO_RESPONSE, "AT+CEREG=2", ""},
 		
 		// Enable CGEV events
-		"AT+CGEREP=2,0",
+		{AtChannel::NO_RESPONSE, "AT+CGEREP=2,0", ""},
 		
 		// Setup indication mode of new message to TE
-		"AT+CNMI=0,1,0,2,0",
+		{AtChannel::NO_RESPONSE, "AT+CNMI=0,1,0,2,0", ""},
 		
 		// Enable network indicators unsolicited events
-		"AT+CIND=1",
+		{AtChannel::NO_RESPONSE, "AT+CIND=1", ""},
 		
 		// USSD mode
-		"AT+CUSD=1",
+		{AtChannel::NO_RESPONSE, "AT+CUSD=1", ""},
 		
 		// Enable background search
-		"AT+BGLTEPLMN=1,30",
-		
-		nullptr
+		{AtChannel::NO_RESPONSE, "AT+BGLTEPLMN=1,30", ""},
 	};
 	
-	const char **cursor = init_commands;
-	while (*cursor) {
-		if (m_at.sendCommandNoResponse(*cursor) != 0) {
-			LOGE("AT cmd failed: %s\n", *cursor);
+	auto start = getCurrentTimestamp();
+	auto responses = m_at.sendCommandBatch(init_commands);
+	
+	for (size_t i = 0; i < responses.size(); i++) {
+		if (responses[i].error) {
+			LOGE("AT cmd failed: %s\n", init_commands[i].cmd.c_str());
 			return false;
 		}
-		cursor++;
 	}
 	
+	LOGD("Init defaults: %d ms\n", static_cast<int>(getCurrentTimestamp() - start));
+	
 	return true;
 }
 
 void ModemAsr1802::handleCgev(const std::string &event) {
 	// "DEACT" and "DETACH" mean disconnect
 	if (event.find("DEACT") != std::string::npos || event.find("DETACH") != std::string::npos) {
-		Loop::setTimeout([=]() {
-			handleDisconnect();
-		}, 0);
+		handleDisconnect();
 	}
 	// Other events handle as "connection changed"
 	else {
 		// Ignore this event for 3G/EDGE
-		if (m_tech == TECH_LTE) {
-			Loop::setTimeout([=]() {
-				handleConnect();
-			}, 0);
-		}
+		if (m_tech == TECH_LTE)
+			handleConnect();
 	}
 }
 
@@ -95,86 +94,32 @@ void ModemAsr1802::handleCreg(const std::string &event) {
 		return;
 	}
 	
-	uint32_t cell_id = 0, loc_id = 0;
-	int tech = CREG_TECH_UNKNOWN, stat = CREG_NOT_REGISTERED;
-	bool parsed = false;
-	
-	switch (AtParser::getArgCnt(event)) {
-		/* +CREG: <stat> */
-		/* +CGREG: <stat> */
-		/* +CEREG: <stat> */
-		case 1:
-			parsed = AtParser(event)
-				.parseInt(&stat)
-				.success();
-		break;
-		
-		/* +CREG: <n>, <stat> */
-		/* +CGREG: <n>, <stat> */
-		/* +CEREG: <n>, <stat> */
-		case 2:
-			parsed = AtParser(event)
-				.parseSkip()
-				.parseInt(&stat)
-				.success();
-		break;
-		
-		/* +CREG: <state>, <lac>, <cid>, <act> */
-		/* +CEREG: <state>, <lac>, <cid>, <act> */
-		case 4:
-			parsed = AtParser(event)
-				.parseInt(&stat)
-				.parseUInt(&loc_id, 16)
-				.parseUInt(&cell_id, 16)
-				.parseInt(&tech)
-				.success();
-		break;
-		
-		/* +CREG: <n>, <state>, <lac>, <cid>, <act> */
-		/* +CEREG: <n>, <state>, <lac>, <cid>, <act> */
-		/* +CGREG: <state>, <lac>, <cid>, <act>, <rac> */
-		case 5:
-			if (strStartsWith(event, "+CGREG")) {
-				parsed = AtParser(event)
-					.parseInt(&stat)
-					.parseUInt(&loc_id, 16)
-					.parseUInt(&cell_id, 16)
-					.parseInt(&tech)
-					.parseSkip()
-					.success();
-			} else {
-				parsed = AtParser(event)
-					.parseSkip()
-					.parseInt(&stat)
-					.parseUInt(&loc_id, 16)
-					.parseUInt(&cell_id, 16)
-					.parseInt(&tech)
-					.success();
-			}
-		break;
-		
-		/* +CGREG: <n>, <state>, <lac>, <cid>, <act>, <rac> */
-		case 6:
-			parsed = AtParser(event)
-				.parseSkip()
-				.parseInt(&stat)
-				.parseUInt(&loc_id, 16)
-				.parseUInt(&cell_id, 16)
-				.parseInt(&tech)
-				.parseSkip()
-				.success();
-		break;
-	}
+	using namespace AtField;
+	
+	/* +CREG: <stat>[, <lac>, <cid>, <act>] */
+	/* +CGREG: <stat>[, <lac>, <cid>, <act>, <rac>] */
+	/* +CEREG: <stat>[, <lac>, <cid>, <act>] */
+	typedef AtSchema<Int, Opt<HexU32>, Opt<HexU64>, Opt<Int>, Opt<Skip>> CregUrc;
+	
+	/* Response of AT+CREG? has additional <n> before <stat> */
+	typedef AtSchema<Skip, Int, Opt<HexU32>, Opt<HexU64>, Opt<Int>, Opt<Skip>> CregQuery;
+	
+	// <n> is distinguishable only by arguments count: "<n>, <stat>" or full form with one extra argument
+	int args_cnt = AtParser::getArgCnt(event);
+	bool has_n = args_cnt == 2 || args_cnt == (strStartsWith(event, "+CGREG") ? 6 : 5);
 	
-	if (!parsed) {
+	auto creg = has_n ? CregQuery::parse(event) : CregUrc::parse(event);
+	if (!creg) {
 		LOGE("Invalid CREG: %s\n", event.c_str());
 		return;
 	}
 	
+	auto [stat, loc_id, cell_id, tech] = *creg;
+	
 	reg->status = static_cast<CregStatus>(stat);
-	reg->tech = static_cast<CregTech>(tech);
-	reg->loc_id = loc_id & 0xFFFF;
-	reg->cell_id = cell_id & 0xFFFF;
+	reg->tech = static_cast<CregTech>(tech.value_or(CREG_TECH_UNKNOWN));
+	reg->loc_id = loc_id.value_or(0);
+	reg->cell_id = cell_id.value_or(0);
 	
 	handleNetworkChange();
 }
@@ -197,34 +142,42 @@ void ModemAsr1802::handleCesq(const std::string &event) {
 		m_levels.rssi_dbm = m_levels.rscp_dbm;
 }
 
-bool ModemAsr1802::dial() {
-	std::string cmd;
-	
+void ModemAsr1802::dial(const std::function<void(bool success)> &callback) {
 	int auth_type = 0;
 	if (m_pdp_auth_mode == "pap")
 		auth_type = 1;
 	if (m_pdp_auth_mode == "chap")
 		auth_type = 2;
 	
-	// Configure PDP context
-	cmd = "AT+CGDCONT=" + std::to_string(m_pdp_context) + ",\"" + m_pdp_type + "\",\"" + m_pdp_apn + "\"";
-	if (m_at.sendCommandNoResponse(cmd) != 0)
-		return false;
-	
-	// Set PPP auth
-	cmd = "AT*AUTHReq=" + std::to_string(m_pdp_context) + "," + std::to_string(auth_type) + ",\"" + m_pdp_user + "\",\"" + m_pdp_password + "\"";
-	if (m_at.sendCommandNoResponse(cmd) != 0)
-		return false;
+	std::string pdp_cmd = "AT+CGDCONT=" + std::to_string(m_pdp_context) + ",\"" + m_pdp_type + "\",\"" + m_pdp_apn + "\"";
+	std::string auth_cmd = "AT*AUTHReq=" + std::to_string(m_pdp_context) + "," + std::to_string(auth_type) + ",\"" + m_pdp_user + "\",\"" + m_pdp_password + "\"";
+	std::string dial_cmd = "AT+CGDATA=\"\"," + std::to_string(m_pdp_context);
 	
-	// Start dialing
-	cmd = "AT+CGDATA=\"\"," + std::to_string(m_pdp_context);
-	auto response = m_at.sendCommandDial(cmd);
-	if (response.error) {
-		LOGD("Dial error: %s\n", response.status.c_str());
-		return false;
-	}
-	
-	return true;
+	// Configure PDP context
+	m_at.sendCommandNoResponseAsync(pdp_cmd, [=](const auto &response) {
+		if (response.error) {
+			callback(false);
+			return;
+		}
+		
+		// Set PPP auth
+		m_at.sendCommandNoResponseAsync(auth_cmd, [=](const auto &response) {
+			if (response.error) {
+				callback(false);
+				return;
+			}
+			
+			// Start dialing
+			m_at.sendCommandDialAsync(dial_cmd, [=](const auto &response) {
+				if (response.error) {
+					LOGD("Dial error: %s\n", response.status.c_str());
+					callback(false);
+					return;
+				}
+				callback(true);
+			});
+		});
+	});
 }
 
 void ModemAsr1802::handleNetworkChange() {
@@ -253,77 +206,84 @@ void ModemAsr1802::handleNetworkChange() {
 	}
 }
 
-int ModemAsr1802::getCurrentPdpCid() {
-	auto response = m_at.sendCommand("AT+CGCONTRDP=?", "+CGCONTRDP");
-	if (response.error)
-		return -1;
-	
-	if (!response.data().size())
-		return 0;
-	
-	int cid;
-	if (!AtParser(response.data()).parseInt(&cid).success())
-		return -1;
-	
-	return cid;
+void ModemAsr1802::getCurrentPdpCid(const std::function<void(int cid)> &callback) {
+	m_at.sendCommandAsync("AT+CGCONTRDP=?", "+CGCONTRDP", [=](const auto &response) {
+		if (response.error) {
+			callback(-1);
+			return;
+		}
+		
+		if (!response.data()[0]) {
+			callback(0);
+			return;
+		}
+		
+		int cid;
+		if (!AtParser(response.data()).parseInt(&cid).success()) {
+			callback(-1);
+			return;
+		}
+		
+		callback(cid);
+	});
 }
 
 void ModemAsr1802::handleConnect() {
-	std::string addr, gw, mask, dns1, dns2;
-	
 	// Without this command not works...
-	if (m_at.sendCommandNoResponse("AT+CGDCONT?") != 0) {
-		handleConnectError();
-		return;
-	}
-	
-	// Get current PDP context id
-	int cid = getCurrentPdpCid();
-	if (cid < 0) {
-		handleConnectError();
-		return;
-	}
+	m_at.sendCommandNoResponseAsync("AT+CGDCONT?", [=](const auto &response) {
+		if (response.error) {
+			handleConnectError();
+			return;
+		}
+		
+		// Get current PDP context id
+		getCurrentPdpCid([=](int cid) {
+			if (cid < 0) {
+				handleConnectError();
+				return;
+			}
+			
+			// Get PDP context info
+			m_at.sendCommandAsync("AT+CGCONTRDP=" + std::to_string(cid), "+CGCONTRDP", [=](const auto &response) {
+				handlePdpContextInfo(response);
+			});
+		});
+	});
+}
+
+void ModemAsr1802::handlePdpContextInfo(const AtChannel::Response &response) {
+	std::string addr, gw, mask, dns1, dns2;
 	
-	// Get PDP context info
-	auto response = m_at.sendCommand("AT+CGCONTRDP=" + std::to_string(cid), "+CGCONTRDP");
-	if (response.error || !response.lines.size()) {
+	if (response.error || !response.linesCount()) {
 		handleConnectError();
 		return;
 	}
 	
-	for (auto &line: response.lines) {
-		int arg_cnt = AtParser::getArgCnt(line);
-		
-		AtParser parser(line);
+	for (size_t line_id = 0; line_id < response.linesCount(); line_id++) {
+		using namespace AtField;
 		
-		// <cid>, <bearer_id>, <apn>
-		parser.parseSkip().parseSkip().parseSkip();
-		
-		// <local_addr>
-		if (arg_cnt >= 4)
-			parser.parseString(&addr);
-		
-		// <subnet_mask>
-		if (arg_cnt >= 5)
-			parser.parseString(&mask);
-		
-		// <gw_addr>
-		if (arg_cnt >= 6)
-			parser.parseString(&gw);
-		
-		// <DNS_prim_addr>
-		if (arg_cnt >= 7)
-			parser.parseString(&dns1);
-		
-		// <DNS_prim_addr>
-		if (arg_cnt >= 8)
-			parser.parseString(&dns2);
-		
-		if (!parser.success()) {
+		// <cid>, <bearer_id>, <apn>[, <local_addr>[, <subnet_mask>[, <gw_addr>[, <DNS_prim_addr>[, <DNS_sec_addr>]]]]]
+		auto info = AtSchema<Skip, Skip, Skip, Opt<Str>, Opt<Str>, Opt<Str>, Opt<Str>, Opt<Str>>::parse(response.line(line_id));
+		if (!info) {
+			LOGE("Invalid CGCONTRDP: %s\n", response.line(line_id));
 			handleConnectError();
 			return;
 		}
 		
+		auto [local_addr, subnet_mask, gw_addr, dns_prim_addr, dns_sec_addr] = *info;
+		
+		// Missing fields keep values from previous line
+		if (local_addr)
+			addr = *local_addr;
+		if (subnet_mask)
+			mask = *subnet_mask;
+		if (gw_addr)
+			gw = *gw_addr;
+		if (dns_prim_addr)
+			dns1 = *dns_prim_addr;
+		if (dns_sec_addr)
+			dns2 = *dns_sec_addr;
+		
 		int ipv = getIpType(addr, true);
 		if (!ipv || !normalizeIp(&addr, ipv, true)) {
 			LOGE("Invalid local IP: %s\n", addr.c_str());
@@ -425,8 +385,8 @@ void ModemAsr1802::startDataConnection() {
 	m_data_state = CONNECTING;
 	emit<EvDataConnecting>({});
 	
-	Loop::setTimeout([this]() {
-		if (dial()) {
+	dial([=](bool success) {
+		if (success) {
 			handleConnect();
 		} else {
 			m_connect_errors++;
@@ -445,17 +405,13 @@ void ModemAsr1802::startDataConnection() {
 				startDataConnection();
 			}, 1000);
 		}
-	}, 0);
+	});
 }
 
 void ModemAsr1802::restartNetwork() {
-	Loop::setTimeout([=]() {
-		setRadioOn(false);
-		
-		Loop::setTimeout([=]() {
-			setRadioOn(true);
-		}, 0);
-	}, 0);
+	setRadioOnAsync(false, [=](bool) {
+		setRadioOnAsync(true, nullptr);
+	});
 }
 
 bool ModemAsr1802::syncApn() {
@@ -555,6 +511,14 @@ bool ModemAsr1802::setRadioOn(bool state) {
 	return m_at.sendCommandNoResponse(cmd) == 0;
 }
 
+void ModemAsr1802::setRadioOnAsync(bool state, const std::function<void(bool success)> &callback) {
+	std::string cmd = "AT+CFUN=" + std::to_string(state ? 1 : 4);
+	m_at.sendCommandNoResponseAsync(cmd, [=](const auto &response) {
+		if (callback)
+			callback(response.error == 0);
+	});
+}
+
 bool ModemAsr1802::init() {
 	// Default AT timeout for this modem
 	m_at.setDefaultTimeout(10 * 1000);
@@ -610,20 +574,22 @@ bool ModemAsr1802::init() {
 	if (!m_force_restart_network) {
 		Loop::setTimeout([=]() {
 			// Detect, if already have internet
-			if (m_data_state == DISCONNECTED) {
-				int cid = getCurrentPdpCid();
+			getCurrentPdpCid([=](int cid) {
+				if (m_data_state != DISCONNECTED)
+					return;
+				
 				if (cid > 0) {
 					handleConnect();
 				} else if (cid < 0) {
 					restartNetwork();
 				}
-			}
+			});
 			
 			// Sync state
-			m_at.sendCommandNoResponse("AT+CREG?");
-			m_at.sendCommandNoResponse("AT+CGREG?");
-			m_at.sendCommandNoResponse("AT+CEREG?");
-			m_at.sendCommandNoResponse("AT+CESQ");
+			m_at.sendCommandNoResponseAsync("AT+CREG?", nullptr);
+			m_at.sendCommandNoResponseAsync("AT+CGREG?", nullptr);
+			m_at.sendCommandNoResponseAsync("AT+CEREG?", nullptr);
+			m_at.sendCommandNoResponseAsync("AT+CESQ", nullptr);
 		}, 0);
 	}
 	
@@ -670,8 +636,13 @@ void ModemAsr1802::finish() {
 	// Disable unsolicited for prevent side effects
 	m_at.resetUnsolicitedHandlers();
 	
+	// Don't wait for stuck commands
+	m_at.cancelAll();
+	for (int i = 0; i < m_ports_count; i++)
+		m_ports[i].at.cancelAll();
+	
 	// Poweroff radio
-	m_at.sendCommandNoResponse("AT+CFUN=4", 5000);
+	m_at.sendCommandNoResponse("AT+CFUN=4", 4000);
 }
 
 ModemAsr1802::~ModemAsr1802() {
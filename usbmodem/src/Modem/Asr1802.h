@@ -29,6 +29,7 @@ class ModemAsr1802: public ModemBaseAt {
 		bool syncApn();
 		
 		void handleConnect();
+		void handlePdpContextInfo(const AtChannel::Response &response);
 		void handleDisconnect();
 		void handleConnectError();
 		
@@ -41,12 +42,13 @@ class ModemAsr1802: public ModemBaseAt {
 		void handleUssdResponse(int code, const std::string &data, int dcs) override;
 		
 		// Manual connection
-		bool dial();
+		void dial(const std::function<void(bool success)> &callback);
 		void startDataConnection();
 		
-		int getCurrentPdpCid();
+		void getCurrentPdpCid(const std::function<void(int cid)> &callback);
 		
 		bool setRadioOn(bool state);
+		void setRadioOnAsync(bool state, const std::function<void(bool success)> &callback);
 		bool isRadioOn();
 		
 		void restartNetwork();
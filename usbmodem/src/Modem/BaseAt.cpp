@@ -1,6 +1,7 @@
 #include "BaseAt.h"
 #include "../Loop.h"
 #include "../GsmUtils.h"
+#include "../AtSchema.h"
 
 #include "zlib.h"
 
@@ -51,11 +52,43 @@ Modem::NetworkReg ModemBaseAt::Creg::toNetworkReg() const {
 }
 
 ModemBaseAt::ModemBaseAt() {
-	m_at.setVerbose(true);
 	m_at.setSerial(&m_serial);
+	
+	m_at.setVerbose(true);
+	m_at.setCache(&m_at_cache);
+	
+	// Unsolicited handlers work on Loop outside of serial reading in both IO modes, so they can send sync commands without hops
+	m_at.setUnsolicitedOnLoop(true);
+	
 	m_at.setDefaultTimeoutCallback([=](const std::string &cmd) {
 		return getCommandTimeout(cmd);
 	});
+	
+	// Static values, changed only with firmware or by our writes
+	m_at_cache.setTtl("AT+CGMI", 3600 * 1000);
+	m_at_cache.setTtl("AT+CGMM", 3600 * 1000);
+	m_at_cache.setTtl("AT+CGMR", 3600 * 1000);
+	m_at_cache.setTtl("AT+CGSN", 3600 * 1000);
+	m_at_cache.setTtl("AT+CPMS=?", 600 * 1000);
+	
+	for (auto &port: m_ports) {
+		port.at.setVerbose(true);
+		port.at.setDefaultTimeoutCallback([=](const std::string &cmd) {
+			return getCommandTimeout(cmd);
+		});
+		
+		// Modem can send URC to any port
+		port.at.setUnsolicitedTarget(&m_at);
+		port.at.setUnsolicitedOnLoop(true);
+		port.at.setCache(&m_at_cache);
+	}
+	
+	// Read-only commands without "?", concurrent identical requests share one response
+	for (auto cmd: {"AT+CSQ", "AT+CESQ", "AT+CGMI", "AT+CGMM", "AT+CGMR", "AT+CGSN", "AT+CIMI"}) {
+		m_at.addCoalescedCommand(cmd);
+		for (auto &port: m_ports)
+			port.at.addCoalescedCommand(cmd);
+	}
 }
 
 ModemBaseAt::~ModemBaseAt() {
@@ -88,6 +121,40 @@ bool ModemBaseAt::setCustomOption(const std::string &name, const std::any &value
 	} else if (name == "prefer_sms_to_sim") {
 		m_prefer_sms_to_sim = std::any_cast<bool>(value);
 		return true;
+	} else if (name == "adaptive_timeouts") {
+		m_at.setAdaptiveTimeouts(std::any_cast<bool>(value));
+		return true;
+	} else if (name == "latency_file") {
+		m_latency_file = std::any_cast<std::string>(value);
+		return true;
+	} else if (name == "at_io_mode") {
+		// thread - separate reader thread, loop - serial handled in main loop
+		auto mode = std::any_cast<std::string>(value) == "loop" ? AtChannel::IO_LOOP : AtChannel::IO_THREAD;
+		m_at.setIoMode(mode);
+		for (auto &port: m_ports)
+			port.at.setIoMode(mode);
+		return true;
+	} else if (name == "cmux") {
+		m_cmux_enabled = std::any_cast<bool>(value);
+		return true;
+	} else if (name == "at_ports") {
+		m_at_ports = std::any_cast<std::string>(value);
+		return true;
+	} else if (name == "serial_low_latency") {
+		m_serial_profile.low_latency = std::any_cast<bool>(value);
+		return true;
+	} else if (name == "serial_vmin") {
+		m_serial_profile.vmin = std::any_cast<int>(value);
+		return true;
+	} else if (name == "serial_vtime") {
+		m_serial_profile.vtime = std::any_cast<int>(value);
+		return true;
+	} else if (name == "serial_read_chunk") {
+		m_serial_profile.read_chunk = std::any_cast<int>(value);
+		return true;
+	} else if (name == "serial_trace") {
+		m_serial_trace = std::any_cast<std::string>(value);
+		return true;
 	}
 	return false;
 }
@@ -154,18 +221,18 @@ void ModemBaseAt::startNetRegWhatchdog() {
 /*
  * Raw AT commands
  * */
-std::pair<bool, std::string> ModemBaseAt::sendAtCommand(const std::string &cmd, int timeout) {
-	auto response = m_at.sendCommandNoPrefix(cmd, timeout);
-	
-	std::string out;
-	
-	if (response.lines.size() > 0) {
-		out = strJoin(response.lines, "\n") + "\n" + response.status;
-	} else {
-		out = response.status;
-	}
-	
-	return std::make_pair(response.error == 0, out);
+void ModemBaseAt::sendAtCommand(const std::string &cmd, AtCommandCallback callback, int timeout) {
+	getAt(AT_ROLE_USER)->sendCommandNoPrefixAsync(cmd, [=](const auto &response) {
+		std::string out;
+		
+		if (response.linesCount() > 0) {
+			out = strJoin(response.lines(), "\n") + "\n" + response.status;
+		} else {
+			out = response.status;
+		}
+		
+		callback(response.error == 0, out);
+	}, timeout, AtChannel::PRIORITY_INTERACTIVE);
 }
 
 /*
@@ -286,7 +353,7 @@ bool ModemBaseAt::discoverSmsStorages() {
 	
 	// Unknown modem
 	if (!m_sms_all_storages[0].size() || !m_sms_all_storages[1].size() || !m_sms_all_storages[2].size()) {
-		LOGE("Invalid SMS storages, CPMS: '%s'\n", response.data().c_str());
+		LOGE("Invalid SMS storages, CPMS: '%s'\n", response.data());
 		return false;
 	}
 	
@@ -356,7 +423,7 @@ bool ModemBaseAt::findBestSmsStorage(bool prefer_sim) {
 	return success;
 }
 
-bool ModemBaseAt::decodeSmsToPdu(const std::string &data, SmsDir *dir, Pdu *pdu, int *id, uint32_t *hash) {
+bool ModemBaseAt::decodeSmsToPdu(const char *data, SmsDir *dir, Pdu *pdu, int *id, uint32_t *hash) {
 	int stat;
 	std::string pdu_bytes;
 	bool direction;
@@ -391,7 +458,7 @@ bool ModemBaseAt::decodeSmsToPdu(const std::string &data, SmsDir *dir, Pdu *pdu,
 			direction = true;
 		break;
 		default:
-			LOGE("Unknown SMS <stat>: '%s'\n", data.c_str());
+			LOGE("Unknown SMS <stat>: '%s'\n", data);
 			return false;
 		break;
 	}
@@ -413,137 +480,135 @@ bool ModemBaseAt::decodeSmsToPdu(const std::string &data, SmsDir *dir, Pdu *pdu,
 	return true;
 }
 
-void ModemBaseAt::getSmsList(SmsDir from_dir, SmsReadCallback callback) {
-	if (from_dir > SMS_DIR_ALL || !m_sms_ready) {
-		callback(false, {});
-		return;
+void ModemBaseAt::addSmsToList(const char *line, SmsList *list) {
+	std::tuple<uint8_t, std::string, std::string, uint16_t, uint8_t> sms_key;
+	int msg_id;
+	Pdu pdu;
+	SmsDir dir;
+	PduUserDataHeader hdr;
+	std::string decoded_text;
+	uint32_t msg_hash;
+	bool invalid = false;
+	
+	bool decode_success = false;
+	if (decodeSmsToPdu(line, &dir, &pdu, &msg_id, &msg_hash)) {
+		std::tie(decode_success, decoded_text) = decodeSmsDcsData(&pdu, &hdr);
+		
+		if (!decode_success)
+			LOGE("Invalid PDU data in SMS: '%s'\n", line);
 	}
 	
-	auto response = m_at.sendCommandMultiline("AT+CMGL=" + std::to_string(from_dir), "+CMGL");
-	if (response.error) {
-		callback(false, {});
-		return;
+	if (!decode_success) {
+		hdr = {};
+		decoded_text = std::string("Invalid PDU:\n") + line;
+		invalid = true;
 	}
 	
-	Loop::setTimeout([=]() {
-		auto start = getCurrentTimestamp();
+	if (hdr.app_port) {
+		decoded_text = "Wireless Datagram Protocol\n"
+			"Src port: " + std::to_string(hdr.app_port->src) + "\n"
+			"Dst port: " + std::to_string(hdr.app_port->dst) + "\n"
+			"Data: " + bin2hex(decoded_text) + "\n";
+		invalid = true;
+	}
+	
+	uint16_t ref_id = hdr.concatenated ? hdr.concatenated->ref_id : 0;
+	uint8_t parts = hdr.concatenated ? hdr.concatenated->parts : 1;
+	uint8_t part = hdr.concatenated ? hdr.concatenated->part : 1;
+	
+	if (part < 1 || part > parts) {
+		LOGE("Invalid SMS part id: %d / %d, in: '%s'\n", part, parts, line);
+		parts = 1;
+		part = 1;
+		ref_id = 0;
+	}
+	
+	Sms *sms = nullptr;
+	
+	if (parts > 1) {
+		if (pdu.type == PDU_TYPE_DELIVER) {
+			sms_key = std::make_tuple(pdu.type, pdu.smsc.number, pdu.deliver().src.number, ref_id, parts);
+		} else if (pdu.type == PDU_TYPE_SUBMIT) {
+			sms_key = std::make_tuple(pdu.type, pdu.smsc.number, pdu.submit().dst.number, ref_id, parts);
+		}
 		
-		// <smsc>, <addr>, <ref_id>, <parts>
-		std::vector<Sms> sms_list;
-		std::map<std::tuple<uint8_t, std::string, std::string, uint16_t, uint8_t>, size_t> sms_parts;
-		std::tuple<uint8_t, std::string, std::string, uint16_t, uint8_t> sms_key;
-		
-		sms_list.reserve(response.lines.size());
-		
-		for (auto &line: response.lines) {
-			int msg_id;
-			Pdu pdu;
-			SmsDir dir;
-			PduUserDataHeader hdr;
-			std::string decoded_text;
-			uint32_t msg_hash;
-			bool invalid = false;
-			
-			bool decode_success = false;
-			if (decodeSmsToPdu(line, &dir, &pdu, &msg_id, &msg_hash)) {
-				std::tie(decode_success, decoded_text) = decodeSmsDcsData(&pdu, &hdr);
-				
-				if (!decode_success)
-					LOGE("Invalid PDU data in SMS: '%s'\n", line.c_str());
-			}
-			
-			if (!decode_success) {
-				hdr = {};
-				decoded_text = "Invalid PDU:\n" + line;
-				invalid = true;
-			}
-			
-			if (hdr.app_port) {
-				decoded_text = "Wireless Datagram Protocol\n"
-					"Src port: " + std::to_string(hdr.app_port->src) + "\n"
-					"Dst port: " + std::to_string(hdr.app_port->dst) + "\n"
-					"Data: " + bin2hex(decoded_text) + "\n";
-				invalid = true;
-			}
-			
-			uint16_t ref_id = hdr.concatenated ? hdr.concatenated->ref_id : 0;
-			uint8_t parts = hdr.concatenated ? hdr.concatenated->parts : 1;
-			uint8_t part = hdr.concatenated ? hdr.concatenated->part : 1;
-			
-			if (part < 1 || part > parts) {
-				LOGE("Invalid SMS part id: %d / %d, in: '%s'\n", part, parts, line.c_str());
-				parts = 1;
-				part = 1;
-				ref_id = 0;
-			}
-			
-			Sms *sms = nullptr;
+		if (list->parts.find(sms_key) != list->parts.cend()) {
+			sms = &list->sms[list->parts[sms_key]];
+		} else {
+			list->parts[sms_key] = list->sms.size();
+			list->sms.resize(list->sms.size() + 1);
+			sms = &list->sms.back();
+			sms->parts.resize(parts);
+		}
+	} else {
+		list->sms.resize(list->sms.size() + 1);
+		sms = &list->sms.back();
+		sms->parts.resize(parts);
+	}
+	
+	sms->hash = msg_hash;
+	sms->dir = dir;
+	sms->unread = (dir == SMS_DIR_UNREAD);
+	sms->invalid = invalid;
+	
+	switch (pdu.type) {
+		case PDU_TYPE_DELIVER:
+		{
+			auto &deliver = pdu.deliver();
+			sms->type = SMS_INCOMING;
+			sms->time = deliver.dt.timestamp;
+			sms->addr = deliver.src.number;
 			
-			if (parts > 1) {
-				if (pdu.type == PDU_TYPE_DELIVER) {
-					sms_key = std::make_tuple(pdu.type, pdu.smsc.number, pdu.deliver().src.number, ref_id, parts);
-				} else if (pdu.type == PDU_TYPE_SUBMIT) {
-					sms_key = std::make_tuple(pdu.type, pdu.smsc.number, pdu.submit().dst.number, ref_id, parts);
-				}
-				
-				if (sms_parts.find(sms_key) != sms_parts.cend()) {
-					sms = &sms_list[sms_parts[sms_key]];
-				} else {
-					sms_parts[sms_key] = sms_list.size();
-					sms_list.resize(sms_list.size() + 1);
-					sms = &sms_list.back();
-					sms->parts.resize(parts);
-				}
+			if (deliver.src.type == PDU_ADDR_INTERNATIONAL) {
+				sms->addr = "+" + deliver.src.number;
 			} else {
-				sms_list.resize(sms_list.size() + 1);
-				sms = &sms_list.back();
-				sms->parts.resize(parts);
+				sms->addr = deliver.src.number;
 			}
+		}
+		break;
+		
+		case PDU_TYPE_SUBMIT:
+		{
+			auto &submit = pdu.submit();
+			sms->type = SMS_OUTGOING;
+			sms->time = 0;
 			
-			sms->hash = msg_hash;
-			sms->dir = dir;
-			sms->unread = (dir == SMS_DIR_UNREAD);
-			sms->invalid = invalid;
-			
-			switch (pdu.type) {
-				case PDU_TYPE_DELIVER:
-				{
-					auto &deliver = pdu.deliver();
-					sms->type = SMS_INCOMING;
-					sms->time = deliver.dt.timestamp;
-					sms->addr = deliver.src.number;
-					
-					if (deliver.src.type == PDU_ADDR_INTERNATIONAL) {
-						sms->addr = "+" + deliver.src.number;
-					} else {
-						sms->addr = deliver.src.number;
-					}
-				}
-				break;
-				
-				case PDU_TYPE_SUBMIT:
-				{
-					auto &submit = pdu.submit();
-					sms->type = SMS_OUTGOING;
-					sms->time = 0;
-					
-					if (submit.dst.type == PDU_ADDR_INTERNATIONAL) {
-						sms->addr = "+" + submit.dst.number;
-					} else {
-						sms->addr = submit.dst.number;
-					}
-				}
-				break;
+			if (submit.dst.type == PDU_ADDR_INTERNATIONAL) {
+				sms->addr = "+" + submit.dst.number;
+			} else {
+				sms->addr = submit.dst.number;
 			}
-			
-			sms->parts[part - 1].id = msg_id;
-			sms->parts[part - 1].text = decoded_text;
 		}
-		auto elapsed = getCurrentTimestamp() - start;
-		LOGD("Sms decode time: %d\n", static_cast<int>(elapsed));
+		break;
+	}
+	
+	sms->parts[part - 1].id = msg_id;
+	sms->parts[part - 1].text = decoded_text;
+}
+
+void ModemBaseAt::getSmsList(SmsDir from_dir, SmsReadCallback callback) {
+	if (from_dir > SMS_DIR_ALL || !m_sms_ready) {
+		callback(false, {});
+		return;
+	}
+	
+	// Records are decoded on reader thread, while modem is still sending next
+	auto list = std::make_shared<SmsList>();
+	
+	getAt(AT_ROLE_BULK)->sendCommandStreamAsync("AT+CMGL=" + std::to_string(from_dir), "+CMGL", [=](const char *line) {
+		auto start = getCurrentTimestamp();
+		addSmsToList(line, list.get());
+		list->decode_time += getCurrentTimestamp() - start;
+	}, [=](const auto &response) {
+		if (response.error) {
+			callback(false, {});
+			return;
+		}
+		
+		LOGD("Sms decode time: %d\n", static_cast<int>(list->decode_time));
 		
-		callback(true, sms_list);
-	}, 0);
+		callback(true, std::move(list->sms));
+	}, 0, AtChannel::PRIORITY_BULK);
 }
 
 bool ModemBaseAt::deleteSms(int id) {
@@ -572,54 +637,31 @@ void ModemBaseAt::handleUssdResponse(int code, const std::string &data, int dcs)
 	}
 	
 	if (m_ussd_callback) {
-		uint32_t current_req = m_ussd_request_id;
+		auto callback = m_ussd_callback;
+		Loop::clearTimeout(m_ussd_timeout);
+		m_ussd_callback = nullptr;
+		m_ussd_timeout = -1;
+		m_ussd_at_request = 0;
+		m_ussd_session = (code == USSD_WAIT_REPLY);
 		
-		Loop::setTimeout([=]() {
-			if (current_req == m_ussd_request_id) {
-				auto callback = m_ussd_callback;
-				Loop::clearTimeout(m_ussd_timeout);
-				m_ussd_callback = nullptr;
-				m_ussd_timeout = -1;
-				m_ussd_session = (code == USSD_WAIT_REPLY);
-				
-				if (callback)
-					callback(static_cast<UssdCode>(code), decoded);
-			} else if (!isUssdBusy()) {
-				LOGD("Unsolicited USSD: %s [code=%d]\n", decoded.c_str(), code);
-				
-				if (code == USSD_WAIT_REPLY)
-					cancelUssd();
-			}
-		}, 0);
+		callback(static_cast<UssdCode>(code), decoded);
 	}
 }
 
 void ModemBaseAt::handleCusd(const std::string &event) {
-	int dcs = 0, code = 0;
-	std::string data;
-	
-	bool success;
-	int args_cnt = AtParser::getArgCnt(event);
-	
-	if (args_cnt == 1) {
-		success = AtParser(event)
-			.parseInt(&code)
-			.success();
-	} else {
-		success = AtParser(event)
-			.parseInt(&code)
-			.parseString(&data)
-			.parseInt(&dcs)
-			.success();
-	}
+	using namespace AtField;
 	
-	if (!success) {
+	// <code>[, <str>, <dcs>]
+	auto cusd = AtSchema<Int, Opt<Str>, Opt<Int>>::parse(event);
+	if (!cusd) {
 		LOGE("Invalid CUSD: %s\n", event.c_str());
 		return;
 	}
 	
+	auto [code, data, dcs] = *cusd;
+	
 	// NOTE: hex2bin assume as raw data, if can't decode as hex
-	handleUssdResponse(code, hex2bin(data), dcs);
+	handleUssdResponse(code, hex2bin(std::string(data.value_or(""))), dcs.value_or(0));
 }
 
 bool ModemBaseAt::sendUssd(const std::string &cmd, UssdCallback callback, int timeout) {
@@ -641,16 +683,28 @@ bool ModemBaseAt::sendUssd(const std::string &cmd, UssdCallback callback, int ti
 	m_ussd_request_id++;
 	m_ussd_callback = callback;
 	
-	if (m_at.sendCommandNoResponse("AT+CUSD=1,\"" + cmd + "\",15") != 0) {
-		m_ussd_callback = nullptr;
-		return false;
-	}
-	
 	m_ussd_timeout = Loop::setTimeout([=]() {
 		m_ussd_callback = nullptr;
 		callback(USSD_ERROR, "USSD command timeout reached.");
 	}, timeout);
 	
+	uint32_t current_req = m_ussd_request_id;
+	
+	m_ussd_at_request = m_at.sendCommandNoResponseAsync("AT+CUSD=1,\"" + cmd + "\",15", [=](const auto &response) {
+		// Command finished, nothing to abort in cancelUssd()
+		if (current_req == m_ussd_request_id)
+			m_ussd_at_request = 0;
+		
+		if (!response.error || current_req != m_ussd_request_id || !m_ussd_callback)
+			return;
+		
+		Loop::clearTimeout(m_ussd_timeout);
+		m_ussd_callback = nullptr;
+		m_ussd_timeout = -1;
+		
+		callback(USSD_ERROR, "Can't send USSD command.");
+	}, 0, AtChannel::PRIORITY_INTERACTIVE);
+	
 	return true;
 }
 
@@ -670,6 +724,12 @@ bool ModemBaseAt::cancelUssd() {
 		}, 0);
 	}
 	
+	// Abort AT+CUSD=1, if modem still waits network
+	if (m_ussd_at_request) {
+		m_at.cancel(m_ussd_at_request);
+		m_ussd_at_request = 0;
+	}
+	
 	return m_at.sendCommandNoResponse("AT+CUSD=2") == 0;
 }
 
@@ -688,44 +748,45 @@ void ModemBaseAt::startSimPolling() {
 	if (m_pin_state != PIN_UNKNOWN && m_pin_state != PIN_REQUIRED)
 		return;
 	
-	auto old_state = m_pin_state;
-	
-	auto response = m_at.sendCommand("AT+CPIN?");
-	if (response.isCmeError()) {
-		int error = response.getCmeError();
+	m_at.sendCommandAsync("AT+CPIN?", "", [=](const auto &response) {
+		auto old_state = m_pin_state;
 		
-		switch (error) {
-			case 10:	// SIM not inserted
-			case 13:	// SIM failure
-			case 15:	// SIM wrong
-				LOGD("SIM not present, no need PIN code\n");
-				m_pin_state = PIN_NOT_SUPPORTED;
-			break;
+		if (response.isCmeError()) {
+			int error = response.getCmeError();
 			
-			case 14:	// SUM busy
-				// SIM not ready, ignore this error
-			break;
+			switch (error) {
+				case 10:	// SIM not inserted
+				case 13:	// SIM failure
+				case 15:	// SIM wrong
+					LOGD("SIM not present, no need PIN code\n");
+					m_pin_state = PIN_NOT_SUPPORTED;
+				break;
+				
+				case 14:	// SUM busy
+					// SIM not ready, ignore this error
+				break;
+				
+				default:
+					LOGE("AT+CPIN command failed [CME ERROR %d]\n", error);
+					m_pin_state = PIN_NOT_SUPPORTED;
+				break;
+			}
+		} else if (response.error) {
+			// AT+CPIN not supported
+			m_pin_state = PIN_NOT_SUPPORTED;
+		}
+		
+		if (old_state != m_pin_state) {
+			emit<EvPinStateChaned>({.state = m_pin_state});
 			
-			default:
-				LOGE("AT+CPIN command failed [CME ERROR %d]\n", error);
-				m_pin_state = PIN_NOT_SUPPORTED;
-			break;
+			if (m_pin_state != PIN_UNKNOWN && m_pin_state != PIN_REQUIRED)
+				return;
 		}
-	} else if (response.error) {
-		// AT+CPIN not supported
-		m_pin_state = PIN_NOT_SUPPORTED;
-	}
-	
-	if (old_state != m_pin_state) {
-		emit<EvPinStateChaned>({.state = m_pin_state});
 		
-		if (m_pin_state != PIN_UNKNOWN && m_pin_state != PIN_REQUIRED)
-			return;
-	}
-	
-	Loop::setTimeout([=]() {
-		startSimPolling();
-	}, 1000);
+		Loop::setTimeout([=]() {
+			startSimPolling();
+		}, 1000);
+	});
 }
 
 void ModemBaseAt::handleCpin(const std::string &event) {
@@ -735,6 +796,10 @@ void ModemBaseAt::handleCpin(const std::string &event) {
 	
 	auto old_state = m_pin_state;
 	
+	// SIM changed or removed
+	if (code != "READY" || old_state != PIN_READY)
+		m_at_cache.invalidate();
+	
 	if (strStartsWith(code, "READY")) {
 		m_pin_state = PIN_READY;
 	} else if (strStartsWith(code, "SIM PIN")) {
@@ -749,13 +814,13 @@ void ModemBaseAt::handleCpin(const std::string &event) {
 			// Trying enter PIN code only one time
 			m_pincode_entered = true;
 			
-			Loop::setTimeout([=]() {
-				if (m_at.sendCommandNoResponse("AT+CPIN=" + m_pincode) != 0)
+			m_at.sendCommandNoResponseAsync("AT+CPIN=" + m_pincode, [=](const auto &response) {
+				if (response.error)
 					LOGE("SIM PIN unlock error\n");
 				
 				// Force request new status
-				m_at.sendCommandNoResponse("AT+CPIN?");
-			}, 0);
+				m_at.sendCommandNoResponseAsync("AT+CPIN?", nullptr);
+			});
 		}
 	} else {
 		LOGE("SIM required other lock code: %s\n", code.c_str());
@@ -810,21 +875,25 @@ void ModemBaseAt::handleCesq(const std::string &event) {
  * Read modem identification (model, vendor, sw version, IMEI, ...)
  * */
 bool ModemBaseAt::readModemIdentification() {
-	AtChannel::Response response;
+	auto start = getCurrentTimestamp();
+	
+	auto responses = m_at.sendCommandBatch({
+		{AtChannel::DEFAULT, "AT+CGMI", "+CGMI"},
+		{AtChannel::DEFAULT, "AT+CGMM", "+CGMM"},
+		{AtChannel::DEFAULT, "AT+CGMR", "+CGMR"},
+		{AtChannel::NUMERIC, "AT+CGSN", "+CGSN"},
+	});
 	
-	response = m_at.sendCommand("AT+CGMI", "+CGMI");
-	if (response.error || !AtParser(response.data()).parseString(&m_hw_vendor).success())
+	if (responses[0].error || !AtParser(responses[0].data()).parseString(&m_hw_vendor).success())
 		return false;
 	
-	response = m_at.sendCommand("AT+CGMM", "+CGMM");
-	if (response.error || !AtParser(response.data()).parseString(&m_hw_model).success())
+	if (responses[1].error || !AtParser(responses[1].data()).parseString(&m_hw_model).success())
 		return false;
 	
-	response = m_at.sendCommand("AT+CGMR", "+CGMR");
-	if (response.error || !AtParser(response.data()).parseString(&m_sw_ver).success())
+	if (responses[2].error || !AtParser(responses[2].data()).parseString(&m_sw_ver).success())
 		return false;
 	
-	response = m_at.sendCommandNumericOrWithPrefix("AT+CGSN", "+CGSN");
+	AtChannel::Response response = std::move(responses[3]);
 	if (response.error) {
 		// Some CDMA modems not support CGSN, but supports GSN
 		response = m_at.sendCommandNumericOrWithPrefix("AT+GSN", "+GSN");
@@ -835,6 +904,8 @@ bool ModemBaseAt::readModemIdentification() {
 	if (!AtParser(response.data()).parseString(&m_imei).success())
 		return false;
 	
+	LOGD("Read modem identification: %d ms\n", static_cast<int>(getCurrentTimestamp() - start));
+	
 	return true;
 }
 
@@ -855,36 +926,310 @@ bool ModemBaseAt::readSimIdentification() {
 	return true;
 }
 
-bool ModemBaseAt::open() {
-	// Try open serial
-	if (m_serial.open(m_tty, m_speed) != 0) {
-		LOGE("Can't open %s with speed %d...\n", m_tty.c_str(), m_speed);
+/*
+ * Additional AT channels
+ * */
+bool ModemBaseAt::openCmux(bool *at_lost) {
+	// Switch modem to multiplexer mode using plain AT channel
+	if (!m_at.start())
+		return false;
+	
+	bool success = handshake() && m_at.sendCommandNoResponse("AT+CMUX=0") == 0;
+	m_at.stop();
+	
+	if (!success)
+		return false;
+	
+	if (!m_cmux.open(&m_serial, 3)) {
+		LOGE("Modem accepted AT+CMUX, but multiplexer is not started...\n");
+		
+		// Multiplexer close-down already sent, check modem is really in AT mode
+		*at_lost = !m_at.start() || !handshake();
+		m_at.stop();
+		
 		return false;
 	}
 	
+	m_at.setSerial(m_cmux.getChannel(1));
+	
+	AtRole roles[] = {AT_ROLE_BULK, AT_ROLE_USER};
+	for (int i = 0; i < 2; i++) {
+		m_ports[i].at.setSerial(m_cmux.getChannel(i + 2));
+		m_ports_count++;
+		
+		if (!startAtPort(&m_ports[i], roles[i])) {
+			LOGE("Can't start AT channel over CMUX...\n");
+			closeAtPorts();
+			return false;
+		}
+	}
+	
+	return true;
+}
+
+bool ModemBaseAt::openAtPorts() {
+	std::vector<std::pair<std::string, std::string>> ports;
+	
+	if (m_at_ports == "auto") {
+		for (auto &tty: findSiblingTTYs(m_tty))
+			ports.push_back({tty, ""});
+	} else {
+		// <device>[=<role>] separated by spaces
+		size_t start = 0;
+		while (start < m_at_ports.size()) {
+			size_t end = std::min(m_at_ports.find(' ', start), m_at_ports.size());
+			std::string entry = m_at_ports.substr(start, end - start);
+			start = end + 1;
+			
+			if (!entry.size())
+				continue;
+			
+			size_t sep = entry.rfind('=');
+			if (sep != std::string::npos) {
+				ports.push_back({findTTY(entry.substr(0, sep)), entry.substr(sep + 1)});
+			} else {
+				ports.push_back({findTTY(entry), ""});
+			}
+		}
+	}
+	
+	// Ports without explicit role: bulk, user and then listeners
+	AtRole auto_roles[] = {AT_ROLE_BULK, AT_ROLE_USER, AT_ROLE_URC};
+	int next_auto_role = 0;
+	
+	for (auto &it: ports) {
+		if (m_ports_count >= MAX_AT_PORTS)
+			break;
+		
+		if (!it.first.size() || it.first == m_tty)
+			continue;
+		
+		AtRole role;
+		if (it.second == "bulk") {
+			role = AT_ROLE_BULK;
+		} else if (it.second == "user") {
+			role = AT_ROLE_USER;
+		} else if (it.second == "urc") {
+			role = AT_ROLE_URC;
+		} else if (!it.second.size()) {
+			while (next_auto_role < 2 && m_at_roles[auto_roles[next_auto_role]])
+				next_auto_role++;
+			role = auto_roles[next_auto_role];
+		} else {
+			LOGE("Unknown AT port role: %s\n", it.second.c_str());
+			continue;
+		}
+		
+		AtPort *port = &m_ports[m_ports_count];
+		m_serial_profile.speed = m_speed;
+		if (port->serial.open(it.first, m_serial_profile) != 0) {
+			LOGE("Can't open AT port %s\n", it.first.c_str());
+			continue;
+		}
+		
+		port->at.setSerial(&port->serial);
+		m_ports_count++;
+		
+		// Other ports of modem can be DIAG, GPS, etc
+		if (!startAtPort(port, role)) {
+			LOGD("%s is not AT port, skip...\n", it.first.c_str());
+			port->at.stop();
+			port->serial.close();
+			m_ports_count--;
+			continue;
+		}
+		
+		LOGD("Using %s as additional AT port\n", it.first.c_str());
+	}
+	
+	return m_ports_count > 0;
+}
+
+bool ModemBaseAt::startAtPort(AtPort *port, AtRole role) {
+	if (!port->at.start())
+		return false;
+	
+	// Echo, error format and SMS mode are per port
+	if (port->at.sendCommandNoResponse("ATE0", 1000) != 0)
+		return false;
+	
+	port->at.sendCommandNoResponse("AT+CMEE=1");
+	
+	if (role == AT_ROLE_BULK)
+		port->at.sendCommandNoResponse("AT+CMGF=0");
+	
+	port->role = role;
+	if (!m_at_roles[role])
+		m_at_roles[role] = &port->at;
+	
+	// Hung DLC or additional tty is same bad as hung main channel
+	startWatchdog(&port->watchdog, &port->at);
+	
+	return true;
+}
+
+void ModemBaseAt::startWatchdog(AtWatchdog *watchdog, AtChannel *at) {
+	watchdog->setChannel(at);
+	watchdog->onStateChanged([=](AtWatchdog::State state) {
+		handleWatchdogState(watchdog, state);
+	});
+	watchdog->start();
+	
+	at->onAnyError([=](AtChannel::Errors error, int64_t) {
+		if (error == AtChannel::AT_IO_ERROR || error == AtChannel::AT_TIMEOUT) {
+			if (!m_self_test)
+				watchdog->reportError();
+		}
+	});
+}
+
+void ModemBaseAt::handleWatchdogState(AtWatchdog *watchdog, AtWatchdog::State state) {
+	if (state == AtWatchdog::BROKEN) {
+		watchdog->stop();
+		
+		// Main channel lost, modem must be reopened
+		if (watchdog == &m_at_watchdog) {
+			emit<EvIoBroken>({});
+			m_at.stop();
+			return;
+		}
+		
+		// Additional port lost, commands of its role go to main channel
+		for (int i = 0; i < m_ports_count; i++) {
+			AtPort *port = &m_ports[i];
+			if (&port->watchdog != watchdog)
+				continue;
+			
+			LOGE("Additional AT port is broken, using main AT channel instead...\n");
+			
+			// Not inside callback of this channel
+			Loop::setTimeout([=]() {
+				if (port->watchdog.getState() == AtWatchdog::BROKEN)
+					closeAtPort(port);
+			}, 0);
+		}
+	}
+	
+	// Degraded while at least one channel is probing
+	bool degraded = m_at_watchdog.getState() == AtWatchdog::DEGRADED;
+	for (int i = 0; i < m_ports_count; i++) {
+		if (m_ports[i].watchdog.getState() == AtWatchdog::DEGRADED)
+			degraded = true;
+	}
+	
+	if (m_io_degraded != degraded) {
+		m_io_degraded = degraded;
+		emit<EvIoHealthChanged>({degraded});
+	}
+}
+
+void ModemBaseAt::closeAtPort(AtPort *port) {
+	for (auto &role: m_at_roles) {
+		if (role == &port->at)
+			role = nullptr;
+	}
+	
+	port->watchdog.stop();
+	port->at.stop();
+	port->serial.close();
+}
+
+void ModemBaseAt::closeAtPorts() {
+	for (int i = 0; i < m_ports_count; i++)
+		closeAtPort(&m_ports[i]);
+	m_ports_count = 0;
+	
+	if (m_cmux.isOpened()) {
+		m_cmux.close();
+		m_at.setSerial(&m_serial);
+	}
+}
+
+AtChannel *ModemBaseAt::getAt(AtRole role) {
+	return m_at_roles[role] ? m_at_roles[role] : &m_at;
+}
+
+const char *ModemBaseAt::getAtRoleName(AtRole role) {
+	switch (role) {
+		case AT_ROLE_CONTROL:	return "control";
+		case AT_ROLE_URC:		return "urc";
+		case AT_ROLE_BULK:		return "bulk";
+		case AT_ROLE_USER:		return "user";
+		case AT_ROLE_MAX:		break;
+	}
+	return "unknown";
+}
+
+std::vector<std::pair<std::string, AtChannel *>> ModemBaseAt::getAtChannels() {
+	std::vector<std::pair<std::string, AtChannel *>> channels = {{"main", &m_at}};
+	for (int i = 0; i < m_ports_count; i++)
+		channels.push_back({getAtRoleName(m_ports[i].role), &m_ports[i].at});
+	return channels;
+}
+
+bool ModemBaseAt::open() {
+	m_replay_mode = strStartsWith(m_tty, "replay:") || strStartsWith(m_tty, "replay-fast:");
+	
+	if (m_replay_mode) {
+		// Offline replay of recorded session
+		if (m_replay.open(m_tty.substr(m_tty.find(':') + 1), strStartsWith(m_tty, "replay:")) != 0) {
+			LOGE("Can't open trace %s...\n", m_tty.c_str());
+			return false;
+		}
+		m_at.setSerial(&m_replay);
+	} else {
+		// Try open serial
+		m_serial_profile.speed = m_speed;
+		if (m_serial.open(m_tty, m_serial_profile) != 0) {
+			LOGE("Can't open %s with speed %d...\n", m_tty.c_str(), m_speed);
+			return false;
+		}
+		
+		if (m_serial_trace.size() > 0 && m_serial.startRecording(m_serial_trace))
+			LOGD("Recording %s traffic to %s\n", m_tty.c_str(), m_serial_trace.c_str());
+	}
+	
+	// Modem can be replaced or reflashed while closed
+	m_at_cache.invalidate();
+	
+	// Optional multiplexer over single tty
+	if (!m_replay_mode && m_cmux_enabled) {
+		bool at_lost = false;
+		if (!openCmux(&at_lost)) {
+			if (at_lost) {
+				LOGE("Modem is stuck in CMUX mode...\n");
+				close();
+				return false;
+			}
+			LOGE("CMUX is not available, using single AT channel...\n");
+		}
+	}
+	
+	// Or additional ports of same USB device
+	if (!m_replay_mode && !m_cmux.isOpened() && m_at_ports.size() > 0 && !openAtPorts())
+		LOGE("Additional AT ports not found, using single AT channel...\n");
+	
 	// Detect TTY device lost
 	m_at.onIoBroken([=]() {
 		Loop::setTimeout([=]() {
+			m_at_watchdog.stop();
 			emit<EvIoBroken>({});
 			m_at.stop();
 		}, 0);
 	});
 	
 	// Detect modem hangs
-	m_at.onAnyError([=](AtChannel::Errors error, int64_t start) {
-		if (error == AtChannel::AT_IO_ERROR || error == AtChannel::AT_TIMEOUT) {
-			if (!m_self_test) {
-				m_self_test = true;
-				LOGE("Detected IO error on AT channel... try ping for check...\n");
-				if (!ping(32)) {
-					LOGE("AT channel is broken!!!\n");
-					emit<EvIoBroken>({});
-					m_at.stop();
-				}
-				m_self_test = false;
-			}
-		}
-	});
+	startWatchdog(&m_at_watchdog, &m_at);
+	
+	// Restore learned commands latency
+	if (m_latency_file.size() > 0) {
+		if (m_at.loadLatencyStats(m_latency_file))
+			LOGD("Loaded commands latency from %s\n", m_latency_file.c_str());
+		
+		m_latency_save_interval = Loop::setInterval([=]() {
+			m_at.saveLatencyStats(m_latency_file);
+		}, 5 * 60 * 1000);
+	}
 	
 	// Start AT channel
 	if (!m_at.start()) {
@@ -910,5 +1255,23 @@ bool ModemBaseAt::open() {
 }
 
 void ModemBaseAt::close() {
+	m_at_watchdog.stop();
+	m_io_degraded = false;
 	m_at.stop();
+	
+	closeAtPorts();
+	
+	m_serial.stopRecording();
+	
+	if (m_replay_mode) {
+		m_replay.close();
+		m_at.setSerial(&m_serial);
+		m_replay_mode = false;
+	}
+	
+	if (m_latency_save_interval != -1) {
+		Loop::clearInterval(m_latency_save_interval);
+		m_latency_save_interval = -1;
+		m_at.saveLatencyStats(m_latency_file);
+	}
 }
@@ -7,7 +7,11 @@
 
 #include "../Modem.h"
 #include "../Serial.h"
+#include "../Cmux.h"
+#include "../SerialReplay.h"
 #include "../AtChannel.h"
+#include "../AtCache.h"
+#include "../AtWatchdog.h"
 #include "../AtParser.h"
 #include "../GsmUtils.h"
 
@@ -19,6 +23,46 @@ class ModemBaseAt: public Modem {
 		Serial m_serial;
 		AtChannel m_at;
 		
+		// Shared by all AT channels of modem
+		AtCache m_at_cache;
+		
+		// Commands routing, roles without own channel goes to m_at
+		enum AtRole {
+			AT_ROLE_CONTROL,	// Connection management, always m_at
+			AT_ROLE_URC,		// Only listen unsolicited events
+			AT_ROLE_BULK,		// SMS reading
+			AT_ROLE_USER,		// Commands from API
+			AT_ROLE_MAX
+		};
+		
+		// Pool of additional AT channels (CMUX DLC's or other tty's of same USB device), each with own queue
+		struct AtPort {
+			Serial serial;
+			AtChannel at;
+			AtWatchdog watchdog;
+			AtRole role;
+		};
+		
+		static constexpr int MAX_AT_PORTS = 3;
+		
+		AtPort m_ports[MAX_AT_PORTS];
+		int m_ports_count = 0;
+		AtChannel *m_at_roles[AT_ROLE_MAX] = {};
+		
+		// Optional CMUX over m_serial: m_at on DLC 1, bulk transfers on DLC 2, user commands on DLC 3
+		Cmux m_cmux;
+		bool m_cmux_enabled = false;
+		
+		// "auto" or list of "<device>[=<role>]"
+		std::string m_at_ports;
+		
+		// Recorded trace instead of modem, when tty is "replay:<trace>" (original speed) or "replay-fast:<trace>"
+		SerialReplay m_replay;
+		bool m_replay_mode = false;
+		
+		// Record all m_serial traffic to this file
+		std::string m_serial_trace;
+		
 		enum CregStatus: int {
 			CREG_NOT_REGISTERED					= 0,
 			CREG_REGISTERED_HOME				= 1,
@@ -50,8 +94,8 @@ class ModemBaseAt: public Modem {
 		struct Creg {
 			CregStatus status = CREG_NOT_REGISTERED;
 			CregTech tech = CREG_TECH_UNKNOWN;
-			uint16_t loc_id = 0;
-			uint16_t cell_id = 0;
+			uint32_t loc_id = 0;
+			uint64_t cell_id = 0;
 			
 			bool isRegistered() const;
 			NetworkTech toNetworkTech() const;
@@ -63,6 +107,15 @@ class ModemBaseAt: public Modem {
 		Creg m_cgreg = {};
 		
 		bool m_self_test = false;
+		AtWatchdog m_at_watchdog;
+		bool m_io_degraded = false;
+		
+		// TTY tuning (speed taken from m_speed)
+		Serial::Profile m_serial_profile;
+		
+		// Learned commands latency, for adaptive timeouts
+		std::string m_latency_file;
+		int m_latency_save_interval = -1;
 		
 		int m_connect_timeout = 0;
 		int m_connect_timeout_id = -1;
@@ -70,6 +123,7 @@ class ModemBaseAt: public Modem {
 		bool m_pincode_entered = false;
 		
 		uint32_t m_ussd_request_id = 0;
+		int m_ussd_at_request = 0;
 		int m_ussd_timeout = -1;
 		bool m_ussd_session = false;
 		UssdCallback m_ussd_callback;
@@ -100,7 +154,18 @@ class ModemBaseAt: public Modem {
 		virtual bool findBestSmsStorage(bool prefer_sim);
 		virtual bool discoverSmsStorages();
 		virtual bool isSmsStorageSupported(int mem_id, SmsStorage check_storage);
-		virtual bool decodeSmsToPdu(const std::string &data, SmsDir *dir, Pdu *pdu, int *id, uint32_t *hash);
+		virtual bool decodeSmsToPdu(const char *data, SmsDir *dir, Pdu *pdu, int *id, uint32_t *hash);
+		
+		// Decoded SMS, concatenated parts are joined into one message
+		struct SmsList {
+			std::vector<Sms> sms;
+			// <type>, <smsc>, <addr>, <ref_id>, <parts> -> index in sms
+			std::map<std::tuple<uint8_t, std::string, std::string, uint16_t, uint8_t>, size_t> parts;
+			int64_t decode_time = 0;
+		};
+		
+		void addSmsToList(const char *line, SmsList *list);
+		
 		virtual bool syncSmsCapacity();
 		virtual bool syncSmsStorage();
 		
@@ -130,6 +195,16 @@ class ModemBaseAt: public Modem {
 		 * Internal
 		 * */
 		virtual int getCommandTimeout(const std::string &cmd);
+		
+		bool openCmux(bool *at_lost);
+		bool openAtPorts();
+		bool startAtPort(AtPort *port, AtRole role);
+		void startWatchdog(AtWatchdog *watchdog, AtChannel *at);
+		void handleWatchdogState(AtWatchdog *watchdog, AtWatchdog::State state);
+		void closeAtPort(AtPort *port);
+		void closeAtPorts();
+		AtChannel *getAt(AtRole role);
+		static const char *getAtRoleName(AtRole role);
 	public:
 		ModemBaseAt();
 		virtual ~ModemBaseAt();
@@ -142,7 +217,13 @@ class ModemBaseAt: public Modem {
 		/*
 		 * Command API
 		 */
-		virtual std::pair<bool, std::string> sendAtCommand(const std::string &cmd, int timeout = 0) override;
+		virtual void sendAtCommand(const std::string &cmd, AtCommandCallback callback, int timeout = 0) override;
+		
+		virtual AtChannel *getAtChannel() override {
+			return &m_at;
+		}
+		
+		virtual std::vector<std::pair<std::string, AtChannel *>> getAtChannels() override;
 		
 		/*
 		 * USSD API
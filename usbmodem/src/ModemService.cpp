@@ -24,6 +24,16 @@ ModemService::ModemService(const std::string &iface): m_iface(iface) {
 	m_uci_options["prefer_sms_to_sim"] = "0";
 	m_uci_options["force_network_restart"] = "0";
 	m_uci_options["connect_timeout"] = "300";
+	m_uci_options["at_io_mode"] = "thread";
+	m_uci_options["adaptive_timeouts"] = "0";
+	m_uci_options["latency_file"] = "";
+	m_uci_options["serial_low_latency"] = "0";
+	m_uci_options["serial_vmin"] = "1";
+	m_uci_options["serial_vtime"] = "0";
+	m_uci_options["serial_read_chunk"] = "0";
+	m_uci_options["cmux"] = "0";
+	m_uci_options["at_ports"] = "";
+	m_uci_options["serial_trace"] = "";
 }
 
 bool ModemService::validateOptions() {
@@ -180,6 +190,21 @@ bool ModemService::runModem() {
 	m_modem->setCustomOption<bool>("prefer_dhcp", m_uci_options["prefer_dhcp"] == "1");
 	m_modem->setCustomOption<bool>("prefer_sms_to_sim", m_uci_options["prefer_sms_to_sim"] == "1");
 	m_modem->setCustomOption<int>("connect_timeout", strToInt(m_uci_options["connect_timeout"]) * 1000);
+	m_modem->setCustomOption<std::string>("at_io_mode", m_uci_options["at_io_mode"]);
+	m_modem->setCustomOption<bool>("adaptive_timeouts", m_uci_options["adaptive_timeouts"] == "1");
+	m_modem->setCustomOption<bool>("serial_low_latency", m_uci_options["serial_low_latency"] == "1");
+	m_modem->setCustomOption<int>("serial_vmin", strToInt(m_uci_options["serial_vmin"]));
+	m_modem->setCustomOption<int>("serial_vtime", strToInt(m_uci_options["serial_vtime"]));
+	m_modem->setCustomOption<int>("serial_read_chunk", strToInt(m_uci_options["serial_read_chunk"]));
+	m_modem->setCustomOption<bool>("cmux", m_uci_options["cmux"] == "1");
+	m_modem->setCustomOption<std::string>("at_ports", m_uci_options["at_ports"]);
+	m_modem->setCustomOption<std::string>("serial_trace", m_uci_options["serial_trace"]);
+	
+	// Learned commands latency, survives daemon restarts
+	std::string latency_file = m_uci_options["latency_file"];
+	if (!latency_file.size())
+		latency_file = "/tmp/usbmodem-" + m_iface + ".latency";
+	m_modem->setCustomOption<std::string>("latency_file", latency_file);
 	
 	m_modem->on<Modem::EvNetworkChanged>([=](const auto &event) {
 		if (event.status == Modem::NET_NOT_REGISTERED) {
@@ -316,6 +341,14 @@ bool ModemService::runModem() {
 		}
 	});
 	
+	m_modem->on<Modem::EvIoHealthChanged>([=](const auto &event) {
+		if (event.degraded) {
+			LOGE("Modem is not responding, probing...\n");
+		} else {
+			LOGD("Modem is responding again\n");
+		}
+	});
+	
 	m_modem->on<Modem::EvIoBroken>([=](const auto &event) {
 		LOGE("TTY device is lost...\n");
 		setError("IO_ERROR");
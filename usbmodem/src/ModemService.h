@@ -49,6 +49,7 @@ class ModemService {
 		
 		// API
 		int apiGetInfo(std::shared_ptr<UbusRequest> req);
+		int apiGetStats(std::shared_ptr<UbusRequest> req);
 		int apiSendCommand(std::shared_ptr<UbusRequest> req);
 		int apiSendUssd(std::shared_ptr<UbusRequest> req);
 		int apiCancelUssd(std::shared_ptr<UbusRequest> req);
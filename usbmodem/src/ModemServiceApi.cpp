@@ -1,5 +1,6 @@
 #include "ModemService.h"
 #include "AtChannel.h"
+#include "AtCache.h"
 #include "GsmUtils.h"
 
 int ModemService::apiSendUssd(std::shared_ptr<UbusRequest> req) {
@@ -57,12 +58,14 @@ int ModemService::apiSendCommand(std::shared_ptr<UbusRequest> req) {
 		timeout = params["timeout"];
 	
 	if (cmd.size() > 0) {
-		auto [success, response] = m_modem->sendAtCommand(cmd, timeout);
+		req->defer();
 		
-		req->reply({
-			{"success", success},
-			{"response", response},
-		});
+		m_modem->sendAtCommand(cmd, [=](bool success, const std::string &response) {
+			req->reply({
+				{"success", success},
+				{"response", response},
+			});
+		}, timeout);
 		
 		return 0;
 	}
@@ -129,6 +132,116 @@ int ModemService::apiGetInfo(std::shared_ptr<UbusRequest> req) {
 	return 0;
 }
 
+static json histogramToJson(const Histogram &histogram) {
+	json buckets = json::array();
+	
+	// [<upper bound in ms>, <count>] for every non-empty bucket
+	for (int i = 0; i < Histogram::BUCKETS; i++) {
+		if (histogram.getBucket(i))
+			buckets.push_back({Histogram::getBucketBound(i), histogram.getBucket(i)});
+	}
+	
+	return {
+		{"count", histogram.getCount()},
+		{"avg", histogram.getAvg()},
+		{"max", histogram.getMax()},
+		{"p50", histogram.getPercentile(0.5)},
+		{"p90", histogram.getPercentile(0.9)},
+		{"p99", histogram.getPercentile(0.99)},
+		{"p999", histogram.getPercentile(0.999)},
+		{"buckets", buckets}
+	};
+}
+
+static json atStatsToJson(AtChannel *at, bool reset) {
+	auto stats = at->getStats();
+	AtCache::Stats cache_stats = {};
+	
+	if (at->getCache())
+		cache_stats = at->getCache()->getStats();
+	
+	if (reset) {
+		at->resetStats();
+		if (at->getCache())
+			at->getCache()->resetStats();
+	}
+	
+	double minutes = stats.elapsed / 60000.0;
+	
+	json response = {
+		{"elapsed", stats.elapsed},
+		{"bytes_read", stats.bytes_read},
+		{"bytes_written", stats.bytes_written},
+		{"coalesced", stats.coalesced},
+		{"unsolicited", {
+			{"count", stats.unsolicited},
+			{"rate", minutes > 0 ? stats.unsolicited / minutes : 0},
+			{"handlers", stats.unsolicited_handlers}
+		}},
+		{"cache", {
+			{"hits", cache_stats.hits},
+			{"misses", cache_stats.misses},
+			{"invalidations", cache_stats.invalidations},
+			{"entries", cache_stats.entries}
+		}},
+		{"queues", json::object()},
+		{"commands", json::object()}
+	};
+	
+	for (int i = 0; i < AtChannel::PRIORITY_MAX; i++) {
+		auto &queue = stats.queues[i];
+		response["queues"][AtChannel::getPriorityName(static_cast<AtChannel::Priority>(i))] = {
+			{"requests", queue.requests},
+			{"rejected", queue.rejected},
+			{"aged", queue.aged},
+			{"depth", queue.depth},
+			{"wait_avg", queue.requests > 0 ? queue.wait_total / queue.requests : 0},
+			{"wait_max", queue.wait_max}
+		};
+	}
+	
+	for (auto &it: stats.commands) {
+		auto &cmd = it.second;
+		response["commands"][it.first] = {
+			{"count", cmd.count},
+			{"errors", cmd.errors},
+			{"timeouts", cmd.timeouts},
+			{"bytes_read", cmd.bytes_read},
+			{"bytes_written", cmd.bytes_written},
+			{"queue_wait", histogramToJson(cmd.queue_wait)},
+			{"write_time", histogramToJson(cmd.write_time)},
+			{"response_time", histogramToJson(cmd.response_time)}
+		};
+	}
+	
+	return response;
+}
+
+int ModemService::apiGetStats(std::shared_ptr<UbusRequest> req) {
+	auto &params = req->data();
+	auto channels = m_modem->getAtChannels();
+	
+	if (!channels.size()) {
+		req->reply({{"error", "Modem has no AT channel."}});
+		return 0;
+	}
+	
+	bool reset = params["reset"].is_boolean() && params["reset"];
+	
+	// Main channel in root for compatibility, additional ports in list
+	json response = atStatsToJson(channels[0].second, reset);
+	response["ports"] = json::array();
+	
+	for (size_t i = 1; i < channels.size(); i++) {
+		json port = atStatsToJson(channels[i].second, reset);
+		port["role"] = channels[i].first;
+		response["ports"].push_back(port);
+	}
+	
+	req->reply(response);
+	return 0;
+}
+
 int ModemService::apiReadSms(std::shared_ptr<UbusRequest> req) {
 	static std::map<Modem::SmsStorage, std::string> storage_names = {
 		{Modem::SMS_STORAGE_MT, "MT"},
@@ -234,6 +347,11 @@ bool ModemService::runApi() {
 		.method("info", [=](auto req) {
 			return apiGetInfo(req);
 		})
+		.method("stats", [=](auto req) {
+			return apiGetStats(req);
+		}, {
+			{"reset", UbusObject::BOOL}
+		})
 		.method("send_command", [=](auto req) {
 			return apiSendCommand(req);
 		}, {
@@ -7,8 +7,11 @@
 #include <poll.h>
 #include <unistd.h>
 #include <fcntl.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
 
 #include "Log.h"
+#include "Termios2.h"
 
 Serial::Serial() {
 	
@@ -23,6 +26,24 @@ void Serial::breakTransfer() {
 		while (::write(m_wake_fds[1], "w", 1) < 0 && errno == EINTR);
 }
 
+void Serial::clearBreak() {
+	char buf[4];
+	while (true) {
+		int ret = ::read(m_wake_fds[0], buf, sizeof(buf));
+		if (ret > 0 || (ret < 0 && errno == EINTR))
+			continue;
+		break;
+	}
+}
+
+int Serial::sendBreak() {
+	if (tcsendbreak(m_fd, 0) != 0) {
+		LOGE("tcsendbreak() failed, errno = %d\n", errno);
+		return ERR_IO;
+	}
+	return 0;
+}
+
 int Serial::close() {
 	if (m_fd != -1) {
 		::close(m_fd);
@@ -39,20 +60,36 @@ int Serial::close() {
 	return 0;
 }
 
+bool Serial::startRecording(const std::string &path) {
+	return m_trace.create(path);
+}
+
+void Serial::stopRecording() {
+	m_trace.close();
+}
+
 int Serial::open(std::string device, int speed) {
+	Profile profile;
+	profile.speed = speed;
+	return open(device, profile);
+}
+
+int Serial::open(std::string device, const Profile &profile) {
 	if (pipe2(m_wake_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
 		LOGE("pipe2() failed, error = %d\n", errno);
 		close();
 		return ERR_BROKEN;
 	}
 	
-	speed_t baudrate = getBaudrate(speed);
-	if (baudrate == B0) {
-		LOGE("%s - invalid speed: %d\n", device.c_str(), speed);
+	if (profile.speed <= 0) {
+		LOGE("%s - invalid speed: %d\n", device.c_str(), profile.speed);
 		close();
 		return ERR_BROKEN;
 	}
 	
+	// Standard baudrate or termios2 for others
+	speed_t baudrate = getBaudrate(profile.speed);
+	
 	m_fd = ::open(device.c_str(), O_RDWR | O_NOCTTY | O_NDELAY | O_NONBLOCK);
 	if (m_fd < 0) {
 		LOGE("%s - open error: %d\n", device.c_str(), m_fd);
@@ -73,20 +110,74 @@ int Serial::open(std::string device, int speed) {
 		return ERR_BROKEN;
 	}
 	
-	cfsetispeed(&config, baudrate);
-	cfsetospeed(&config, baudrate);
+	if (baudrate != B0) {
+		cfsetispeed(&config, baudrate);
+		cfsetospeed(&config, baudrate);
+	}
+	
 	cfmakeraw(&config);
 	
+	config.c_cc[VMIN] = profile.vmin;
+	config.c_cc[VTIME] = profile.vtime;
+	
 	if (tcsetattr(m_fd, TCSANOW, &config) != 0) {
 		LOGE("%s - can't set termios config\n", device.c_str());
 		close();
 		return ERR_BROKEN;
 	}
 	
+	if (baudrate == B0 && setTermios2Speed(m_fd, profile.speed) != 0) {
+		LOGE("%s - can't set custom speed %d, errno = %d\n", device.c_str(), profile.speed, errno);
+		close();
+		return ERR_BROKEN;
+	}
+	
+	// Not critical, virtual ports often not supports this
+	if (profile.low_latency && !setLowLatency(true))
+		LOGE("%s - can't enable low latency mode, errno = %d\n", device.c_str(), errno);
+	
+	m_read_chunk = profile.read_chunk;
+	
 	return 0;
 }
 
+/*
+ * Use already opened non-tty fd (socket, pipe), serial takes ownership of fd
+ * */
+int Serial::attach(int fd) {
+	if (pipe2(m_wake_fds, O_CLOEXEC | O_NONBLOCK) < 0) {
+		LOGE("pipe2() failed, error = %d\n", errno);
+		::close(fd);
+		close();
+		return ERR_BROKEN;
+	}
+	
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+	m_fd = fd;
+	m_read_chunk = 0;
+	
+	return 0;
+}
+
+bool Serial::setLowLatency(bool enable) {
+	struct serial_struct serial;
+	
+	if (ioctl(m_fd, TIOCGSERIAL, &serial) != 0)
+		return false;
+	
+	if (enable) {
+		serial.flags |= ASYNC_LOW_LATENCY;
+	} else {
+		serial.flags &= ~ASYNC_LOW_LATENCY;
+	}
+	
+	return ioctl(m_fd, TIOCSSERIAL, &serial) == 0;
+}
+
 int Serial::readChunk(char *data, int size, int timeout_ms) {
+	if (m_read_chunk > 0 && size > m_read_chunk)
+		size = m_read_chunk;
+	
 	struct pollfd pfd[2] = {
 		{.fd = m_fd, .events = POLLIN},
 		{.fd = m_wake_fds[0], .events = POLLIN}
@@ -115,12 +206,14 @@ int Serial::readChunk(char *data, int size, int timeout_ms) {
 			return ERR_IO;
 		}
 		
+		if (m_trace.isOpened())
+			m_trace.add(SerialTrace::READ, data, ret);
+		
 		return ret;
 	}
 	
 	if ((pfd[1].revents & POLLIN)) {
-		char buf[4];
-		while (::read(m_wake_fds[0], buf, 4) > 0 || errno == EINTR);
+		clearBreak();
 		return ERR_INTR;
 	}
 	
@@ -156,12 +249,14 @@ int Serial::writeChunk(const char *data, int size, int timeout_ms) {
 			return ERR_IO;
 		}
 		
+		if (m_trace.isOpened())
+			m_trace.add(SerialTrace::WRITE, data, ret);
+		
 		return ret;
 	}
 	
 	if ((pfd[1].revents & POLLIN)) {
-		char buf[4];
-		while (::read(m_wake_fds[0], buf, 4) > 0 || errno == EINTR);
+		clearBreak();
 		return ERR_INTR;
 	}
 	
@@ -225,6 +320,19 @@ speed_t Serial::getBaudrate(int speed) {
 		case 115200:	return B115200;
 		case 230400:	return B230400;
 		case 460800:	return B460800;
+#ifdef B500000
+		case 500000:	return B500000;
+		case 576000:	return B576000;
+		case 921600:	return B921600;
+		case 1000000:	return B1000000;
+		case 1152000:	return B1152000;
+		case 1500000:	return B1500000;
+		case 2000000:	return B2000000;
+		case 2500000:	return B2500000;
+		case 3000000:	return B3000000;
+		case 3500000:	return B3500000;
+		case 4000000:	return B4000000;
+#endif
 	}
 	return B0;
 }
@@ -4,11 +4,9 @@
 #include <termios.h>
 
 #include "Utils.h"
+#include "SerialTrace.h"
 
 class Serial {
-	protected:
-		int m_fd = -1;
-	
 	public:
 		enum Errors {
 			ERR_SUCCESS		= 0,
@@ -17,20 +15,62 @@ class Serial {
 			ERR_INTR		= -3
 		};
 		
-		Serial();
-		~Serial();
+		struct Profile {
+			// Any baudrate, non-standard rates set using termios2
+			int speed = 115200;
+			
+			// ASYNC_LOW_LATENCY: push received data to tty without delay (if supported by driver)
+			bool low_latency = false;
+			
+			// Min bytes for wake up poll()/read() when vtime=0, inter-byte timeout (1/10 s) when vtime>0
+			int vmin = 1;
+			int vtime = 0;
+			
+			// Max bytes per one read(), 0 - all available buffer space
+			int read_chunk = 0;
+		};
+	protected:
+		int m_fd = -1;
+		int m_read_chunk = 0;
+		
+		// Optional recorder of all traffic
+		SerialTrace m_trace;
 		
+		// Pipe for interrupting blocked read/write, see breakTransfer()
 		int m_wake_fds[2] = {-1, -1};
 		
+		bool setLowLatency(bool enable);
+	public:
+		Serial();
+		~Serial();
+		
 		static speed_t getBaudrate(int speed);
 		
 		int open(std::string device, int speed);
+		int open(std::string device, const Profile &profile);
+		int attach(int fd);
 		int close();
+		
+		inline int getFd() {
+			return m_fd;
+		}
+		
+		// Readable after breakTransfer(), for external poll() loops
+		inline int getWakeFd() {
+			return m_wake_fds[0];
+		}
+		void clearBreak();
 		void breakTransfer();
 		
+		// Line break, for abort command in progress
+		int sendBreak();
+		
 		int read(char *data, int size, int timeout_ms = 10000);
 		int write(const char *data, int size, int timeout_ms = 10000);
 		
 		int readChunk(char *data, int size, int timeout_ms = 10000);
 		int writeChunk(const char *data, int size, int timeout_ms = 10000);
+		
+		bool startRecording(const std::string &path);
+		void stopRecording();
 };
@@ -0,0 +1,168 @@
+#include "SerialReplay.h"
+
+#include <cstdint>
+#include <algorithm>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "Log.h"
+
+SerialReplay::SerialReplay() {
+	
+}
+
+SerialReplay::~SerialReplay() {
+	close();
+}
+
+int SerialReplay::open(const std::string &trace, bool realtime) {
+	close();
+	
+	m_records.clear();
+	if (!SerialTrace::load(trace, &m_records))
+		return ERR_IO;
+	
+	int fds[2];
+	if (socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, fds) != 0) {
+		LOGE("socketpair() failed, error = %d\n", errno);
+		return ERR_IO;
+	}
+	
+	if (attach(fds[0]) != 0) {
+		::close(fds[1]);
+		return ERR_IO;
+	}
+	
+	m_peer_fd = fds[1];
+	m_realtime = realtime;
+	m_stop = false;
+	m_finished = false;
+	m_diverged = false;
+	m_expected.clear();
+	m_written = 0;
+	
+	if (pthread_create(&m_thread, nullptr, replayThread, this) != 0) {
+		LOGE("Can't create replay thread, errno=%d\n", errno);
+		close();
+		return ERR_IO;
+	}
+	m_thread_created = true;
+	
+	LOGD("Replay %s: %d records\n", trace.c_str(), static_cast<int>(m_records.size()));
+	
+	return 0;
+}
+
+int SerialReplay::close() {
+	if (m_thread_created) {
+		m_stop = true;
+		pthread_join(m_thread, nullptr);
+		m_thread_created = false;
+	}
+	
+	if (m_peer_fd != -1) {
+		::close(m_peer_fd);
+		m_peer_fd = -1;
+	}
+	
+	return Serial::close();
+}
+
+void *SerialReplay::replayThread(void *arg) {
+	SerialReplay *self = static_cast<SerialReplay *>(arg);
+	self->replayLoop();
+	return nullptr;
+}
+
+void SerialReplay::handleWritten(const char *data, size_t size) {
+	bool matched = m_written + size <= m_expected.size() && m_expected.compare(m_written, size, data, size) == 0;
+	if (!m_diverged && !matched) {
+		LOGE("Replay diverged at write offset %d\n", static_cast<int>(m_written));
+		m_diverged = true;
+	}
+	m_written += size;
+}
+
+bool SerialReplay::waitWritten(size_t size) {
+	char buffer[4096];
+	
+	while (!m_stop) {
+		struct pollfd pfd = {.fd = m_peer_fd, .events = POLLIN, .revents = 0};
+		int timeout = m_written >= size ? 0 : 100;
+		
+		int ret = poll(&pfd, 1, timeout);
+		if (ret < 0 && errno != EINTR)
+			return false;
+		
+		if (ret > 0 && (pfd.revents & POLLIN)) {
+			int readed = ::read(m_peer_fd, buffer, sizeof(buffer));
+			if (readed > 0) {
+				handleWritten(buffer, readed);
+				continue;
+			}
+		}
+		
+		if (ret > 0 && (pfd.revents & (POLLERR | POLLHUP)))
+			return false;
+		
+		if (m_written >= size)
+			return true;
+	}
+	return false;
+}
+
+void SerialReplay::replayLoop() {
+	size_t required = 0;
+	uint64_t last_write_time = 0;
+	
+	// Trace time is counted from last point, when real and trace time were synchronized
+	int64_t anchor_real = getCurrentTimestamp();
+	uint64_t anchor_trace = 0;
+	
+	for (auto &record: m_records) {
+		if (record.dir == SerialTrace::WRITE) {
+			m_expected += record.data;
+			required += record.data.size();
+			last_write_time = record.time;
+			continue;
+		}
+		
+		// Response can't be sent before command
+		bool waited = m_written < required;
+		if (!waitWritten(required))
+			return;
+		
+		if (m_realtime) {
+			// Original latency is counted from actual moment of command
+			if (waited) {
+				anchor_real = getCurrentTimestamp();
+				anchor_trace = last_write_time;
+			}
+			
+			int64_t delay = anchor_real + static_cast<int64_t>(record.time - anchor_trace) / 1000 - getCurrentTimestamp();
+			while (delay > 0 && !m_stop) {
+				usleep(std::min(delay, static_cast<int64_t>(100)) * 1000);
+				delay = anchor_real + static_cast<int64_t>(record.time - anchor_trace) / 1000 - getCurrentTimestamp();
+			}
+		}
+		
+		size_t written = 0;
+		while (written < record.data.size() && !m_stop) {
+			int ret = ::write(m_peer_fd, record.data.data() + written, record.data.size() - written);
+			if (ret < 0) {
+				if (errno == EINTR || errno == EAGAIN)
+					continue;
+				return;
+			}
+			written += ret;
+		}
+	}
+	
+	m_finished = true;
+	LOGD("Replay finished\n");
+	
+	// Keep channel alive and consume commands, which were not in trace
+	waitWritten(SIZE_MAX);
+}
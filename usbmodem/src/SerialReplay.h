@@ -0,0 +1,57 @@
+#pragma once
+
+#include <pthread.h>
+
+#include <string>
+#include <vector>
+#include <atomic>
+
+#include "Serial.h"
+#include "SerialTrace.h"
+
+/*
+ * Serial, which serves recorded trace instead of real modem
+ * Every response is released only after replayed side wrote same amount of bytes, as in original session.
+ * So, replay is deterministic in both modes: realtime (original latency) and fast (no delays).
+ * */
+class SerialReplay: public Serial {
+	protected:
+		std::vector<SerialTrace::Record> m_records;
+		bool m_realtime = true;
+		
+		int m_peer_fd = -1;
+		std::atomic<bool> m_stop{false};
+		std::atomic<bool> m_finished{false};
+		std::atomic<bool> m_diverged{false};
+		bool m_thread_created = false;
+		pthread_t m_thread = 0;
+		
+		// Recorded write stream, for checking replayed commands
+		std::string m_expected;
+		size_t m_written = 0;
+		
+		static void *replayThread(void *arg);
+		void replayLoop();
+		bool waitWritten(size_t size);
+		void handleWritten(const char *data, size_t size);
+	public:
+		SerialReplay();
+		~SerialReplay();
+		
+		int open(const std::string &trace, bool realtime = true);
+		int close();
+		
+		// All records of trace are served
+		inline bool isFinished() {
+			return m_finished;
+		}
+		
+		// Replayed side sent something different from original session
+		inline bool isDiverged() {
+			return m_diverged;
+		}
+		
+		inline size_t getRecordsCount() {
+			return m_records.size();
+		}
+};
@@ -0,0 +1,117 @@
+#include "SerialTrace.h"
+
+#include <ctime>
+
+#include "Log.h"
+#include "Utils.h"
+
+static const char TRACE_MAGIC[] = "UMTRACE1";
+
+SerialTrace::SerialTrace() {
+	
+}
+
+SerialTrace::~SerialTrace() {
+	close();
+}
+
+int64_t SerialTrace::getTimeUs() {
+	struct timespec tm = {};
+	clock_gettime(CLOCK_MONOTONIC, &tm);
+	return static_cast<int64_t>(tm.tv_sec) * 1000000 + tm.tv_nsec / 1000;
+}
+
+bool SerialTrace::create(const std::string &path) {
+	close();
+	
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	m_file = fopen(path.c_str(), "wb");
+	if (!m_file) {
+		LOGE("Can't create trace %s, errno = %d\n", path.c_str(), errno);
+		return false;
+	}
+	
+	fwrite(TRACE_MAGIC, 1, strlen(TRACE_MAGIC), m_file);
+	m_last_time = getTimeUs();
+	
+	return true;
+}
+
+void SerialTrace::close() {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	if (m_file) {
+		fclose(m_file);
+		m_file = nullptr;
+	}
+}
+
+void SerialTrace::writeVarint(FILE *fp, uint64_t value) {
+	uint8_t buffer[10];
+	int size = 0;
+	
+	do {
+		buffer[size] = value & 0x7F;
+		value >>= 7;
+		if (value)
+			buffer[size] |= 0x80;
+		size++;
+	} while (value);
+	
+	fwrite(buffer, 1, size, fp);
+}
+
+bool SerialTrace::readVarint(const std::string &data, size_t *offset, uint64_t *value) {
+	*value = 0;
+	for (int shift = 0; shift < 64 && *offset < data.size(); shift += 7) {
+		uint8_t c = data[(*offset)++];
+		*value |= static_cast<uint64_t>(c & 0x7F) << shift;
+		if (!(c & 0x80))
+			return true;
+	}
+	return false;
+}
+
+void SerialTrace::add(Direction dir, const char *data, size_t size) {
+	std::lock_guard<std::mutex> lock(m_mutex);
+	
+	if (!m_file || !size)
+		return;
+	
+	int64_t now = getTimeUs();
+	writeVarint(m_file, (static_cast<uint64_t>(now - m_last_time) << 1) | dir);
+	writeVarint(m_file, size);
+	fwrite(data, 1, size, m_file);
+	
+	// Don't lose trace, when daemon killed
+	fflush(m_file);
+	
+	m_last_time = now;
+}
+
+bool SerialTrace::load(const std::string &path, std::vector<Record> *records) {
+	std::string data = readFile(path);
+	
+	if (data.compare(0, strlen(TRACE_MAGIC), TRACE_MAGIC) != 0) {
+		LOGE("%s is not serial trace\n", path.c_str());
+		return false;
+	}
+	
+	uint64_t time = 0;
+	size_t offset = strlen(TRACE_MAGIC);
+	
+	while (offset < data.size()) {
+		uint64_t header, size;
+		if (!readVarint(data, &offset, &header) || !readVarint(data, &offset, &size) || data.size() - offset < size) {
+			LOGE("%s: truncated record at %d\n", path.c_str(), static_cast<int>(offset));
+			break;
+		}
+		
+		time += header >> 1;
+		records->push_back({static_cast<Direction>(header & 1), time, data.substr(offset, size)});
+		offset += size;
+	}
+	
+	return true;
+}
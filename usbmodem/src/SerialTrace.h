@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstdio>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <mutex>
+
+/*
+ * Compact trace of serial traffic
+ * File: "UMTRACE1" magic, then records: varint(delta_us << 1 | direction), varint(size), data
+ * Time delta is relative to previous record, reads and writes are two interleaved streams.
+ * */
+class SerialTrace {
+	public:
+		enum Direction: uint8_t {
+			READ	= 0,
+			WRITE	= 1
+		};
+		
+		struct Record {
+			Direction dir;
+			
+			// Time since start of trace (us)
+			uint64_t time;
+			
+			std::string data;
+		};
+	protected:
+		FILE *m_file = nullptr;
+		int64_t m_last_time = 0;
+		std::mutex m_mutex;
+		
+		static int64_t getTimeUs();
+		static void writeVarint(FILE *fp, uint64_t value);
+		static bool readVarint(const std::string &data, size_t *offset, uint64_t *value);
+	public:
+		SerialTrace();
+		~SerialTrace();
+		
+		SerialTrace(const SerialTrace &) = delete;
+		SerialTrace &operator=(const SerialTrace &) = delete;
+		
+		bool create(const std::string &path);
+		void close();
+		void add(Direction dir, const char *data, size_t size);
+		
+		inline bool isOpened() {
+			return m_file != nullptr;
+		}
+		
+		static bool load(const std::string &path, std::vector<Record> *records);
+};
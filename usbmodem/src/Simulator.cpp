@@ -0,0 +1,33 @@
+#include <string>
+
+#include <unistd.h>
+
+#include "Asr1802Simulator.h"
+#include "Log.h"
+#include "Utils.h"
+
+/*
+ * usbmodem-simulator [script]
+ * */
+int main(int argc, char *argv[]) {
+	Asr1802Simulator sim;
+	
+	if (!sim.start()) {
+		LOGE("Can't create PTY\n");
+		return -1;
+	}
+	
+	LOGD("ASR1802 simulator: %s\n", sim.getTty().c_str());
+	
+	if (argc >= 2) {
+		std::string script = readFile(argv[1]);
+		if (!script.size() || !sim.runScript(script))
+			return -1;
+	}
+	
+	// Serve until killed
+	while (true)
+		pause();
+	
+	return 0;
+}
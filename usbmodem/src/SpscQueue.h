@@ -0,0 +1,51 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+/*
+ * Bounded lock-free queue for exactly one producer and one consumer thread
+ * Slots are written and read in place and never destroyed, so items with own storage (std::string)
+ * keep their capacity and don't allocate after warmup.
+ * */
+template <typename T, size_t N>
+class SpscQueue {
+	static_assert(N > 0 && (N & (N - 1)) == 0, "Queue size must be power of two");
+	
+	protected:
+		T m_slots[N];
+		
+		// Separate cache lines, consumer and producer don't invalidate each other
+		alignas(64) std::atomic<size_t> m_head{0};
+		alignas(64) std::atomic<size_t> m_tail{0};
+	public:
+		// Producer: free slot for writing, nullptr if queue is full
+		inline T *back() {
+			size_t tail = m_tail.load(std::memory_order_relaxed);
+			if (tail - m_head.load(std::memory_order_acquire) >= N)
+				return nullptr;
+			return &m_slots[tail & (N - 1)];
+		}
+		
+		// Producer: publish slot returned by back()
+		inline void push() {
+			m_tail.store(m_tail.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+		
+		// Consumer: oldest item, nullptr if queue is empty
+		inline T *front() {
+			size_t head = m_head.load(std::memory_order_relaxed);
+			if (head == m_tail.load(std::memory_order_acquire))
+				return nullptr;
+			return &m_slots[head & (N - 1)];
+		}
+		
+		// Consumer: release slot returned by front()
+		inline void pop() {
+			m_head.store(m_head.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+		}
+		
+		inline size_t size() {
+			return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+		}
+};
@@ -0,0 +1,21 @@
+#include "Termios2.h"
+
+#include <asm/termbits.h>
+#include <sys/ioctl.h>
+
+int setTermios2Speed(int fd, int speed) {
+	struct termios2 config;
+	
+	if (ioctl(fd, TCGETS2, &config) != 0)
+		return -1;
+	
+	config.c_cflag &= ~CBAUD;
+	config.c_cflag |= BOTHER;
+	config.c_ospeed = speed;
+	
+	config.c_cflag &= ~(CBAUD << IBSHIFT);
+	config.c_cflag |= BOTHER << IBSHIFT;
+	config.c_ispeed = speed;
+	
+	return ioctl(fd, TCSETS2, &config);
+}
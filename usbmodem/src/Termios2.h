@@ -0,0 +1,7 @@
+#pragma once
+
+/*
+ * Arbitrary baudrate using termios2 (BOTHER)
+ * Separate unit, because <asm/termbits.h> conflicts with <termios.h>.
+ * */
+int setTermios2Speed(int fd, int speed);
@@ -316,6 +316,13 @@ std::string readFile(std::string path) {
 	return std::string((std::istreambuf_iterator<char>(s)), std::istreambuf_iterator<char>());
 }
 
+bool writeFile(std::string path, const std::string &data) {
+	std::ofstream s(path, std::ios::binary | std::ios::trunc);
+	s << data;
+	s.close();
+	return !s.fail();
+}
+
 std::string trim(std::string s) {
 	s.erase(s.begin(), std::find_if(s.begin(), s.end(), [](uint8_t c) {
 		return !isspace(c);
@@ -413,3 +420,66 @@ std::string findNetByTTY(std::string url) {
 	
 	return "";
 }
+
+// ttyACM: <iface>/tty/<name>, ttyUSB (usb-serial): <iface>/<name>/tty/<name>
+static std::string findIfaceTTYName(const std::filesystem::path &iface_path) {
+	std::error_code ec, err;
+	std::filesystem::directory_iterator end;
+	
+	for (auto it = std::filesystem::directory_iterator(iface_path / "tty", ec); !ec && it != end; it.increment(ec)) {
+		if (std::filesystem::exists(it->path() / "dev", err))
+			return it->path().filename().string();
+	}
+	
+	ec.clear();
+	for (auto it = std::filesystem::directory_iterator(iface_path, ec); !ec && it != end; it.increment(ec)) {
+		std::string name = it->path().filename().string();
+		if (strStartsWith(name, "tty") && std::filesystem::exists(it->path() / "tty" / name / "dev", err))
+			return name;
+	}
+	
+	return "";
+}
+
+std::vector<std::string> findSiblingTTYs(std::string url) {
+	std::vector<std::pair<int, std::string>> found;
+	std::vector<std::string> result;
+	std::error_code ec, err;
+	
+	if (!strStartsWith(url, "/dev/tty"))
+		return result;
+	
+	std::string dev_name = std::filesystem::path(url).filename().string();
+	
+	// Interface (ttyACM) or usb-serial port (ttyUSB), USB device is somewhere above
+	std::filesystem::path usb_dev_path = std::filesystem::canonical("/sys/class/tty/" + dev_name + "/device", ec);
+	if (ec)
+		return result;
+	
+	while (usb_dev_path.has_relative_path() && !std::filesystem::exists(usb_dev_path / "idVendor", err))
+		usb_dev_path = usb_dev_path.parent_path();
+	
+	if (!usb_dev_path.has_relative_path())
+		return result;
+	
+	std::filesystem::directory_iterator end;
+	for (auto it = std::filesystem::directory_iterator(usb_dev_path, ec); !ec && it != end; it.increment(ec)) {
+		std::string iface_path = it->path().string();
+		if (!std::filesystem::exists(iface_path + "/bInterfaceNumber", err))
+			continue;
+		
+		std::string tty_name = findIfaceTTYName(it->path());
+		if (tty_name.size() > 0 && tty_name != dev_name) {
+			int iface = strToInt(readFile(iface_path + "/bInterfaceNumber"), 16);
+			found.push_back({iface, "/dev/" + tty_name});
+		}
+	}
+	
+	// Same order as interfaces of USB device
+	std::sort(found.begin(), found.end());
+	
+	for (auto &it: found)
+		result.push_back(it.second);
+	
+	return result;
+}
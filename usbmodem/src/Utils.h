@@ -4,6 +4,8 @@
 
 #include <cmath>
 #include <string>
+#include <string_view>
+#include <cstring>
 #include <cerrno>
 #include <cstdint>
 #include <vector>
@@ -37,6 +39,10 @@ static inline bool strStartsWith(const std::string &a, const std::string &b) {
 	return a.size() >= b.size() && memcmp(a.c_str(), b.c_str(), b.size()) == 0;
 }
 
+static inline bool strStartsWith(std::string_view a, std::string_view b) {
+	return a.size() >= b.size() && memcmp(a.data(), b.data(), b.size()) == 0;
+}
+
 void setTimespecTimeout(struct timespec *tm, int timeout);
 
 static inline int hex2byte(char c) {
@@ -74,6 +80,7 @@ std::string strJoin(const std::vector<std::string> &lines, const std::string &de
 std::string strprintf(const char *format, ...);
 std::string trim(std::string s);
 std::string readFile(std::string path);
+bool writeFile(std::string path, const std::string &data);
 std::string findUsbIface(std::string dev_path, int iface);
 std::string findUsbDevice(int vid, int pid);
 std::string findUsbTTYName(const std::string &iface_path);
@@ -81,4 +88,5 @@ std::string findUsbNetName(const std::string &iface_path);
 std::string findUsbTTY(int vid, int pid, int iface);
 std::string findTTY(std::string url);
 std::string findNetByTTY(std::string url);
+std::vector<std::string> findSiblingTTYs(std::string url);
 std::string getDefaultNetmask(const std::string &ip);